@@ -0,0 +1,538 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+
+#include "common.h"
+#include "modarith.h"
+#include "prime_factorial.h"
+#include "range_kernel.h"
+
+#define DEFAULT_N 20000000
+#define DEFAULT_TRIALS 7
+#define MAX_TRIALS 101
+#define MAX_LENGTHS 16
+
+// Прежняя реализация MultModulo (сдвиг и сложение), оставлена для сравнения
+static uint64_t MultModuloShiftAdd(uint64_t a, uint64_t b, uint64_t mod) {
+    uint64_t result = 0;
+    a = a % mod;
+    while (b > 0) {
+        if (b % 2 == 1)
+            result = (result + a) % mod;
+        a = (a * 2) % mod;
+        b /= 2;
+    }
+    return result % mod;
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Каждый вариант считает произведение чисел [1, n] как цепочку зависимых умножений
+static uint64_t ChainShiftAdd(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    (void)ctx;
+    uint64_t acc = 1;
+    for (uint64_t i = 1; i <= n; i++)
+        acc = MultModuloShiftAdd(acc, i, mod);
+    return acc;
+}
+
+static uint64_t ChainMultModulo(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    (void)ctx;
+    uint64_t acc = 1;
+    for (uint64_t i = 1; i <= n; i++)
+        acc = MultModulo(acc, i, mod);
+    return acc;
+}
+
+static uint64_t ChainWide(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    (void)ctx;
+    uint64_t acc = 1 % mod;
+    for (uint64_t i = 1; i <= n; i++)
+        acc = ModMulWide(acc, i % mod, mod);
+    return acc;
+}
+
+static uint64_t ChainBarrett(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    uint64_t acc = 1 % mod;
+    for (uint64_t i = 1; i <= n; i++)
+        acc = ModMulBarrett(ctx, acc, i % mod);
+    return acc;
+}
+
+static uint64_t ChainMontgomery(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    uint64_t acc = MontEnter(ctx, 1);
+    for (uint64_t i = 1; i <= n; i++)
+        acc = MontMul(ctx, acc, MontEnter(ctx, i % mod));
+    return MontLeave(ctx, acc);
+}
+
+static uint64_t ChainRangeProduct(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    (void)mod;
+    return ModRangeProduct(ctx, 1, n);
+}
+
+// Factorial() целиком, как его вызывает сервер: для простых mod < 2^32
+// включается сублинейный движок, поэтому умножений на число меньше n
+static uint64_t ChainFactorial(uint64_t n, uint64_t mod, const struct ModContext *ctx) {
+    (void)ctx;
+    struct FactorialArgs args = {1, n, mod};
+    return Factorial(&args);
+}
+
+struct Variant {
+    const char *name;
+    uint64_t (*run)(uint64_t n, uint64_t mod, const struct ModContext *ctx);
+    bool needs_barrett;
+    bool needs_montgomery;
+    uint64_t scale; // во сколько раз уменьшить n для медленных вариантов
+};
+
+static const struct Variant variants[] = {
+    {"shift-add (old)", ChainShiftAdd, false, false, 16},
+    {"MultModulo", ChainMultModulo, false, false, 1},
+    {"wide __int128", ChainWide, false, false, 1},
+    {"barrett", ChainBarrett, true, false, 1},
+    {"montgomery", ChainMontgomery, false, true, 1},
+    {"ModRangeProduct", ChainRangeProduct, false, false, 1},
+    {"Factorial()", ChainFactorial, false, false, 1},
+};
+
+static const enum RangeKernel kernels[] = {
+    RANGE_KERNEL_SERIAL, RANGE_KERNEL_SCALAR_LANES, RANGE_KERNEL_AVX2, RANGE_KERNEL_AVX512_IFMA,
+};
+
+struct Modulus {
+    uint64_t mod;
+    const char *label;
+};
+
+static const struct Modulus moduli[] = {
+    {97ULL, "small prime"},
+    {1000000ULL, "small composite"},
+    {1000000007ULL, "30-bit prime"},
+    {998244353ULL, "30-bit prime"},
+    {4294967291ULL, "32-bit prime"},
+    {4294967295ULL, "32-bit composite"},
+    {(1ULL << 50) - 27, "50-bit prime"},
+    {(1ULL << 61) - 1, "61-bit Mersenne prime"},
+    {(1ULL << 62) - 57, "62-bit prime"},
+    {(1ULL << 62) + 2, "63-bit even composite"},
+    {18446744073709551557ULL, "64-bit prime"},
+    {18446744073709551615ULL, "64-bit odd composite"},
+};
+
+// Аппаратные счётчики тактов и инструкций одной группой на этот поток
+struct PerfCounters {
+    bool enabled;
+    int cycles_fd;
+    int instructions_fd;
+};
+
+static bool PerfOpen(struct PerfCounters *perf) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    perf->cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf->cycles_fd < 0)
+        return false;
+
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 0;
+    perf->instructions_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, perf->cycles_fd, 0);
+    if (perf->instructions_fd < 0) {
+        close(perf->cycles_fd);
+        return false;
+    }
+    perf->enabled = true;
+    return true;
+}
+
+static void PerfStart(const struct PerfCounters *perf) {
+    ioctl(perf->cycles_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void PerfStop(const struct PerfCounters *perf, uint64_t *cycles, uint64_t *instructions) {
+    ioctl(perf->cycles_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    struct {
+        uint64_t count;
+        uint64_t values[2];
+    } data;
+    if (read(perf->cycles_fd, &data, sizeof(data)) != (ssize_t)sizeof(data) || data.count != 2) {
+        *cycles = 0;
+        *instructions = 0;
+        return;
+    }
+    *cycles = data.values[0];
+    *instructions = data.values[1];
+}
+
+struct BenchConfig {
+    int trials;
+    int warmup;
+    struct PerfCounters perf;
+    FILE *csv;
+};
+
+// Что измеряется: вариант цепочки на [1, n] или ядро на [begin, begin + length)
+struct BenchCase {
+    const struct Variant *variant;
+    enum RangeKernel kernel;
+    uint64_t begin;
+    uint64_t length;
+    uint64_t reps;              // вызовов за одно испытание, для коротких диапазонов
+};
+
+struct Measurement {
+    double ns;                  // медиана, нс на умножение
+    double mad;                 // медианное абсолютное отклонение ns
+    double per_cycle;           // умножений за такт, медиана
+    double ipc;                 // инструкций за такт, 0 без счётчиков
+    uint64_t result;
+};
+
+static uint64_t RunCase(const struct BenchCase *bench, const struct ModContext *ctx) {
+    uint64_t result = 0;
+    for (uint64_t r = 0; r < bench->reps; r++) {
+        if (bench->variant != NULL)
+            result ^= bench->variant->run(bench->length, ctx->mod, ctx);
+        else
+            result ^= RangeProductWith(bench->kernel, ctx, bench->begin,
+                                       bench->begin + bench->length - 1);
+    }
+    return result;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double Median(double *values, int count) {
+    qsort(values, (size_t)count, sizeof(double), CompareDoubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Прогрев, затем trials испытаний. Такты берутся из perf, а без него из TSC:
+// это опорная частота, а не текущая частота ядра.
+static void Measure(const struct BenchConfig *config, const struct BenchCase *bench,
+                    const struct ModContext *ctx, struct Measurement *out) {
+    for (int w = 0; w < config->warmup; w++)
+        out->result = RunCase(bench, ctx);
+
+    double ns[MAX_TRIALS];
+    double per_cycle[MAX_TRIALS];
+    double ipc[MAX_TRIALS];
+    double ops = (double)bench->length * (double)bench->reps;
+    for (int t = 0; t < config->trials; t++) {
+        uint64_t cycles;
+        uint64_t instructions = 0;
+        double start = NowSeconds();
+        if (config->perf.enabled) {
+            PerfStart(&config->perf);
+            out->result = RunCase(bench, ctx);
+            PerfStop(&config->perf, &cycles, &instructions);
+        } else {
+            uint64_t tsc = __rdtsc();
+            out->result = RunCase(bench, ctx);
+            cycles = __rdtsc() - tsc;
+        }
+        ns[t] = (NowSeconds() - start) * 1e9 / ops;
+        per_cycle[t] = cycles ? ops / (double)cycles : 0;
+        ipc[t] = cycles ? (double)instructions / (double)cycles : 0;
+    }
+
+    out->ns = Median(ns, config->trials);
+    for (int t = 0; t < config->trials; t++)
+        ns[t] = ns[t] > out->ns ? ns[t] - out->ns : out->ns - ns[t];
+    out->mad = Median(ns, config->trials);
+    out->per_cycle = Median(per_cycle, config->trials);
+    out->ipc = Median(ipc, config->trials);
+}
+
+static void PrintMeasurement(const struct BenchConfig *config, const char *name,
+                             const struct Measurement *m) {
+    printf("  %-22s %9.3f ns/op ±%6.3f  %6.3f mul/cycle", name, m->ns, m->mad, m->per_cycle);
+    if (config->perf.enabled)
+        printf("  IPC %.2f", m->ipc);
+}
+
+static void WriteCsv(const struct BenchConfig *config, uint64_t mod, const char *name,
+                     uint64_t length, const struct Measurement *m) {
+    if (config->csv != NULL)
+        fprintf(config->csv, "%lu,%s,%lu,%.4f,%.4f,%.4f,%.3f\n", mod, name, length, m->ns, m->mad,
+                m->per_cycle, m->ipc);
+}
+
+// Ядра из range_kernel на диапазонах разной длины и побитовое совпадение с
+// последовательной цепочкой на случайных диапазонах
+static int BenchKernels(const struct BenchConfig *config, const struct ModContext *ctx,
+                        uint64_t n, uint64_t expected, const uint64_t *lengths, int length_count) {
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!RangeKernelSupported(kernels[k], ctx->mod))
+            continue;
+
+        struct BenchCase bench = {NULL, kernels[k], 1, n, 1};
+        struct Measurement m;
+        Measure(config, &bench, ctx, &m);
+        int mismatches = m.result != expected;
+
+        srand(12345);
+        for (int t = 0; t < 2000; t++) {
+            uint64_t begin = ((uint64_t)rand() << 31 | (uint64_t)rand()) % ctx->mod;
+            uint64_t len = (uint64_t)rand() % 5000;
+            if (t % 7 == 0)
+                begin = ctx->mod - 1 - len / 2; // диапазон, пересекающий кратное mod
+            uint64_t end = begin + len;
+            if (RangeProductWith(kernels[k], ctx, begin, end) != ModRangeProduct(ctx, begin, end))
+                mismatches++;
+        }
+        failures += mismatches;
+
+        char name[64];
+        snprintf(name, sizeof(name), "kernel %s", RangeKernelName(kernels[k]));
+        PrintMeasurement(config, name, &m);
+        printf("  %s\n", mismatches == 0 ? "bit-exact" : "MISMATCH");
+        WriteCsv(config, ctx->mod, name, n, &m);
+
+        // Короткие диапазоны повторяются, чтобы испытание длилось около n умножений
+        if (length_count == 0)
+            continue;
+        printf("  %-22s", "  by length");
+        for (int l = 0; l < length_count; l++) {
+            uint64_t length = lengths[l];
+            if (length >= ctx->mod)
+                continue;
+            struct BenchCase by_length = {NULL, kernels[k], 1, length, n / length ? n / length : 1};
+            Measure(config, &by_length, ctx, &m);
+            printf("  %lu: %.3f", length, m.ns);
+            WriteCsv(config, ctx->mod, name, length, &m);
+        }
+        printf(" ns/op\n");
+    }
+    return failures;
+}
+
+// Сублинейный n! для простых модулей против линейного ядра на длинном диапазоне
+static int BenchPrime(const struct ModContext *ctx) {
+    if (ctx->mod >= (1ULL << 32) || ctx->mod < 1000 || !IsPrime64(ctx->mod))
+        return 0;
+
+    uint64_t begin = ctx->mod / 7;
+    uint64_t end = ctx->mod / 2 + ctx->mod / 5;
+
+    double start = NowSeconds();
+    uint64_t fast = PrimeRangeProduct(ctx, begin, end);
+    double fast_time = NowSeconds() - start;
+
+    start = NowSeconds();
+    uint64_t linear = RangeProduct(ctx, begin, end);
+    double linear_time = NowSeconds() - start;
+
+    printf("  prime engine [%lu, %lu]: %.3f s vs linear %.3f s  %s\n", begin, end, fast_time,
+           linear_time, fast == linear ? "match" : "MISMATCH");
+    return fast == linear ? 0 : 1;
+}
+
+static int ParseLengths(const char *text, uint64_t *lengths) {
+    char *copy = strdup(text);
+    int count = 0;
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (count == MAX_LENGTHS || !ConvertStringToUI64(item, &lengths[count]) ||
+            lengths[count] == 0) {
+            free(copy);
+            return -1;
+        }
+        count++;
+    }
+    free(copy);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    uint64_t n = DEFAULT_N;
+    struct BenchConfig config = {DEFAULT_TRIALS, 1, {false, -1, -1}, NULL};
+    int cpu = -2;                       // -2: текущий процессор, -1: не закреплять
+    bool use_perf = false;
+    const char *filter = NULL;
+    uint64_t lengths[MAX_LENGTHS] = {16, 256, 4096, 65536};
+    int length_count = 4;
+
+    while (true) {
+        static struct option options[] = {
+            {"n", required_argument, 0, 0},
+            {"trials", required_argument, 0, 0},
+            {"warmup", required_argument, 0, 0},
+            {"cpu", required_argument, 0, 0},
+            {"perf", no_argument, 0, 0},
+            {"lengths", required_argument, 0, 0},
+            {"only", required_argument, 0, 0},
+            {"csv", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "", options, &option_index);
+
+        if (c == -1)
+            break;
+
+        if (c != 0) {
+            fprintf(stderr,
+                    "Using: %s [--n %d] [--trials %d] [--warmup 1] [--cpu N|-1] [--perf] "
+                    "[--lengths 16,256,4096,65536] [--only LABEL] [--csv FILE]\n",
+                    argv[0], DEFAULT_N, DEFAULT_TRIALS);
+            return 1;
+        }
+        switch (option_index) {
+        case 0:
+            if (!ConvertStringToUI64(optarg, &n) || n == 0) {
+                fprintf(stderr, "Invalid n value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 1:
+            config.trials = atoi(optarg);
+            if (config.trials <= 0 || config.trials > MAX_TRIALS) {
+                fprintf(stderr, "Trials must be in [1, %d]\n", MAX_TRIALS);
+                return 1;
+            }
+            break;
+        case 2:
+            config.warmup = atoi(optarg);
+            if (config.warmup < 0) {
+                fprintf(stderr, "Warmup must not be negative\n");
+                return 1;
+            }
+            break;
+        case 3:
+            cpu = atoi(optarg);
+            break;
+        case 4:
+            use_perf = true;
+            break;
+        case 5:
+            length_count = ParseLengths(optarg, lengths);
+            if (length_count < 0) {
+                fprintf(stderr, "Lengths must be up to %d positive numbers: 16,256\n",
+                        MAX_LENGTHS);
+                return 1;
+            }
+            break;
+        case 6:
+            filter = optarg;
+            break;
+        case 7:
+            config.csv = fopen(optarg, "a");
+            if (config.csv == NULL) {
+                fprintf(stderr, "Cannot open %s\n", optarg);
+                return 1;
+            }
+            if (ftell(config.csv) == 0)
+                fprintf(config.csv, "mod,case,length,ns_per_op,mad,mul_per_cycle,ipc\n");
+            break;
+        }
+    }
+
+    // Закрепление убирает разброс от миграции между ядрами
+    if (cpu == -2)
+        cpu = sched_getcpu();
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "Cannot pin to CPU %d: %s\n", cpu, strerror(errno));
+            cpu = -1;
+        }
+    }
+    if (use_perf && !PerfOpen(&config.perf))
+        fprintf(stderr, "perf_event_open failed (%s), counting TSC cycles\n", strerror(errno));
+
+    printf("CPU: avx2=%d avx512ifma=%d, ", __builtin_cpu_supports("avx2") ? 1 : 0,
+           __builtin_cpu_supports("avx512ifma") ? 1 : 0);
+    if (cpu >= 0)
+        printf("pinned to %d", cpu);
+    else
+        printf("not pinned");
+    printf(", cycles from %s, %d trials, median ± MAD\n", config.perf.enabled ? "perf" : "TSC",
+           config.trials);
+
+    int failures = 0;
+    for (size_t m = 0; m < sizeof(moduli) / sizeof(moduli[0]); m++) {
+        uint64_t mod = moduli[m].mod;
+        if (filter != NULL && strstr(moduli[m].label, filter) == NULL)
+            continue;
+        struct ModContext ctx;
+        ModInit(&ctx, mod);
+
+        printf("mod = %lu (%s)\n", mod, moduli[m].label);
+        uint64_t reference[2] = {0, 0}; // результаты для n / scale при scale 1 и 16
+        bool have_reference[2] = {false, false};
+
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            const struct Variant *var = &variants[v];
+            if (var->needs_barrett && ctx.kind != MOD_KIND_BARRETT)
+                continue;
+            if (var->needs_montgomery && (mod % 2 == 0 || mod == 1))
+                continue;
+
+            struct BenchCase bench = {var, RANGE_KERNEL_SERIAL, 1, n / var->scale, 1};
+            struct Measurement result;
+            Measure(&config, &bench, &ctx, &result);
+
+            int slot = var->scale == 1 ? 0 : 1;
+            if (!have_reference[slot]) {
+                reference[slot] = result.result;
+                have_reference[slot] = true;
+            } else if (reference[slot] != result.result) {
+                failures++;
+            }
+
+            PrintMeasurement(&config, var->name, &result);
+            printf("  result %lu%s\n", result.result,
+                   reference[slot] == result.result ? "" : "  MISMATCH");
+            WriteCsv(&config, mod, var->name, bench.length, &result);
+        }
+
+        // Медленный вариант проверяется на своём n против быстрого. При mod >= 2^63
+        // старый цикл переполняет a * 2 и считает неверно, поэтому не сравнивается.
+        struct FactorialArgs check = {1, n / variants[0].scale, mod};
+        if (mod < (1ULL << 63) && Factorial(&check) != reference[1]) {
+            printf("  shift-add result differs from Factorial()\n");
+            failures++;
+        }
+
+        failures += BenchKernels(&config, &ctx, n, reference[0], lengths, length_count);
+        failures += BenchPrime(&ctx);
+    }
+
+    if (config.csv != NULL)
+        fclose(config.csv);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,478 @@
+#include "bignum.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Пороги по длине меньшего множителя в limbs
+#define KARATSUBA_MIN 32
+#define NTT_MIN 8192
+// Столько чисел диапазона перемножаются подряд в один limb-аккумулятор
+#define PRODUCT_LEAF 32
+// Поддерево меньше этого не стоит отдельного потока
+#define PARALLEL_MIN_RANGE (1u << 14)
+
+// NTT по простому модулю 2^64 - 2^32 + 1: свёртка 16-битных цифр не больше
+// 2^26 * 2^32 и помещается в вычет, поэтому хватает одного модуля без CRT
+#define NTT_P 0xFFFFFFFF00000001ULL
+#define NTT_GENERATOR 7
+#define NTT_DIGIT_BITS 16
+#define NTT_DIGITS_PER_LIMB 4
+
+void BigInit(struct BigNum *n) {
+    n->limbs = NULL;
+    n->size = 0;
+    n->cap = 0;
+}
+
+void BigFree(struct BigNum *n) {
+    free(n->limbs);
+    BigInit(n);
+}
+
+void BigResize(struct BigNum *n, size_t size) {
+    if (size > n->cap) {
+        n->limbs = realloc(n->limbs, sizeof(uint64_t) * size);
+        n->cap = size;
+    }
+    if (size > n->size)
+        memset(n->limbs + n->size, 0, sizeof(uint64_t) * (size - n->size));
+    n->size = size;
+}
+
+void BigNormalize(struct BigNum *n) {
+    while (n->size > 0 && n->limbs[n->size - 1] == 0)
+        n->size--;
+}
+
+void BigSetU64(struct BigNum *n, uint64_t value) {
+    n->size = 0;
+    if (value == 0)
+        return;
+    BigResize(n, 1);
+    n->limbs[0] = value;
+}
+
+// r[0, rn) += a[0, an), an <= rn. Возвращает перенос из старшего limb.
+static uint64_t AddTo(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        unsigned __int128 sum = (unsigned __int128)r[i] + a[i] + carry;
+        r[i] = (uint64_t)sum;
+        carry = (uint64_t)(sum >> 64);
+    }
+    for (; carry != 0 && i < rn; i++) {
+        r[i]++;
+        carry = r[i] == 0;
+    }
+    return carry;
+}
+
+// r[0, rn) -= a[0, an), an <= rn, r >= a
+static void SubFrom(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+    uint64_t borrow = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        uint64_t value = r[i];
+        r[i] = value - a[i] - borrow;
+        borrow = value < a[i] || (value == a[i] && borrow);
+    }
+    for (; borrow != 0 && i < rn; i++) {
+        borrow = r[i] == 0;
+        r[i]--;
+    }
+}
+
+static void MulSchool(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    memset(r, 0, sizeof(uint64_t) * (an + bn));
+    for (size_t i = 0; i < bn; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < an; j++) {
+            unsigned __int128 t = (unsigned __int128)a[j] * b[i] + r[i + j] + carry;
+            r[i + j] = (uint64_t)t;
+            carry = (uint64_t)(t >> 64);
+        }
+        r[i + an] = carry;
+    }
+}
+
+// Сведение 128-битного произведения по модулю NTT_P: 2^64 = 2^32 - 1 и
+// 2^96 = -1 по этому модулю
+static uint64_t NttReduce(unsigned __int128 x) {
+    uint64_t lo = (uint64_t)x;
+    uint64_t hi = (uint64_t)(x >> 64);
+    uint64_t hi_hi = hi >> 32;
+    uint64_t hi_lo = hi & 0xFFFFFFFFULL;
+    uint64_t t0 = lo - hi_hi;
+    if (lo < hi_hi)
+        t0 -= 0xFFFFFFFFULL;
+    uint64_t t1 = hi_lo * 0xFFFFFFFFULL;
+    uint64_t r = t0 + t1;
+    if (r < t1)
+        r += 0xFFFFFFFFULL;
+    return r >= NTT_P ? r - NTT_P : r;
+}
+
+static uint64_t NttMul(uint64_t a, uint64_t b) {
+    return NttReduce((unsigned __int128)a * b);
+}
+
+static uint64_t NttAdd(uint64_t a, uint64_t b) {
+    uint64_t sum = a + b;
+    if (sum < a)
+        sum += 0xFFFFFFFFULL;
+    return sum >= NTT_P ? sum - NTT_P : sum;
+}
+
+static uint64_t NttSub(uint64_t a, uint64_t b) {
+    return a >= b ? a - b : a + (NTT_P - b);
+}
+
+static uint64_t NttPow(uint64_t base, uint64_t exp) {
+    uint64_t result = 1;
+    while (exp > 0) {
+        if (exp & 1)
+            result = NttMul(result, base);
+        base = NttMul(base, base);
+        exp >>= 1;
+    }
+    return result;
+}
+
+// Преобразование длины n (степень двойки) на месте. twiddles[half + k] =
+// w_len^k для каждого этапа длины len = 2 * half, где w_len — первообразный
+// корень степени len: этап читает свои корни подряд.
+static void Ntt(uint64_t *a, size_t n, const uint64_t *twiddles) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            uint64_t t = a[i];
+            a[i] = a[j];
+            a[j] = t;
+        }
+    }
+    for (size_t half = 1; half < n; half <<= 1) {
+        const uint64_t *w = twiddles + half;
+        for (size_t start = 0; start < n; start += 2 * half) {
+            uint64_t *lo = a + start;
+            uint64_t *hi = lo + half;
+            for (size_t k = 0; k < half; k++) {
+                uint64_t u = lo[k];
+                uint64_t v = NttMul(hi[k], w[k]);
+                lo[k] = NttAdd(u, v);
+                hi[k] = NttSub(u, v);
+            }
+        }
+    }
+}
+
+// Корни для Ntt: root — первообразный корень степени n
+static void NttTwiddles(uint64_t *twiddles, size_t n, uint64_t root) {
+    for (size_t half = n / 2; half >= 1; half >>= 1) {
+        uint64_t w = 1;
+        for (size_t k = 0; k < half; k++) {
+            twiddles[half + k] = w;
+            w = NttMul(w, root);
+        }
+        root = NttMul(root, root);
+    }
+}
+
+static void SplitDigits(uint64_t *digits, const uint64_t *a, size_t an, size_t n) {
+    memset(digits, 0, sizeof(uint64_t) * n);
+    for (size_t i = 0; i < an; i++) {
+        for (int d = 0; d < NTT_DIGITS_PER_LIMB; d++)
+            digits[i * NTT_DIGITS_PER_LIMB + d] = (a[i] >> (NTT_DIGIT_BITS * d)) & 0xFFFF;
+    }
+}
+
+static void MulNtt(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    size_t digits = (an + bn) * NTT_DIGITS_PER_LIMB;
+    size_t n = 1;
+    while (n < digits)
+        n <<= 1;
+    uint64_t *fa = malloc(sizeof(uint64_t) * n);
+    uint64_t *fb = malloc(sizeof(uint64_t) * n);
+    uint64_t *twiddles = malloc(sizeof(uint64_t) * n);
+    SplitDigits(fa, a, an, n);
+    SplitDigits(fb, b, bn, n);
+
+    uint64_t w = NttPow(NTT_GENERATOR, (NTT_P - 1) / n);
+    NttTwiddles(twiddles, n, w);
+    Ntt(fa, n, twiddles);
+    Ntt(fb, n, twiddles);
+    for (size_t i = 0; i < n; i++)
+        fa[i] = NttMul(fa[i], fb[i]);
+
+    // Обратное преобразование: корни w^-1, затем деление на n
+    NttTwiddles(twiddles, n, NttPow(w, NTT_P - 2));
+    Ntt(fa, n, twiddles);
+    uint64_t n_inv = NttPow(n % NTT_P, NTT_P - 2);
+
+    unsigned __int128 carry = 0;
+    for (size_t i = 0; i < an + bn; i++) {
+        uint64_t limb = 0;
+        for (int d = 0; d < NTT_DIGITS_PER_LIMB; d++) {
+            carry += NttMul(fa[i * NTT_DIGITS_PER_LIMB + d], n_inv);
+            limb |= (uint64_t)(carry & 0xFFFF) << (NTT_DIGIT_BITS * d);
+            carry >>= NTT_DIGIT_BITS;
+        }
+        r[i] = limb;
+    }
+    free(fa);
+    free(fb);
+    free(twiddles);
+}
+
+static void MulRaw(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn);
+
+// Множитель a намного длиннее b: a режется на куски длины bn
+static void MulUnbalanced(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b,
+                          size_t bn) {
+    uint64_t *part = malloc(sizeof(uint64_t) * 2 * bn);
+    memset(r, 0, sizeof(uint64_t) * (an + bn));
+    for (size_t offset = 0; offset < an; offset += bn) {
+        size_t len = an - offset < bn ? an - offset : bn;
+        MulRaw(part, a + offset, len, b, bn);
+        AddTo(r + offset, an + bn - offset, part, len + bn);
+    }
+    free(part);
+}
+
+// a = a1 * B^m + a0, b = b1 * B^m + b0,
+// a * b = a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0
+static void MulKaratsuba(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b,
+                         size_t bn) {
+    size_t m = an / 2;
+    size_t rn = an + bn;
+    MulRaw(r, a, m, b, m);
+    MulRaw(r + 2 * m, a + m, an - m, b + m, bn - m);
+
+    size_t sa_n = an - m + 1;
+    size_t sb_n = (m > bn - m ? m : bn - m) + 1;
+    uint64_t *sa = calloc(sa_n + sb_n, sizeof(uint64_t));
+    uint64_t *sb = sa + sa_n;
+    memcpy(sa, a + m, sizeof(uint64_t) * (an - m));
+    AddTo(sa, sa_n, a, m);
+    memcpy(sb, b, sizeof(uint64_t) * m);
+    AddTo(sb, sb_n, b + m, bn - m);
+
+    size_t mid_n = sa_n + sb_n;
+    uint64_t *mid = malloc(sizeof(uint64_t) * mid_n);
+    MulRaw(mid, sa, sa_n, sb, sb_n);
+    SubFrom(mid, mid_n, r, 2 * m);
+    SubFrom(mid, mid_n, r + 2 * m, rn - 2 * m);
+    // Средний член меньше B^(rn - m), старшие limbs mid нулевые
+    AddTo(r + m, rn - m, mid, mid_n < rn - m ? mid_n : rn - m);
+    free(mid);
+    free(sa);
+}
+
+// r[0, an + bn) = a * b, r не пересекается с множителями
+static void MulRaw(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    if (an < bn) {
+        const uint64_t *t = a;
+        a = b;
+        b = t;
+        size_t tn = an;
+        an = bn;
+        bn = tn;
+    }
+    if (bn < KARATSUBA_MIN)
+        MulSchool(r, a, an, b, bn);
+    else if (an >= 2 * bn)
+        MulUnbalanced(r, a, an, b, bn);
+    else if (bn >= NTT_MIN)
+        MulNtt(r, a, an, b, bn);
+    else
+        MulKaratsuba(r, a, an, b, bn);
+}
+
+void BigMul(struct BigNum *out, const struct BigNum *a, const struct BigNum *b) {
+    if (a->size == 0 || b->size == 0) {
+        out->size = 0;
+        return;
+    }
+    size_t size = a->size + b->size;
+    uint64_t *limbs = malloc(sizeof(uint64_t) * size);
+    MulRaw(limbs, a->limbs, a->size, b->limbs, b->size);
+    free(out->limbs);
+    out->limbs = limbs;
+    out->size = size;
+    out->cap = size;
+    BigNormalize(out);
+}
+
+void BigMulU64(struct BigNum *n, uint64_t value) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < n->size; i++) {
+        unsigned __int128 t = (unsigned __int128)n->limbs[i] * value + carry;
+        n->limbs[i] = (uint64_t)t;
+        carry = (uint64_t)(t >> 64);
+    }
+    if (carry != 0) {
+        BigResize(n, n->size + 1);
+        n->limbs[n->size - 1] = carry;
+    }
+    if (value == 0)
+        n->size = 0;
+}
+
+size_t BigBits(const struct BigNum *n) {
+    if (n->size == 0)
+        return 0;
+    return n->size * 64 - (size_t)__builtin_clzll(n->limbs[n->size - 1]);
+}
+
+uint64_t BigModU64(const struct BigNum *n, uint64_t mod) {
+    unsigned __int128 r = 0;
+    for (size_t i = n->size; i-- > 0;)
+        r = ((r << 64) | n->limbs[i]) % mod;
+    return (uint64_t)r;
+}
+
+// Лист дерева: числа копятся в одном limb, пока произведение помещается
+static void ProductLeaf(struct BigNum *out, uint64_t begin, uint64_t end) {
+    BigSetU64(out, 1);
+    uint64_t acc = 1;
+    for (uint64_t x = begin;; x++) {
+        unsigned __int128 t = (unsigned __int128)acc * x;
+        if (t >> 64) {
+            BigMulU64(out, acc);
+            acc = x;
+        } else {
+            acc = (uint64_t)t;
+        }
+        if (x == end)
+            break;
+    }
+    BigMulU64(out, acc);
+}
+
+// Поддерево, отданное отдельному потоку: диапазон чисел или отрезок parts
+struct ProductJob {
+    struct BigNum result;
+    uint64_t begin;
+    uint64_t end;
+    struct BigNum *parts;
+    int count;
+    int threads;
+};
+
+static void *RunProductJob(void *arg) {
+    struct ProductJob *job = arg;
+    if (job->parts != NULL)
+        BigProductOf(&job->result, job->parts, job->count, job->threads);
+    else
+        BigProductRange(&job->result, job->begin, job->end, job->threads);
+    return NULL;
+}
+
+// Левое поддерево job считается в своём потоке, если threads > 1, правое —
+// в текущем. Результат — произведение обоих.
+static void SplitProduct(struct BigNum *out, struct ProductJob *left, struct ProductJob *right,
+                         int threads) {
+    pthread_t thread;
+    bool spawned = false;
+    if (threads > 1) {
+        left->threads = threads / 2;
+        right->threads = threads - threads / 2;
+        spawned = pthread_create(&thread, NULL, RunProductJob, left) == 0;
+    }
+    if (!spawned) {
+        left->threads = 1;
+        right->threads = 1;
+        RunProductJob(left);
+    }
+    RunProductJob(right);
+    if (spawned)
+        pthread_join(thread, NULL);
+    BigMul(out, &left->result, &right->result);
+    BigFree(&left->result);
+    BigFree(&right->result);
+}
+
+void BigProductRange(struct BigNum *out, uint64_t begin, uint64_t end, int threads) {
+    if (begin > end) {
+        BigSetU64(out, 1);
+        return;
+    }
+    uint64_t count = end - begin + 1;
+    if (count != 0 && count <= PRODUCT_LEAF) {
+        ProductLeaf(out, begin, end);
+        return;
+    }
+    uint64_t middle = begin + (end - begin) / 2;
+    struct ProductJob left = {{NULL, 0, 0}, begin, middle, NULL, 0, 1};
+    struct ProductJob right = {{NULL, 0, 0}, middle + 1, end, NULL, 0, 1};
+    SplitProduct(out, &left, &right, end - begin >= PARALLEL_MIN_RANGE ? threads : 1);
+}
+
+void BigProductOf(struct BigNum *out, struct BigNum *parts, int count, int threads) {
+    if (count == 0) {
+        BigSetU64(out, 1);
+        return;
+    }
+    if (count == 1) {
+        BigFree(out);
+        *out = parts[0];
+        BigInit(&parts[0]);
+        return;
+    }
+    int half = count / 2;
+    struct ProductJob left = {{NULL, 0, 0}, 0, 0, parts, half, 1};
+    struct ProductJob right = {{NULL, 0, 0}, 0, 0, parts + half, count - half, 1};
+    SplitProduct(out, &left, &right, threads);
+}
+
+char *BigToHex(const struct BigNum *n) {
+    char *text = malloc(n->size * 16 + 2);
+    if (n->size == 0) {
+        strcpy(text, "0");
+        return text;
+    }
+    size_t length = (size_t)sprintf(text, "%lx", n->limbs[n->size - 1]);
+    for (size_t i = n->size - 1; i-- > 0;)
+        length += (size_t)sprintf(text + length, "%016lx", n->limbs[i]);
+    return text;
+}
+
+char *BigToDecimal(const struct BigNum *n) {
+    const uint64_t base = 10000000000000000000ULL; // 10^19
+    // Каждые 64 бита дают не больше 20 десятичных цифр
+    size_t max_chunks = n->size * 20 / 19 + 2;
+    uint64_t *chunks = malloc(sizeof(uint64_t) * max_chunks);
+    uint64_t *work = malloc(sizeof(uint64_t) * (n->size + 1));
+    memcpy(work, n->limbs, sizeof(uint64_t) * n->size);
+    size_t size = n->size;
+    size_t count = 0;
+    while (size > 0) {
+        unsigned __int128 r = 0;
+        for (size_t i = size; i-- > 0;) {
+            r = (r << 64) | work[i];
+            work[i] = (uint64_t)(r / base);
+            r %= base;
+        }
+        chunks[count++] = (uint64_t)r;
+        while (size > 0 && work[size - 1] == 0)
+            size--;
+    }
+
+    char *text = malloc(count * 19 + 2);
+    if (count == 0) {
+        strcpy(text, "0");
+    } else {
+        size_t length = (size_t)sprintf(text, "%lu", chunks[count - 1]);
+        for (size_t i = count - 1; i-- > 0;)
+            length += (size_t)sprintf(text + length, "%019lu", chunks[i]);
+    }
+    free(work);
+    free(chunks);
+    return text;
+}
@@ -0,0 +1,47 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Неотрицательное целое произвольной длины: limbs[0] — младшие 64 бита,
+// старший limb ненулевой, ноль — size == 0
+struct BigNum {
+    uint64_t *limbs;
+    size_t size;
+    size_t cap;
+};
+
+// Ноль без выделения памяти
+void BigInit(struct BigNum *n);
+void BigFree(struct BigNum *n);
+void BigSetU64(struct BigNum *n, uint64_t value);
+
+// size limbs под заполнение вызывающим, после него — BigNormalize
+void BigResize(struct BigNum *n, size_t size);
+// Отбрасывает нулевые старшие limbs
+void BigNormalize(struct BigNum *n);
+
+// out = a * b, out может совпадать с a или b. Алгоритм выбирается по длине
+// меньшего множителя: школьный, Карацуба или NTT по модулю 2^64 - 2^32 + 1.
+void BigMul(struct BigNum *out, const struct BigNum *a, const struct BigNum *b);
+void BigMulU64(struct BigNum *n, uint64_t value);
+
+size_t BigBits(const struct BigNum *n);
+uint64_t BigModU64(const struct BigNum *n, uint64_t mod);
+
+// Произведение begin..end (1 при begin > end) сбалансированным деревом:
+// множители одного уровня близки по длине, поэтому дорогие умножения
+// достаются быстрым алгоритмам. До threads поддеревьев считаются в своих
+// потоках.
+void BigProductRange(struct BigNum *out, uint64_t begin, uint64_t end, int threads);
+
+// Произведение count чисел тем же деревом. Множители освобождаются.
+void BigProductOf(struct BigNum *out, struct BigNum *parts, int count, int threads);
+
+// Строки в malloc. Шестнадцатеричная запись линейна, десятичная —
+// квадратична и годится для чисел до сотен тысяч бит.
+char *BigToHex(const struct BigNum *n);
+char *BigToDecimal(const struct BigNum *n);
+
+#endif
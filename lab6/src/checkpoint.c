@@ -0,0 +1,154 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint64_t CheckpointChecksum(const uint64_t *values, uint64_t count) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t v = values[i];
+        for (int byte = 0; byte < 8; byte++) {
+            hash ^= (v >> (byte * 8)) & 0xff;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+int CheckpointOpen(struct Checkpoint *checkpoint, const char *path, bool verify) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can not open checkpoint %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < CHECKPOINT_DATA_OFFSET) {
+        fprintf(stderr, "Checkpoint %s is truncated\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can not map checkpoint %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    const struct CheckpointHeader *header = map;
+    const char *error = NULL;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+        error = "bad magic";
+    else if (header->version != CHECKPOINT_VERSION)
+        error = "unsupported version";
+    else if (header->data_offset != CHECKPOINT_DATA_OFFSET || header->mod == 0 ||
+             header->stride == 0 || header->count == 0)
+        error = "bad header";
+    else if (header->count > ((size_t)st.st_size - CHECKPOINT_DATA_OFFSET) / sizeof(uint64_t))
+        error = "truncated";
+
+    const uint64_t *values = (const uint64_t *)((const char *)map + CHECKPOINT_DATA_OFFSET);
+    if (error == NULL && verify && CheckpointChecksum(values, header->count) != header->checksum)
+        error = "checksum mismatch";
+
+    if (error != NULL) {
+        fprintf(stderr, "Checkpoint %s: %s\n", path, error);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    checkpoint->header = header;
+    checkpoint->values = values;
+    checkpoint->map_size = (size_t)st.st_size;
+    return 0;
+}
+
+void CheckpointClose(struct Checkpoint *checkpoint) {
+    if (checkpoint->header != NULL)
+        munmap((void *)checkpoint->header, checkpoint->map_size);
+    checkpoint->header = NULL;
+    checkpoint->values = NULL;
+}
+
+int CheckpointWrite(const char *path, uint64_t mod, uint64_t stride, const uint64_t *values,
+                    uint64_t count) {
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "Checkpoint path is too long\n");
+        return -1;
+    }
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can not create %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    char head[CHECKPOINT_DATA_OFFSET] = {0};
+    struct CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.data_offset = CHECKPOINT_DATA_OFFSET;
+    header.mod = mod;
+    header.stride = stride;
+    header.count = count;
+    header.checksum = CheckpointChecksum(values, count);
+    memcpy(head, &header, sizeof(header));
+
+    bool ok = fwrite(head, sizeof(head), 1, file) == 1 &&
+              fwrite(values, sizeof(uint64_t), count, file) == count;
+    ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Can not write checkpoint %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+bool CheckpointPlan(const struct Checkpoint *checkpoint, uint64_t begin, uint64_t end,
+                    bool prime, struct CachePlan *plan) {
+    const struct CheckpointHeader *header = checkpoint->header;
+    // С нулём в диапазоне произведение равно 0, его посчитает обычный путь
+    if (begin == 0 || begin > end)
+        return false;
+    if (begin > 1 && (!prime || end >= header->mod))
+        return false;
+
+    uint64_t stride = header->stride;
+    uint64_t upper = end / stride;
+    if (upper >= header->count)
+        upper = header->count - 1;
+    uint64_t lower = begin > 1 ? (begin - 1) / stride : 0;
+    if (lower >= header->count)
+        lower = header->count - 1;
+
+    uint64_t cost = end - upper * stride;
+    if (begin > 1)
+        cost += begin - 1 - lower * stride;
+    if (cost > end - begin)
+        return false;
+
+    plan->num = checkpoint->values[upper];
+    plan->mul_begin = upper * stride + 1;
+    plan->mul_end = end;
+    plan->den = 1;
+    plan->div_begin = 1;
+    plan->div_end = 0;
+    if (begin > 1) {
+        plan->den = checkpoint->values[lower];
+        plan->div_begin = lower * stride + 1;
+        plan->div_end = begin - 1;
+    }
+    return true;
+}
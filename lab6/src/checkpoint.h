@@ -0,0 +1,54 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "range_cache.h"
+
+#define CHECKPOINT_MAGIC "FACTCKP1"
+#define CHECKPOINT_VERSION 1
+// Значения начинаются с этого смещения, заголовок дополнен нулями
+#define CHECKPOINT_DATA_OFFSET 64
+
+// Заголовок файла контрольных точек. Числа в порядке байтов хоста: файл
+// строится и читается на одной машине.
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t data_offset;
+    uint64_t mod;
+    uint64_t stride;
+    uint64_t count;         // values[i] = (i * stride)! mod mod, i < count
+    uint64_t checksum;      // FNV-1a по массиву values
+};
+
+// Отображённый в память файл. Страницы только для чтения и общие, поэтому
+// все процессы сервера на машине делят одну копию в page cache.
+struct Checkpoint {
+    const struct CheckpointHeader *header;
+    const uint64_t *values;
+    size_t map_size;
+};
+
+uint64_t CheckpointChecksum(const uint64_t *values, uint64_t count);
+
+// Проверяет заголовок и размер файла. Контрольная сумма считается, только
+// если verify: для больших файлов это чтение всего индекса с диска.
+// Возвращает 0 или -1, текст ошибки уже выведен в stderr.
+int CheckpointOpen(struct Checkpoint *checkpoint, const char *path, bool verify);
+void CheckpointClose(struct Checkpoint *checkpoint);
+
+// Записывает файл через временный и rename, чтобы не испортить отображения
+// уже работающих серверов
+int CheckpointWrite(const char *path, uint64_t mod, uint64_t stride, const uint64_t *values,
+                    uint64_t count);
+
+// План вычисления [begin, end] через ближайшие контрольные точки:
+// end! / (begin - 1)!. Для begin > 1 нужен простой модуль и end < mod.
+// Возвращает false, если план не дешевле прямого счёта.
+bool CheckpointPlan(const struct Checkpoint *checkpoint, uint64_t begin, uint64_t end,
+                    bool prime, struct CachePlan *plan);
+
+#endif
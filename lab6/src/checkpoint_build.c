@@ -0,0 +1,210 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+
+#include "checkpoint.h"
+#include "common.h"
+#include "modarith.h"
+#include "thread_pool.h"
+
+// Число задач на поток: отрезки считаются с разной скоростью, мелкие
+// задачи выравнивают загрузку
+#define TASKS_PER_THREAD 8
+// Сколько случайных точек сверяет --verify с прямым счётом
+#define VERIFY_SAMPLES 16
+
+// Задача считает произведения отрезков [(i - 1) * stride + 1, i * stride]
+// для i из [first, last) и кладёт их в values[i]
+struct SegmentTask {
+    struct PoolTask task;
+    struct TaskGroup *group;
+    uint64_t *values;
+    uint64_t first;
+    uint64_t last;
+    uint64_t stride;
+    uint64_t mod;
+};
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void RunSegmentTask(struct PoolTask *task) {
+    struct SegmentTask *segment = (struct SegmentTask *)task;
+    for (uint64_t i = segment->first; i < segment->last; i++) {
+        struct FactorialArgs args = {(i - 1) * segment->stride + 1, i * segment->stride,
+                                     segment->mod};
+        segment->values[i] = Factorial(&args);
+    }
+    TaskGroupDone(segment->group);
+}
+
+static int Build(const char *path, uint64_t mod, uint64_t stride, uint64_t max_n, int tnum) {
+    uint64_t count = max_n / stride + 1;
+    uint64_t *values = malloc(sizeof(uint64_t) * count);
+    if (values == NULL) {
+        fprintf(stderr, "Can not allocate %lu values\n", count);
+        return 1;
+    }
+
+    struct ThreadPool pool;
+    if (ThreadPoolInit(&pool, tnum) != 0) {
+        fprintf(stderr, "Error: pthread_create failed!\n");
+        return 1;
+    }
+
+    double start = NowSeconds();
+    uint64_t segments = count - 1;
+    uint64_t tasks = (uint64_t)tnum * TASKS_PER_THREAD;
+    if (tasks > segments)
+        tasks = segments;
+    struct SegmentTask *segment_tasks = calloc(tasks ? tasks : 1, sizeof(struct SegmentTask));
+    struct TaskGroup group;
+    TaskGroupInit(&group, (int)tasks);
+    for (uint64_t t = 0; t < tasks; t++) {
+        struct SegmentTask *segment = &segment_tasks[t];
+        segment->task.run = RunSegmentTask;
+        segment->group = &group;
+        segment->values = values;
+        segment->first = 1 + segments * t / tasks;
+        segment->last = 1 + segments * (t + 1) / tasks;
+        segment->stride = stride;
+        segment->mod = mod;
+        ThreadPoolSubmit(&pool, &segment->task);
+    }
+    TaskGroupWait(&group);
+    TaskGroupDestroy(&group);
+    ThreadPoolDestroy(&pool);
+    free(segment_tasks);
+
+    // Произведения отрезков -> префиксные факториалы
+    struct ModContext ctx;
+    ModInit(&ctx, mod);
+    values[0] = 1 % mod;
+    for (uint64_t i = 1; i < count; i++)
+        values[i] = ModMul(&ctx, values[i - 1], values[i]);
+
+    int status = CheckpointWrite(path, mod, stride, values, count) == 0 ? 0 : 1;
+    if (status == 0)
+        printf("Wrote %s: mod %lu, stride %lu, %lu points up to %lu in %.2f s\n", path, mod,
+               stride, count, (count - 1) * stride, NowSeconds() - start);
+    free(values);
+    return status;
+}
+
+static int Verify(const char *path) {
+    struct Checkpoint checkpoint;
+    if (CheckpointOpen(&checkpoint, path, true) != 0)
+        return 1;
+
+    const struct CheckpointHeader *header = checkpoint.header;
+    printf("%s: mod %lu, stride %lu, %lu points, checksum ok\n", path, header->mod,
+           header->stride, header->count);
+
+    // Выборочная сверка с прямым счётом; последняя точка проверяется всегда
+    int failures = 0;
+    srand((unsigned)time(NULL));
+    for (int s = 0; s < VERIFY_SAMPLES; s++) {
+        uint64_t i = s == 0 ? header->count - 1 : (uint64_t)rand() % header->count;
+        struct FactorialArgs args = {1, i * header->stride, header->mod};
+        uint64_t expected = Factorial(&args);
+        if (checkpoint.values[i] != expected) {
+            printf("  %lu! = %lu, file has %lu  MISMATCH\n", i * header->stride, expected,
+                   checkpoint.values[i]);
+            failures++;
+        }
+    }
+    printf("%d of %d sampled points match\n", VERIFY_SAMPLES - failures, VERIFY_SAMPLES);
+    CheckpointClose(&checkpoint);
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    uint64_t mod = 0;
+    uint64_t stride = 0;
+    uint64_t max_n = 0;
+    int tnum = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out = NULL;
+    const char *verify = NULL;
+
+    while (true) {
+        static struct option options[] = {
+            {"mod", required_argument, 0, 0},
+            {"stride", required_argument, 0, 0},
+            {"max", required_argument, 0, 0},
+            {"out", required_argument, 0, 0},
+            {"tnum", required_argument, 0, 0},
+            {"verify", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "", options, &option_index);
+
+        if (c == -1)
+            break;
+
+        if (c != 0) {
+            printf("Unknown argument\n");
+            continue;
+        }
+
+        switch (option_index) {
+        case 0:
+            if (!ConvertStringToUI64(optarg, &mod) || mod == 0) {
+                fprintf(stderr, "Invalid mod value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 1:
+            if (!ConvertStringToUI64(optarg, &stride) || stride == 0) {
+                fprintf(stderr, "Invalid stride value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 2:
+            if (!ConvertStringToUI64(optarg, &max_n)) {
+                fprintf(stderr, "Invalid max value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 3:
+            out = optarg;
+            break;
+        case 4:
+            tnum = atoi(optarg);
+            if (tnum <= 0) {
+                fprintf(stderr, "Thread number must be positive\n");
+                return 1;
+            }
+            break;
+        case 5:
+            verify = optarg;
+            break;
+        default:
+            printf("Index %d is out of options\n", option_index);
+        }
+    }
+
+    if (verify != NULL)
+        return Verify(verify);
+
+    if (mod == 0 || stride == 0 || max_n == 0 || out == NULL) {
+        fprintf(stderr,
+                "Using: %s --mod 1000000007 --stride 1048576 --max 1000000000 --out m.ckpt "
+                "[--tnum 4]\n"
+                "       %s --verify m.ckpt\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    if (tnum <= 0)
+        tnum = 1;
+    return Build(out, mod, stride, max_n, tnum);
+}
@@ -6,191 +6,1147 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <pthread.h>
-#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
 
+#include "bignum.h"
 #include "common.h"
+#include "log.h"
+#include "modarith.h"
+#include "net.h"
+#include "prime_factorial.h"
+#include "protocol.h"
+#include "scheduler.h"
+#include "shm_ring.h"
+#include "timer_wheel.h"
+
+#define DEFAULT_WINDOW 2
+#define MAX_WINDOW 64
+#define DEFAULT_CHUNK_MS 200
+#define DEFAULT_TIMEOUT 30
+#define DEFAULT_VERIFY_SAMPLES 8
+#define CONNECT_TIMEOUT 5.0
+// Сколько ждать ответа, пока у сервера есть неотвеченные куски
+#define IO_TIMEOUT 10.0
+#define TIMER_TICK 0.01
+// Как часто свободные соединения спрашивают планировщик о копиях
+#define IDLE_POLL_MS 50
+#define MAX_EVENTS 256
+// UDP: первый повтор через UDP_RETRANSMIT_MIN плюс два окна кусков,
+// дальше интервал удваивается
+#define UDP_RETRANSMIT_MIN 0.05
+#define UDP_MAX_RETRIES 6
+// Самый длинный ответ на один кусок: кадр v2 с одним 128-битным результатом
+#define MAX_RESPONSE_SIZE (PROTO_HEADER_SIZE + sizeof(uint32_t) + PROTO_WIDE_RESULT_SIZE)
+// Точный режим: результат длиннее печатается только в файл --exact-out
+#define EXACT_PRINT_BITS (1 << 16)
 
-struct ThreadData {
-    struct Server server;
-    uint64_t begin;
-    uint64_t end;
-    uint64_t mod;
-    uint64_t result;
-    int thread_id;
-    pthread_t thread;
-    bool completed;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
+// Кусок, отправленный серверу и ещё не посчитанный
+struct InFlight {
+    struct SchedulerChunk chunk;
+    uint64_t id;
+    double sent;
+    bool cancelled;             // TCP: отмена отправлена, ждём ответа на кусок
 };
 
-// Глобальные переменные для синхронизации
-struct ThreadMonitor {
-    struct ThreadData *threads;
-    int total_threads;
-    int completed_threads;
-    pthread_mutex_t mutex;
-    pthread_cond_t all_done;
+// Разобранный ответ на один кусок
+struct Response {
+    uint64_t id;
+    uint16_t status;            // OK, CANCELLED или OVERLOADED
+    unsigned __int128 result;
+    uint32_t retry_after_ms;    // OVERLOADED: подсказка сервера
 };
 
-struct ThreadMonitor monitor;
+enum ConnState {
+    CONN_CONNECTING,
+    CONN_ATTACHING,             // shm: ждём дескрипторы каналов от сервера
+    CONN_ACTIVE,
+    CONN_CLOSED,
+};
 
-void* ServerThread(void* arg) {
-    struct ThreadData* data = (struct ThreadData*)arg;
-    
-    printf("Thread %d started: connecting to %s:%d for range %lu-%lu\n", 
-           data->thread_id, data->server.ip, data->server.port, 
-           data->begin, data->end);
-    
-    struct hostent *hostname = gethostbyname(data->server.ip);
-    if (hostname == NULL) {
-        fprintf(stderr, "Thread %d: gethostbyname failed with %s\n", 
-                data->thread_id, data->server.ip);
-        data->result = 0;
-        goto thread_complete;
-    }
-
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(data->server.port);
-    server_addr.sin_addr.s_addr = *((unsigned long *)hostname->h_addr);
-
-    int sck = socket(AF_INET, SOCK_STREAM, 0);
-    if (sck < 0) {
-        fprintf(stderr, "Thread %d: Socket creation failed!\n", data->thread_id);
-        data->result = 0;
-        goto thread_complete;
-    }
-
-    // Устанавливаем таймауты для неблокирующей работы
-    struct timeval timeout;
-    timeout.tv_sec = 10;  // 10 секунд таймаут
-    timeout.tv_usec = 0;
-    setsockopt(sck, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(sck, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-
-    printf("Thread %d: Connecting to %s:%d...\n", 
-           data->thread_id, data->server.ip, data->server.port);
-    
-    if (connect(sck, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        fprintf(stderr, "Thread %d: Connection to %s:%d failed\n", 
-                data->thread_id, data->server.ip, data->server.port);
-        close(sck);
-        data->result = 0;
-        goto thread_complete;
+// Соединение с одним сервером. Все соединения обслуживает один поток.
+struct ClientConn {
+    int index;                  // номер сервера, он же номер в планировщике
+    int fd;
+    enum ConnState state;
+    enum ServerTransport transport;
+    struct ShmEnd shm;          // shm: каналы, channel == NULL до их получения
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    struct Timer timer;         // тайм-аут connect или ожидания ответа
+    unsigned char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    bool want_write;            // подписаны на EPOLLOUT
+    unsigned char in[MAX_RESPONSE_SIZE];
+    size_t in_len;
+    struct InFlight *in_flight;
+    int count;
+    uint64_t next_id;
+    double last_done;
+    double rto;                 // UDP: текущий интервал повтора
+    int retries;                // UDP: повторы подряд без единого ответа
+    double resume;              // перегруженному серверу куски не выдаются до этого времени
+    uint64_t shed;              // куски, от которых он отказался из-за перегрузки
+    struct ProtoNode *children; // режим дерева: поддерево сервера
+    uint32_t child_count;
+};
+
+struct Client {
+    int epoll_fd;
+    struct TimerWheel wheel;
+    struct Scheduler *scheduler;
+    struct ClientConn *conns;
+    char **names;
+    int conn_count;
+    int open_count;             // соединения не в состоянии CONN_CLOSED
+    bool udp;
+    bool reduce;                // куски уходят кадрами PROTO_OP_REDUCE
+    int fanout;                 // режим дерева, 0 — серверы без поддеревьев
+    double retransmit;          // начальный интервал повтора UDP
+    uint32_t redundant_samples; // сколько кусков пересчитать на других серверах
+    bool verification_queued;
+    int protocol;
+    int window;
+};
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Адреса разрешаются один раз на имя хоста: у серверов одного хоста
+// копируется адрес первого с заменой порта. Для unix и shm адрес — путь
+// к unix-сокету сервера.
+static bool ResolveServers(const struct Server *servers, struct ClientConn *conns, int count) {
+    bool any = false;
+    for (int i = 0; i < count; i++) {
+        conns[i].addr_len = 0;
+        conns[i].transport = servers[i].transport;
+        if (servers[i].transport != SERVER_TCP) {
+            struct sockaddr_un *addr = (struct sockaddr_un *)&conns[i].addr;
+            memset(addr, 0, sizeof(*addr));
+            addr->sun_family = AF_UNIX;
+            strcpy(addr->sun_path, servers[i].ip); // длину проверил ReadServers
+            conns[i].addr_len = sizeof(*addr);
+            any = true;
+            continue;
+        }
+        for (int j = 0; j < i; j++) {
+            if (conns[j].addr_len != 0 && servers[j].transport == SERVER_TCP &&
+                strcmp(servers[i].ip, servers[j].ip) == 0) {
+                conns[i].addr = conns[j].addr;
+                conns[i].addr_len = conns[j].addr_len;
+                break;
+            }
+        }
+
+        if (conns[i].addr_len == 0) {
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            struct addrinfo *result = NULL;
+            int error = getaddrinfo(servers[i].ip, NULL, &hints, &result);
+            if (error != 0) {
+                LOG(LOG_WARN, "Cannot resolve %s: %s\n", servers[i].ip, gai_strerror(error));
+                continue;
+            }
+            memcpy(&conns[i].addr, result->ai_addr, result->ai_addrlen);
+            conns[i].addr_len = result->ai_addrlen;
+            freeaddrinfo(result);
+        }
+
+        uint16_t port = htons((uint16_t)servers[i].port);
+        if (conns[i].addr.ss_family == AF_INET6)
+            ((struct sockaddr_in6 *)&conns[i].addr)->sin6_port = port;
+        else
+            ((struct sockaddr_in *)&conns[i].addr)->sin_port = port;
+        any = true;
+    }
+    return any;
+}
+
+// Режим дерева: серверы делятся на группы, клиент соединяется только с
+// первым сервером группы, остальные уходят ему поддеревом. Узлы поддерева
+// передаются IPv4-адресами.
+static bool BuildTrees(struct Client *client, const struct Server *servers, int count) {
+    struct ClientConn *nodes = calloc((size_t)count, sizeof(struct ClientConn));
+    ResolveServers(servers, nodes, count);
+    bool valid = true;
+    for (int i = 0; i < client->conn_count; i++) {
+        uint32_t first;
+        uint32_t size;
+        ProtoTreeGroup((uint32_t)count, (uint32_t)client->fanout, (uint32_t)i, &first, &size);
+        struct ClientConn *conn = &client->conns[i];
+        conn->addr = nodes[first].addr;
+        conn->addr_len = nodes[first].addr_len;
+        conn->transport = nodes[first].transport;
+        conn->child_count = size - 1;
+        conn->children = malloc(sizeof(struct ProtoNode) * size);
+        for (uint32_t j = 0; j < conn->child_count; j++) {
+            const struct ClientConn *node = &nodes[first + 1 + j];
+            if (node->addr_len == 0 || node->addr.ss_family != AF_INET) {
+                fprintf(stderr, "Tree mode needs an IPv4 address for server %s:%d\n",
+                        servers[first + 1 + j].ip, servers[first + 1 + j].port);
+                valid = false;
+                continue;
+            }
+            const struct sockaddr_in *addr = (const struct sockaddr_in *)&node->addr;
+            conn->children[j].ip = ntohl(addr->sin_addr.s_addr);
+            conn->children[j].port = ntohs(addr->sin_port);
+        }
     }
+    free(nodes);
+    return valid;
+}
 
-    printf("Thread %d: Connected successfully, sending task...\n", data->thread_id);
+static void UpdateEvents(struct Client *client, struct ClientConn *conn, bool want_write) {
+    if (conn->want_write == want_write)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->want_write = want_write;
+}
 
-    char task[sizeof(uint64_t) * 3];
-    memcpy(task, &data->begin, sizeof(uint64_t));
-    memcpy(task + sizeof(uint64_t), &data->end, sizeof(uint64_t));
-    memcpy(task + 2 * sizeof(uint64_t), &data->mod, sizeof(uint64_t));
+// Копия eventfd есть у сервера, поэтому close не снимает его с epoll
+static void DetachShm(struct Client *client, struct ClientConn *conn) {
+    if (conn->shm.channel == NULL)
+        return;
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, conn->shm.bell, NULL);
+    ShmDetach(&conn->shm);
+}
+
+// Соединение больше не используется: его куски возвращаются планировщику
+static void FailConn(struct Client *client, struct ClientConn *conn, const char *reason) {
+    if (conn->state == CONN_CLOSED)
+        return;
+    LOG(LOG_WARN, "Server %s: %s\n", client->names[conn->index], reason);
+    for (int i = 0; i < conn->count; i++)
+        SchedulerReturn(client->scheduler, &conn->in_flight[i].chunk);
+    conn->count = 0;
+    SchedulerServerFailed(client->scheduler, conn->index);
+    TimerCancel(&client->wheel, &conn->timer);
+    DetachShm(client, conn);
+    if (conn->fd >= 0)
+        close(conn->fd); // заодно снимает дескриптор с epoll
+    conn->fd = -1;
+    conn->state = CONN_CLOSED;
+    client->open_count--;
+}
 
-    if (send(sck, task, sizeof(task), 0) < 0) {
-        fprintf(stderr, "Thread %d: Send failed to %s:%d\n", 
-                data->thread_id, data->server.ip, data->server.port);
-        close(sck);
-        data->result = 0;
-        goto thread_complete;
+// Соединение с закончившимся планировщиком закрывается без ошибки
+static void CloseConn(struct Client *client, struct ClientConn *conn) {
+    if (conn->state == CONN_CLOSED)
+        return;
+    TimerCancel(&client->wheel, &conn->timer);
+    DetachShm(client, conn);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->state = CONN_CLOSED;
+    client->open_count--;
+}
+
+static void FlushOut(struct Client *client, struct ClientConn *conn) {
+    // shm: что не поместилось в кольцо, дописывается, когда сервер
+    // освободит место и разбудит eventfd
+    if (conn->shm.channel != NULL) {
+        long sent = ShmSend(&conn->shm, conn->out + conn->out_sent,
+                            conn->out_len - conn->out_sent);
+        if (sent < 0) {
+            FailConn(client, conn, "shared memory ring corrupted");
+            return;
+        }
+        conn->out_sent += (size_t)sent;
+        if (conn->out_sent == conn->out_len) {
+            conn->out_len = 0;
+            conn->out_sent = 0;
+        }
+        return;
     }
+    while (conn->out_sent < conn->out_len) {
+        ssize_t sent = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent,
+                            MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                UpdateEvents(client, conn, true);
+                return;
+            }
+            FailConn(client, conn, "send failed");
+            return;
+        }
+        conn->out_sent += (size_t)sent;
+    }
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    UpdateEvents(client, conn, false);
+}
 
-    printf("Thread %d: Task sent, waiting for response...\n", data->thread_id);
+// Длина запроса на один кусок
+static size_t RequestSize(const struct Client *client, const struct ClientConn *conn) {
+    if (client->protocol == 1)
+        return PROTO_V1_REQUEST_SIZE;
+    size_t size = PROTO_HEADER_SIZE + (client->reduce ? ProtoReducePayloadSize(1)
+                                                      : ProtoRangePayloadSize(1));
+    return conn->child_count > 0 ? size + ProtoTreeSize(conn->child_count) : size;
+}
 
-    char response[sizeof(uint64_t)];
-    if (recv(sck, response, sizeof(response), 0) < 0) {
-        fprintf(stderr, "Thread %d: Receive failed from %s:%d\n", 
-                data->thread_id, data->server.ip, data->server.port);
-        close(sck);
-        data->result = 0;
-        goto thread_complete;
+// Место под size байт в конце выходного буфера
+static unsigned char *ReserveOut(struct ClientConn *conn, size_t size) {
+    if (conn->out_len + size > conn->out_cap) {
+        conn->out_cap = conn->out_len + size > 2 * conn->out_cap ? conn->out_len + size
+                                                                 : 2 * conn->out_cap;
+        conn->out = realloc(conn->out, conn->out_cap);
+    }
+    return conn->out + conn->out_len;
+}
+
+// Кадр v2 с одним куском: диапазон произведения или свёртка над ним, у
+// сервера с поддеревом — внутри кадра PROTO_OP_AGGREGATE. Возвращает длину
+// кадра, out вмещает RequestSize().
+static size_t EncodeChunk(const struct Client *client, const struct ClientConn *conn,
+                          const struct FactorialArgs *chunk, uint64_t id, unsigned char *out) {
+    uint8_t opcode = client->reduce ? PROTO_OP_REDUCE : PROTO_OP_RANGE;
+    size_t length = client->reduce ? ProtoReducePayloadSize(1) : ProtoRangePayloadSize(1);
+    size_t tree_size = conn->child_count > 0 ? ProtoTreeSize(conn->child_count) : 0;
+    struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION,
+                                 tree_size > 0 ? PROTO_OP_AGGREGATE : opcode, PROTO_STATUS_OK,
+                                 (uint32_t)(tree_size + length), id};
+    ProtoEncodeHeader(&header, out);
+    out += PROTO_HEADER_SIZE;
+    if (tree_size > 0) {
+        struct ProtoTree tree = {opcode, (uint16_t)client->fanout, conn->child_count};
+        ProtoEncodeTree(&tree, conn->children, out);
+        out += tree_size;
     }
 
-    memcpy(&data->result, response, sizeof(uint64_t));
-    printf("Thread %d: Got result from %s:%d: %lu (range %lu-%lu)\n", 
-           data->thread_id, data->server.ip, data->server.port, 
-           data->result, data->begin, data->end);
+    if (client->reduce) {
+        struct ReduceArgs args = {chunk->begin, chunk->end, client->scheduler->spec};
+        ProtoEncodeReductions(&args, 1, out);
+    } else {
+        ProtoEncodeRanges(chunk, 1, out);
+    }
+    return PROTO_HEADER_SIZE + tree_size + length;
+}
 
-    close(sck);
+static void AppendChunk(struct Client *client, struct ClientConn *conn,
+                        const struct FactorialArgs *chunk, uint64_t id) {
+    size_t size = RequestSize(client, conn);
+    unsigned char *out = ReserveOut(conn, size);
 
-thread_complete:
-    // Помечаем поток как завершенный и уведомляем монитор
-    pthread_mutex_lock(&monitor.mutex);
-    data->completed = true;
-    monitor.completed_threads++;
-    
-    printf("Thread %d: COMPLETED (%d/%d threads done)\n", 
-           data->thread_id, monitor.completed_threads, monitor.total_threads);
-    
-    // Если все потоки завершены, сигнализируем основному потоку
-    if (monitor.completed_threads == monitor.total_threads) {
-        pthread_cond_broadcast(&monitor.all_done);
+    if (client->protocol == 1) {
+        memcpy(out, &chunk->begin, sizeof(uint64_t));
+        memcpy(out + sizeof(uint64_t), &chunk->end, sizeof(uint64_t));
+        memcpy(out + 2 * sizeof(uint64_t), &chunk->mod, sizeof(uint64_t));
+        conn->out_len += size;
+        return;
     }
-    pthread_mutex_unlock(&monitor.mutex);
-    
-    return NULL;
+    conn->out_len += EncodeChunk(client, conn, chunk, id, out);
 }
 
-// Функция для проверки статуса потоков без блокировки
-void check_threads_progress() {
-    pthread_mutex_lock(&monitor.mutex);
-    int completed = monitor.completed_threads;
-    int total = monitor.total_threads;
-    pthread_mutex_unlock(&monitor.mutex);
-    
-    printf("Progress: %d/%d servers completed\n", completed, total);
+// UDP: кадр v2 одной датаграммой. Прочие ошибки отправки равносильны
+// потере, кусок уйдёт повторно по таймеру. Возвращает false, если
+// соединение закрыто.
+static bool SendDatagram(struct Client *client, struct ClientConn *conn,
+                         const struct InFlight *slot) {
+    // Выходной буфер в режиме UDP служит только для сборки датаграммы
+    unsigned char *frame = ReserveOut(conn, RequestSize(client, conn));
+    size_t size = EncodeChunk(client, conn, &slot->chunk.args, slot->id, frame);
+    if (send(conn->fd, frame, size, 0) >= 0)
+        return true;
+    // ECONNREFUSED: ICMP «порт недоступен» на прошлую датаграмму
+    if (errno == ECONNREFUSED) {
+        FailConn(client, conn, "connection refused");
+        return false;
+    }
+    LOG(LOG_DEBUG, "Server %s: datagram send failed, will retransmit\n",
+        client->names[conn->index]);
+    return true;
 }
 
-// Функция для ожидания завершения всех потоков с таймаутом
-bool wait_for_all_threads(int timeout_seconds) {
-    struct timeval now;
-    struct timespec timeout;
-    
-    pthread_mutex_lock(&monitor.mutex);
-    
-    gettimeofday(&now, NULL);
-    timeout.tv_sec = now.tv_sec + timeout_seconds;
-    timeout.tv_nsec = now.tv_usec * 1000;
-    
-    while (monitor.completed_threads < monitor.total_threads) {
-        printf("Waiting for %d more servers...\n", 
-               monitor.total_threads - monitor.completed_threads);
-        
-        if (pthread_cond_timedwait(&monitor.all_done, &monitor.mutex, &timeout) != 0) {
-            pthread_mutex_unlock(&monitor.mutex);
-            printf("Timeout waiting for servers after %d seconds\n", timeout_seconds);
-            return false;
+static double ResponseTimeout(const struct Client *client, const struct ClientConn *conn) {
+    return client->udp ? conn->rto : IO_TIMEOUT;
+}
+
+// Добирает куски до окна и отправляет их. Таймер ответа взведён, пока у
+// сервера есть неотвеченные куски.
+static void FillWindow(struct Client *client, struct ClientConn *conn, double now) {
+    if (conn->state != CONN_ACTIVE || now < conn->resume)
+        return;
+    bool added = false;
+    while (conn->count < client->window) {
+        struct InFlight *slot = &conn->in_flight[conn->count];
+        if (!SchedulerNext(client->scheduler, conn->index, &slot->chunk))
+            break;
+        slot->id = conn->next_id++;
+        slot->sent = now;
+        slot->cancelled = false;
+        if (conn->count == 0 && now > conn->last_done)
+            conn->last_done = now; // сервер простаивал, простой не входит в замер
+        conn->count++;
+        if (slot->chunk.role == CHUNK_SPECULATIVE)
+            LOG(LOG_DEBUG, "Server %s: speculative copy of range %lu-%lu\n",
+                client->names[conn->index], slot->chunk.args.begin, slot->chunk.args.end);
+        if (client->udp) {
+            if (!SendDatagram(client, conn, slot))
+                return;
+        } else
+            AppendChunk(client, conn, &slot->chunk.args, slot->id);
+        added = true;
+    }
+    if (added) {
+        if (!conn->timer.armed)
+            TimerArm(&client->wheel, &conn->timer, now, ResponseTimeout(client, conn));
+        if (!client->udp)
+            FlushOut(client, conn);
+    }
+}
+
+// connect для UDP только запоминает адрес сервера: соединение готово сразу
+static void StartDatagram(struct Client *client, struct ClientConn *conn, double now) {
+    conn->fd = socket(conn->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (conn->fd < 0) {
+        FailConn(client, conn, "socket creation failed");
+        return;
+    }
+    if (connect(conn->fd, (struct sockaddr *)&conn->addr, conn->addr_len) < 0) {
+        FailConn(client, conn, "connection failed");
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) < 0) {
+        FailConn(client, conn, "epoll_ctl failed");
+        return;
+    }
+    conn->state = CONN_ACTIVE;
+    conn->last_done = now;
+    conn->rto = client->retransmit;
+    FillWindow(client, conn, now);
+}
+
+static void StartConnect(struct Client *client, struct ClientConn *conn, double now) {
+    conn->fd = socket(conn->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn->fd < 0) {
+        FailConn(client, conn, "socket creation failed");
+        return;
+    }
+    if (connect(conn->fd, (struct sockaddr *)&conn->addr, conn->addr_len) < 0 &&
+        errno != EINPROGRESS) {
+        FailConn(client, conn, "connection failed");
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.ptr = conn;
+    if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) < 0) {
+        FailConn(client, conn, "epoll_ctl failed");
+        return;
+    }
+    conn->want_write = true;
+    TimerArm(&client->wheel, &conn->timer, now, CONNECT_TIMEOUT);
+}
+
+static void FinishConnect(struct Client *client, struct ClientConn *conn, double now) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        FailConn(client, conn, "connection failed");
+        return;
+    }
+    UpdateEvents(client, conn, false);
+    if (conn->transport == SERVER_SHM) {
+        // Тайм-аут connect покрывает и ответ на запрос каналов
+        unsigned char frame[PROTO_HEADER_SIZE];
+        struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION, PROTO_OP_SHM_ATTACH,
+                                     PROTO_STATUS_OK, 0, 0};
+        ProtoEncodeHeader(&header, frame);
+        if (send(conn->fd, frame, sizeof(frame), MSG_NOSIGNAL) != (ssize_t)sizeof(frame)) {
+            FailConn(client, conn, "connection failed");
+            return;
         }
+        conn->state = CONN_ATTACHING;
+        return;
     }
-    
-    pthread_mutex_unlock(&monitor.mutex);
+    conn->state = CONN_ACTIVE;
+    conn->last_done = now;
+    TimerCancel(&client->wheel, &conn->timer);
+    FillWindow(client, conn, now);
+}
+
+// Ответ на PROTO_OP_SHM_ATTACH: дальше кадры идут кольцами, а от сокета
+// нужно только закрытие сервером
+static void FinishAttach(struct Client *client, struct ClientConn *conn, double now) {
+    unsigned char reply[PROTO_HEADER_SIZE];
+    int fds[3];
+    int count;
+    long received = RecvFds(conn->fd, reply, sizeof(reply), fds, 3, &count);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    // Заголовок разбирается, только если пришёл целиком
+    bool valid = received == (long)sizeof(reply) && count == 3;
+    if (valid) {
+        struct FrameHeader header;
+        ProtoDecodeHeader(reply, &header);
+        valid = header.magic == PROTO_MAGIC && header.opcode == PROTO_OP_SHM_ATTACH &&
+                header.status == PROTO_STATUS_OK;
+    }
+    if (valid && ShmAttach(&conn->shm, fds[0], false, fds[2], fds[1]) != 0)
+        valid = false;
+    if (!valid) {
+        for (int i = 0; i < count; i++)
+            close(fds[i]);
+        FailConn(client, conn, "shared memory attach failed");
+        return;
+    }
+    close(fds[0]);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, conn->shm.bell, &event) < 0) {
+        FailConn(client, conn, "epoll_ctl failed");
+        return;
+    }
+    event.events = EPOLLRDHUP;
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->state = CONN_ACTIVE;
+    conn->last_done = now;
+    TimerCancel(&client->wheel, &conn->timer);
+    FillWindow(client, conn, now);
+}
+
+// Разбирает ответ из начала входного буфера. Возвращает его длину, 0 если
+// ответ пришёл не целиком, -1 при ошибке протокола.
+static long ParseResponse(struct Client *client, struct ClientConn *conn,
+                          struct Response *response) {
+    response->status = PROTO_STATUS_OK;
+    if (client->protocol == 1) {
+        if (conn->in_len < PROTO_V1_RESPONSE_SIZE)
+            return 0;
+        response->id = conn->in_flight[0].id;
+        uint64_t value;
+        memcpy(&value, conn->in, PROTO_V1_RESPONSE_SIZE);
+        response->result = value;
+        return (long)PROTO_V1_RESPONSE_SIZE;
+    }
+
+    if (conn->in_len < PROTO_HEADER_SIZE)
+        return 0;
+    struct FrameHeader header;
+    ProtoDecodeHeader(conn->in, &header);
+    if (header.magic != PROTO_MAGIC || header.length > MAX_RESPONSE_SIZE - PROTO_HEADER_SIZE)
+        return -1;
+    if (conn->in_len < PROTO_HEADER_SIZE + header.length)
+        return 0;
+    response->id = header.request_id;
+    response->status = header.status;
+    if (header.status == PROTO_STATUS_CANCELLED)
+        return (long)(PROTO_HEADER_SIZE + header.length);
+    if (header.status == PROTO_STATUS_OVERLOADED) {
+        if (header.length != PROTO_RETRY_AFTER_SIZE)
+            return -1;
+        response->retry_after_ms = ProtoGetU32(conn->in + PROTO_HEADER_SIZE);
+        return (long)(PROTO_HEADER_SIZE + header.length);
+    }
+    if (header.status != PROTO_STATUS_OK) {
+        LOG(LOG_WARN, "Server %s rejected request %lu with status %u\n",
+            client->names[conn->index], header.request_id, header.status);
+        return -1;
+    }
+    if (client->reduce) {
+        if (ProtoDecodeWideResults(conn->in + PROTO_HEADER_SIZE, header.length,
+                                   &response->result, 1) != 1)
+            return -1;
+    } else {
+        uint64_t value;
+        if (ProtoDecodeResults(conn->in + PROTO_HEADER_SIZE, header.length, &value, 1) != 1)
+            return -1;
+        response->result = value;
+    }
+    return (long)(PROTO_HEADER_SIZE + header.length);
+}
+
+static int FindInFlight(const struct ClientConn *conn, uint64_t id) {
+    for (int i = 0; i < conn->count; i++) {
+        if (conn->in_flight[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+static void RemoveInFlight(struct Client *client, struct ClientConn *conn, int index,
+                           double now) {
+    struct InFlight *slot = &conn->in_flight[index];
+    memmove(slot, slot + 1, sizeof(struct InFlight) * (size_t)(conn->count - index - 1));
+    conn->count--;
+    if (conn->count > 0)
+        TimerArm(&client->wheel, &conn->timer, now, ResponseTimeout(client, conn));
+    else
+        TimerCancel(&client->wheel, &conn->timer);
+}
+
+// Кусок посчитан: копии того же куска на других серверах больше не нужны, им
+// отправляется отмена. Проверочные пересчёты не отменяются. По UDP ответ на
+// отмену может потеряться, поэтому копия забывается сразу.
+static void CancelCopies(struct Client *client, const struct ClientConn *winner, uint32_t record,
+                         double now) {
+    if (client->protocol == 1 || !client->scheduler->records[record].done)
+        return;
+    for (int c = 0; c < client->conn_count; c++) {
+        struct ClientConn *conn = &client->conns[c];
+        if (conn == winner || conn->state != CONN_ACTIVE)
+            continue;
+        bool sent = false;
+        for (int i = 0; i < conn->count; i++) {
+            struct InFlight *slot = &conn->in_flight[i];
+            if (slot->chunk.index != record || slot->chunk.role == CHUNK_VERIFY || slot->cancelled)
+                continue;
+            unsigned char frame[PROTO_HEADER_SIZE];
+            struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION, PROTO_OP_CANCEL,
+                                         PROTO_STATUS_OK, 0, slot->id};
+            ProtoEncodeHeader(&header, frame);
+            LOG(LOG_DEBUG, "Server %s: cancelling copy of range %lu-%lu\n", client->names[c],
+                slot->chunk.args.begin, slot->chunk.args.end);
+            if (client->udp) {
+                send(conn->fd, frame, sizeof(frame), 0);
+                SchedulerReturn(client->scheduler, &slot->chunk);
+                RemoveInFlight(client, conn, i--, now);
+                continue;
+            }
+            memcpy(ReserveOut(conn, sizeof(frame)), frame, sizeof(frame));
+            conn->out_len += sizeof(frame);
+            slot->cancelled = true;
+            sent = true;
+        }
+        if (sent)
+            FlushOut(client, conn);
+    }
+}
+
+// Чистое время куска считается от момента, когда сервер освободился от
+// предыдущего, поэтому очередь на сервере не занижает его скорость
+static bool CompleteChunk(struct Client *client, struct ClientConn *conn, uint64_t id,
+                          unsigned __int128 result, double now) {
+    int index = FindInFlight(conn, id);
+    if (index < 0)
+        return false;
+
+    struct InFlight *done = &conn->in_flight[index];
+    uint32_t record = done->chunk.index;
+    double start = done->sent > conn->last_done ? done->sent : conn->last_done;
+    conn->last_done = now;
+    SchedulerComplete(client->scheduler, conn->index, &done->chunk, result, now - start);
+    conn->retries = 0;
+    conn->rto = client->retransmit;
+    RemoveInFlight(client, conn, index, now);
+    CancelCopies(client, conn, record, now);
     return true;
 }
 
+// Сервер подтвердил отмену: кусок уже посчитан другим сервером
+static bool DropChunk(struct Client *client, struct ClientConn *conn, uint64_t id, double now) {
+    int index = FindInFlight(conn, id);
+    if (index < 0)
+        return false;
+    SchedulerReturn(client->scheduler, &conn->in_flight[index].chunk);
+    RemoveInFlight(client, conn, index, now);
+    return true;
+}
+
+// Сервер перегружен: кусок возвращается планировщику и уходит свободному
+// серверу, а этому новые куски не выдаются, пока не пройдёт его подсказка
+static bool DeferChunk(struct Client *client, struct ClientConn *conn, uint64_t id,
+                       uint32_t retry_after_ms, double now) {
+    int index = FindInFlight(conn, id);
+    if (index < 0)
+        return false;
+    LOG(LOG_DEBUG, "Server %s overloaded, retry in %u ms\n", client->names[conn->index],
+        retry_after_ms);
+    SchedulerReturn(client->scheduler, &conn->in_flight[index].chunk);
+    RemoveInFlight(client, conn, index, now);
+    conn->resume = now + retry_after_ms / 1000.0;
+    conn->shed++;
+    return true;
+}
+
+// false — ответ на кусок, которого нет среди неотвеченных
+static bool HandleResponse(struct Client *client, struct ClientConn *conn,
+                           const struct Response *response, double now) {
+    if (response->status == PROTO_STATUS_CANCELLED)
+        return DropChunk(client, conn, response->id, now);
+    if (response->status == PROTO_STATUS_OVERLOADED)
+        return DeferChunk(client, conn, response->id, response->retry_after_ms, now);
+    return CompleteChunk(client, conn, response->id, response->result, now);
+}
+
+// recv из сокета или кольца ответов shm: пустое кольцо — EAGAIN, испорченное
+// — EPROTO
+static ssize_t Receive(struct ClientConn *conn, void *data, size_t size) {
+    if (conn->shm.channel == NULL)
+        return recv(conn->fd, data, size, 0);
+    long received = ShmReceive(&conn->shm, data, size);
+    if (received == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return received;
+}
+
+static void ReadResponses(struct Client *client, struct ClientConn *conn, double now) {
+    while (conn->state == CONN_ACTIVE) {
+        ssize_t received = Receive(conn, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+        if (received == 0) {
+            FailConn(client, conn, "connection closed by server");
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                FailConn(client, conn, "receive failed");
+            break;
+        }
+        conn->in_len += (size_t)received;
+
+        while (conn->in_len > 0) {
+            struct Response response;
+            long used = ParseResponse(client, conn, &response);
+            if (used == 0)
+                break;
+            if (used < 0 || !HandleResponse(client, conn, &response, now)) {
+                FailConn(client, conn, "bad response");
+                return;
+            }
+            memmove(conn->in, conn->in + used, conn->in_len - (size_t)used);
+            conn->in_len -= (size_t)used;
+        }
+    }
+    FillWindow(client, conn, now);
+}
+
+// Ответы на повторно отправленные куски приходят дважды, второй
+// отбрасывается по request_id
+static void ReadDatagrams(struct Client *client, struct ClientConn *conn, double now) {
+    while (conn->state == CONN_ACTIVE) {
+        ssize_t received = recv(conn->fd, conn->in, sizeof(conn->in), MSG_TRUNC);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            // ECONNREFUSED: ICMP «порт недоступен» на прошлую датаграмму
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                FailConn(client, conn, errno == ECONNREFUSED ? "connection refused"
+                                                             : "receive failed");
+            break;
+        }
+
+        struct Response response;
+        conn->in_len = (size_t)received <= sizeof(conn->in) ? (size_t)received : 0;
+        long used = ParseResponse(client, conn, &response);
+        conn->in_len = 0;
+        if (used <= 0 || used != received) {
+            FailConn(client, conn, "bad response");
+            return;
+        }
+        if (!HandleResponse(client, conn, &response, now))
+            LOG(LOG_DEBUG, "Server %s: duplicate reply %lu\n", client->names[conn->index],
+                response.id);
+    }
+    FillWindow(client, conn, now);
+}
+
+// UDP: все неотвеченные куски отправляются заново
+static void Retransmit(struct Client *client, struct ClientConn *conn, double now) {
+    if (++conn->retries > UDP_MAX_RETRIES) {
+        FailConn(client, conn, "no response");
+        return;
+    }
+    LOG(LOG_DEBUG, "Server %s: retransmitting %d chunks\n", client->names[conn->index],
+        conn->count);
+    for (int i = 0; i < conn->count; i++) {
+        if (!SendDatagram(client, conn, &conn->in_flight[i]))
+            return;
+    }
+    conn->rto *= 2;
+    TimerArm(&client->wheel, &conn->timer, now, conn->rto);
+}
+
+static void ExpireTimer(struct Timer *timer, void *arg) {
+    struct Client *client = arg;
+    struct ClientConn *conn =
+        (struct ClientConn *)((char *)timer - offsetof(struct ClientConn, timer));
+    if (client->udp && conn->state == CONN_ACTIVE) {
+        Retransmit(client, conn, NowSeconds());
+        return;
+    }
+    FailConn(client, conn, conn->state == CONN_ACTIVE ? "response timeout" : "connect timeout");
+}
+
+// Режим redundant: когда всё посчитано, случайные куски выдаются на
+// пересчёт серверам, которые их не считали
+static void QueueVerification(struct Client *client) {
+    if (client->redundant_samples == 0 || client->verification_queued ||
+        !SchedulerComputed(client->scheduler))
+        return;
+    client->verification_queued = true;
+    uint32_t *indices = malloc(sizeof(uint32_t) * client->redundant_samples);
+    uint32_t count = SchedulerSampleDone(client->scheduler, indices, client->redundant_samples);
+    SchedulerQueueVerification(client->scheduler, indices, count);
+    free(indices);
+}
+
+// Один поток, один epoll на все серверы. Возвращает true, если весь
+// диапазон посчитан (и проверен в режиме redundant) до истечения timeout.
+static bool RunClient(struct Client *client, double timeout) {
+    double now = NowSeconds();
+    double deadline = now + timeout;
+    TimerWheelInit(&client->wheel, TIMER_TICK, now);
+
+    for (int i = 0; i < client->conn_count; i++) {
+        struct ClientConn *conn = &client->conns[i];
+        if (conn->addr_len == 0) {
+            FailConn(client, conn, "address not resolved");
+            continue;
+        }
+        if (client->udp && conn->transport != SERVER_TCP)
+            FailConn(client, conn, "UDP needs an ip:port server");
+        else if (client->udp)
+            StartDatagram(client, conn, now);
+        else
+            StartConnect(client, conn, now);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!SchedulerDone(client->scheduler) && client->open_count > 0 && now < deadline) {
+        // Свободным соединениям работа может появиться со временем (копии
+        // запаздывающих кусков), поэтому без таймеров всё равно просыпаемся
+        int wait_ms = TimerWheelTimeoutMs(&client->wheel, now);
+        if (wait_ms < 0 || wait_ms > IDLE_POLL_MS)
+            wait_ms = IDLE_POLL_MS;
+
+        int count = epoll_wait(client->epoll_fd, events, MAX_EVENTS, wait_ms);
+        if (count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        now = NowSeconds();
+
+        for (int i = 0; i < count; i++) {
+            struct ClientConn *conn = events[i].data.ptr;
+            if (conn->state == CONN_CLOSED)
+                continue;
+            if (conn->state == CONN_CONNECTING) {
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    FinishConnect(client, conn, now);
+                continue;
+            }
+            if (conn->state == CONN_ATTACHING) {
+                FinishAttach(client, conn, now);
+                continue;
+            }
+            if (conn->shm.channel != NULL) {
+                // Событие сокета — только закрытие, остальное — eventfd
+                if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    FailConn(client, conn, "connection closed by server");
+                    continue;
+                }
+                ShmClearBell(&conn->shm);
+                ReadResponses(client, conn, now);
+                if (conn->state == CONN_ACTIVE)
+                    FlushOut(client, conn);
+                continue;
+            }
+            if (client->udp) {
+                ReadDatagrams(client, conn, now);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                ReadResponses(client, conn, now);
+            if (conn->state == CONN_ACTIVE && (events[i].events & EPOLLOUT))
+                FlushOut(client, conn);
+        }
+
+        TimerWheelAdvance(&client->wheel, now, ExpireTimer, client);
+        QueueVerification(client);
+        for (int i = 0; i < client->conn_count; i++) {
+            if (client->conns[i].state == CONN_ACTIVE && client->conns[i].count == 0)
+                FillWindow(client, &client->conns[i], now);
+        }
+    }
+
+    for (int i = 0; i < client->conn_count; i++)
+        CloseConn(client, &client->conns[i]);
+    return SchedulerDone(client->scheduler);
+}
+
+// Каждый сервер — открытый дескриптор, поэтому мягкий предел поднимается
+// до жёсткого
+static void RaiseFileLimit(int servers_num) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= (rlim_t)servers_num + 16)
+        return;
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < (rlim_t)servers_num + 16)
+        fprintf(stderr, "Open file limit is too low for %d servers\n", servers_num);
+}
+
+enum VerifyMode {
+    VERIFY_MODE_NONE,
+    VERIFY_MODE_SAMPLED,        // локальный пересчёт случайных кусков
+    VERIFY_MODE_REDUNDANT,      // пересчёт случайных кусков другими серверами
+    VERIFY_MODE_FULL,           // последовательное вычисление всего k!
+};
+
+static const char *VERIFY_MODE_NAMES[] = {"none", "sampled", "redundant", "full"};
+
+static bool ParseVerifyMode(const char *name, enum VerifyMode *mode) {
+    for (int i = 0; i <= VERIFY_MODE_FULL; i++) {
+        if (strcmp(name, VERIFY_MODE_NAMES[i]) == 0) {
+            *mode = (enum VerifyMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Локальный пересчёт куска. Для n! свёртка сводится к Factorial().
+static unsigned __int128 ComputeLocal(const struct Scheduler *scheduler, uint64_t begin,
+                                      uint64_t end) {
+    struct ReduceArgs args = {begin, end, scheduler->spec};
+    return Reduce(&args);
+}
+
+// Сверка случайных кусков с локальным пересчётом
+static void VerifySampled(struct Scheduler *scheduler, uint32_t samples) {
+    uint32_t *indices = malloc(sizeof(uint32_t) * samples);
+    uint32_t count = SchedulerSampleDone(scheduler, indices, samples);
+    for (uint32_t i = 0; i < count; i++) {
+        struct FactorialArgs args = scheduler->records[indices[i]].args;
+        SchedulerCheckLocal(scheduler, indices[i], ComputeLocal(scheduler, args.begin, args.end));
+    }
+    free(indices);
+}
+
+static void PrintDiscrepancies(const struct Scheduler *scheduler, char **names) {
+    for (uint32_t i = 0; i < scheduler->discrepancy_count; i++) {
+        const struct Discrepancy *d = &scheduler->discrepancies[i];
+        const struct FactorialArgs *args = &scheduler->records[d->index].args;
+        char result_a[40];
+        char result_b[40];
+        ReduceFormat(d->result_a, result_a, sizeof(result_a));
+        ReduceFormat(d->result_b, result_b, sizeof(result_b));
+        if (d->server_b < 0)
+            printf("Mismatch in range %lu-%lu: server %s returned %s, local recomputation %s\n",
+                   args->begin, args->end, names[d->server_a], result_a, result_b);
+        else
+            printf("Mismatch in range %lu-%lu: server %s returned %s, server %s returned %s\n",
+                   args->begin, args->end, names[d->server_a], result_a, names[d->server_b],
+                   result_b);
+    }
+}
+
+// ip:port, для локальных серверов unix:путь или shm:путь
+static int FormatServer(const struct Server *server, char *out, size_t size) {
+    if (server->transport == SERVER_TCP)
+        return snprintf(out, size, "%s:%d", server->ip, server->port);
+    return snprintf(out, size, "%s:%s", server->transport == SERVER_SHM ? "shm" : "unix",
+                    server->ip);
+}
+
+static int ConnectExact(const struct ClientConn *conn, int timeout) {
+    int fd = socket(conn->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct timeval limit = {timeout, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+    if (connect(fd, (const struct sockaddr *)&conn->addr, conn->addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int SendExact(int fd, uint64_t id, uint64_t begin, uint64_t end) {
+    unsigned char frame[PROTO_HEADER_SIZE + sizeof(uint32_t) + PROTO_RANGE_SIZE];
+    struct FactorialArgs args = {begin, end, 0};
+    size_t length = ProtoRangePayloadSize(1);
+    struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION, PROTO_OP_EXACT, PROTO_STATUS_OK,
+                                 (uint32_t)length, id};
+    ProtoEncodeHeader(&header, frame);
+    ProtoEncodeRanges(&args, 1, frame + PROTO_HEADER_SIZE);
+    return SendAll(fd, frame, PROTO_HEADER_SIZE + length);
+}
+
+// Ответ на SendExact: 0 и произведение в out или -1
+static int RecvExact(int fd, uint64_t id, struct BigNum *out) {
+    unsigned char head[PROTO_HEADER_SIZE];
+    if (RecvAll(fd, head, sizeof(head)) != 0)
+        return -1;
+    struct FrameHeader header;
+    ProtoDecodeHeader(head, &header);
+    if (header.magic != PROTO_MAGIC || header.opcode != PROTO_OP_EXACT ||
+        header.request_id != id || header.length > ProtoResultPayloadSize(PROTO_MAX_EXACT_RANGE))
+        return -1;
+    unsigned char *payload = malloc(header.length + 1);
+    int count = -1;
+    if (RecvAll(fd, payload, header.length) == 0 && header.status == PROTO_STATUS_OK &&
+        header.length >= sizeof(uint32_t)) {
+        size_t max = (header.length - sizeof(uint32_t)) / sizeof(uint64_t);
+        BigResize(out, max);
+        count = ProtoDecodeResults(payload, header.length, out->limbs, (uint32_t)max);
+        out->size = count < 0 ? 0 : (size_t)count;
+        BigNormalize(out);
+    }
+    free(payload);
+    return count < 0 ? -1 : 0;
+}
+
+// Точный режим: [1, k] делится поровну между серверами, каждый возвращает
+// точное произведение своей части, клиент перемножает их тем же деревом.
+// Запросы уходят всем сразу, ответы читаются по очереди. Часть сервера,
+// который не ответил или отказал, считается локально. Для shm-серверов
+// кадры идут обычным потоком по их unix-сокету.
+static int RunExact(const struct Server *servers, int count, uint64_t k, const uint64_t *mod,
+                    const char *out_path, int timeout) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    if ((uint64_t)count > k)
+        count = (int)k;
+    struct ClientConn *conns = calloc((size_t)count, sizeof(struct ClientConn));
+    struct BigNum *parts = malloc(sizeof(struct BigNum) * (size_t)count);
+    uint64_t *begins = malloc(sizeof(uint64_t) * ((size_t)count + 1));
+    int *fds = malloc(sizeof(int) * (size_t)count);
+    ResolveServers(servers, conns, count);
+
+    double start = NowSeconds();
+    for (int i = 0; i <= count; i++)
+        begins[i] = 1 + (uint64_t)((unsigned __int128)k * (unsigned)i / (unsigned)count);
+    for (int i = 0; i < count; i++) {
+        BigInit(&parts[i]);
+        fds[i] = -1;
+        if (begins[i + 1] - begins[i] > PROTO_MAX_EXACT_RANGE || conns[i].addr_len == 0)
+            continue;
+        fds[i] = ConnectExact(&conns[i], timeout);
+        if (fds[i] >= 0 && SendExact(fds[i], (uint64_t)i, begins[i], begins[i + 1] - 1) != 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        bool received = fds[i] >= 0 && RecvExact(fds[i], (uint64_t)i, &parts[i]) == 0;
+        if (fds[i] >= 0)
+            close(fds[i]);
+        char name[sizeof(servers[i].ip) + 32];
+        FormatServer(&servers[i], name, sizeof(name));
+        if (received) {
+            printf("Server %s: %lu-%lu, %zu bits\n", name, begins[i], begins[i + 1] - 1,
+                   BigBits(&parts[i]));
+        } else {
+            printf("Server %s failed, computing %lu-%lu locally\n", name, begins[i],
+                   begins[i + 1] - 1);
+            BigProductRange(&parts[i], begins[i], begins[i + 1] - 1, threads);
+        }
+    }
+
+    struct BigNum result;
+    BigInit(&result);
+    BigProductOf(&result, parts, count, threads);
+    printf("Computed %lu! exactly in %.3f s: %zu bits\n", k, NowSeconds() - start,
+           BigBits(&result));
+    if (BigBits(&result) <= EXACT_PRINT_BITS) {
+        char *text = BigToDecimal(&result);
+        printf("Final result: %lu! = %s\n", k, text);
+        free(text);
+    }
+    if (mod != NULL)
+        printf("Final result: %lu! mod %lu = %lu\n", k, *mod, BigModU64(&result, *mod));
+
+    int status = 0;
+    if (out_path != NULL) {
+        FILE *out = fopen(out_path, "w");
+        char *text = BigToHex(&result);
+        if (out == NULL || fprintf(out, "%s\n", text) < 0) {
+            fprintf(stderr, "Cannot write %s\n", out_path);
+            status = 1;
+        }
+        if (out != NULL && fclose(out) != 0)
+            status = 1;
+        free(text);
+    }
+    BigFree(&result);
+    free(fds);
+    free(begins);
+    free(parts);
+    free(conns);
+    return status;
+}
+
 int main(int argc, char **argv) {
     uint64_t k = 0;
     uint64_t mod = 0;
     bool k_set = false;
     bool mod_set = false;
     char servers_file[255] = {'\0'};
-
-    // Инициализация монитора
-    monitor.threads = NULL;
-    monitor.total_threads = 0;
-    monitor.completed_threads = 0;
-    pthread_mutex_init(&monitor.mutex, NULL);
-    pthread_cond_init(&monitor.all_done, NULL);
+    int protocol = 2;
+    int window = DEFAULT_WINDOW;
+    int chunk_ms = DEFAULT_CHUNK_MS;
+    const char *profile = NULL;
+    int timeout = DEFAULT_TIMEOUT;
+    enum VerifyMode verify_mode = VERIFY_MODE_SAMPLED;
+    int verify_samples = DEFAULT_VERIFY_SAMPLES;
+    enum LogLevel level = LOG_INFO;
+    bool udp = false;
+    int fanout = 0;
+    // Без --reduce считается k! mod m: произведение по модулю над x_i = i
+    bool reduce = false;
+    struct ReduceSpec spec = {REDUCE_PRODUCT, REDUCE_GEN_INDEX, 1, 0, 0};
+    uint64_t below = 0;
+    bool exact = false;
+    const char *exact_out = NULL;
 
     while (true) {
         static struct option options[] = {
             {"k", required_argument, 0, 0},
             {"mod", required_argument, 0, 0},
             {"servers", required_argument, 0, 0},
+            {"protocol", required_argument, 0, 0},
+            {"window", required_argument, 0, 0},
+            {"chunk-ms", required_argument, 0, 0},
+            {"profile", required_argument, 0, 0},
+            {"timeout", required_argument, 0, 0},
+            {"verify", required_argument, 0, 0},
+            {"verify-samples", required_argument, 0, 0},
+            {"log-level", required_argument, 0, 0},
+            {"udp", no_argument, 0, 0},
+            {"reduce", required_argument, 0, 0},
+            {"generator", required_argument, 0, 0},
+            {"seed", required_argument, 0, 0},
+            {"bound", required_argument, 0, 0},
+            {"below", required_argument, 0, 0},
+            {"fanout", required_argument, 0, 0},
+            {"exact", no_argument, 0, 0},
+            {"exact-out", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -221,6 +1177,103 @@ int main(int argc, char **argv) {
                 strncpy(servers_file, optarg, sizeof(servers_file) - 1);
                 servers_file[sizeof(servers_file) - 1] = '\0';
                 break;
+            case 3:
+                protocol = atoi(optarg);
+                if (protocol != 1 && protocol != 2) {
+                    fprintf(stderr, "Protocol must be 1 or 2\n");
+                    return 1;
+                }
+                break;
+            case 4:
+                window = atoi(optarg);
+                if (window <= 0 || window > MAX_WINDOW) {
+                    fprintf(stderr, "Window must be in [1, %d]\n", MAX_WINDOW);
+                    return 1;
+                }
+                break;
+            case 5:
+                chunk_ms = atoi(optarg);
+                if (chunk_ms <= 0) {
+                    fprintf(stderr, "Chunk duration must be positive\n");
+                    return 1;
+                }
+                break;
+            case 6:
+                profile = optarg;
+                break;
+            case 7:
+                timeout = atoi(optarg);
+                if (timeout <= 0) {
+                    fprintf(stderr, "Timeout must be positive\n");
+                    return 1;
+                }
+                break;
+            case 8:
+                if (!ParseVerifyMode(optarg, &verify_mode)) {
+                    fprintf(stderr, "Verify mode must be none, sampled, redundant or full\n");
+                    return 1;
+                }
+                break;
+            case 9:
+                verify_samples = atoi(optarg);
+                if (verify_samples <= 0) {
+                    fprintf(stderr, "Verify samples must be positive\n");
+                    return 1;
+                }
+                break;
+            case 10:
+                if (!LogParseLevel(optarg, &level)) {
+                    fprintf(stderr, "Log level must be error, warn, info or debug\n");
+                    return 1;
+                }
+                break;
+            case 11:
+                udp = true;
+                break;
+            case 12:
+                if (!ReduceParseOp(optarg, &spec.op)) {
+                    fprintf(stderr, "Reduce must be sum, min, max, product or count\n");
+                    return 1;
+                }
+                reduce = true;
+                break;
+            case 13:
+                if (!ReduceParseGenerator(optarg, &spec.generator)) {
+                    fprintf(stderr, "Generator must be index or random\n");
+                    return 1;
+                }
+                break;
+            case 14:
+                if (!ConvertStringToUI64(optarg, &spec.seed)) {
+                    fprintf(stderr, "Invalid seed value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 15:
+                if (!ConvertStringToUI64(optarg, &spec.bound)) {
+                    fprintf(stderr, "Invalid bound value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 16:
+                if (!ConvertStringToUI64(optarg, &below)) {
+                    fprintf(stderr, "Invalid below value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 17:
+                fanout = atoi(optarg);
+                if (fanout <= 0 || fanout > UINT16_MAX) {
+                    fprintf(stderr, "Fanout must be between 1 and %d\n", UINT16_MAX);
+                    return 1;
+                }
+                break;
+            case 18:
+                exact = true;
+                break;
+            case 19:
+                exact_out = optarg;
+                break;
             default:
                 printf("Index %d is out of options\n", option_index);
             }
@@ -234,53 +1287,50 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (!k_set || !mod_set || !strlen(servers_file)) {
-        fprintf(stderr, "Using: %s --k 1000 --mod 5 --servers /path/to/file\n", argv[0]);
+    // Модуль нужен только произведению, точному — по желанию
+    bool needs_mod = spec.op == REDUCE_PRODUCT && !exact;
+    if (!k_set || (needs_mod && !mod_set) || !strlen(servers_file)) {
+        fprintf(stderr,
+                "Using: %s --k 1000 --mod 5 --servers /path/to/file "
+                "[--protocol 2] [--window %d] [--chunk-ms %d] [--profile file] "
+                "[--timeout %d] [--verify none|sampled|redundant|full] "
+                "[--verify-samples %d] [--log-level error|warn|info|debug] [--udp] "
+                "[--reduce sum|min|max|product|count [--generator index|random] [--seed 1] "
+                "[--bound N] [--below N]] [--fanout N] [--exact [--exact-out file]]\n"
+                "With --reduce the elements 1..k are reduced, --mod is needed for product only\n"
+                "With --fanout the servers form trees, the client talks to N roots only\n"
+                "With --exact k! is computed exactly, --exact-out saves it in hex\n",
+                argv[0], DEFAULT_WINDOW, DEFAULT_CHUNK_MS, DEFAULT_TIMEOUT,
+                DEFAULT_VERIFY_SAMPLES);
         return 1;
     }
 
-    if (k == 0 || mod == 0) {
-        fprintf(stderr, "k and mod must be positive values\n");
+    if ((udp || reduce || fanout > 0) && protocol != 2) {
+        fprintf(stderr, "UDP, reduce and tree modes use protocol 2 frames\n");
+        return 1;
+    }
+    if (exact && (udp || reduce || fanout > 0 || protocol != 2)) {
+        fprintf(stderr, "Exact mode uses protocol 2 over TCP or unix sockets only\n");
         return 1;
     }
 
-    FILE* file = fopen(servers_file, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Cannot open servers file: %s\n", servers_file);
+    if (k == 0 || ((needs_mod || (exact && mod_set)) && mod == 0)) {
+        fprintf(stderr, "k and mod must be positive values\n");
         return 1;
     }
+    spec.param = spec.op == REDUCE_PRODUCT ? mod : below;
+    // При k >= mod среди множителей есть сам mod, и k! mod mod = 0 без счёта
+    if (!reduce && !exact && k >= mod) {
+        printf("Final result: %lu! mod %lu = 0\n", k, mod);
+        return 0;
+    }
 
     struct Server* servers = NULL;
-    int servers_num = 0;
-    char line[255];
-    
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;
-        
-        if (strlen(line) == 0) continue;
-        
-        struct Server server;
-        char* colon = strchr(line, ':');
-        if (colon == NULL) {
-            fprintf(stderr, "Invalid server format: %s (expected ip:port)\n", line);
-            continue;
-        }
-        
-        *colon = '\0';
-        strncpy(server.ip, line, sizeof(server.ip) - 1);
-        server.ip[sizeof(server.ip) - 1] = '\0';
-        server.port = atoi(colon + 1);
-        
-        if (server.port <= 0) {
-            fprintf(stderr, "Invalid port in: %s\n", line);
-            continue;
-        }
-        
-        servers_num++;
-        servers = realloc(servers, sizeof(struct Server) * servers_num);
-        servers[servers_num - 1] = server;
+    int servers_num = ReadServers(servers_file, &servers);
+    if (servers_num < 0) {
+        fprintf(stderr, "Cannot open servers file: %s\n", servers_file);
+        return 1;
     }
-    fclose(file);
 
     if (servers_num == 0) {
         fprintf(stderr, "No valid servers found in file: %s\n", servers_file);
@@ -288,105 +1338,186 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    printf("Starting PARALLEL computation of %lu! mod %lu using %d servers\n", k, mod, servers_num);
+    if (exact) {
+        printf("Starting PARALLEL exact computation of %lu! using %d servers\n", k, servers_num);
+        int status = RunExact(servers, servers_num, k, mod_set ? &mod : NULL, exact_out, timeout);
+        free(servers);
+        return status;
+    }
 
-    // Инициализация данных потоков
-    struct ThreadData *thread_data = malloc(sizeof(struct ThreadData) * servers_num);
-    monitor.threads = thread_data;
-    monitor.total_threads = servers_num;
+    // Описание задачи для итоговых строк
+    char job[128];
+    if (!reduce)
+        snprintf(job, sizeof(job), "%lu! mod %lu", k, mod);
+    else if (spec.generator == REDUCE_GEN_INDEX)
+        snprintf(job, sizeof(job), "%s of 1..%lu", ReduceOpName(spec.op), k);
+    else
+        snprintf(job, sizeof(job), "%s of %lu random values (seed %lu)", ReduceOpName(spec.op), k,
+                 spec.seed);
+    if (fanout > 0 && servers_num > PROTO_MAX_CHILDREN) {
+        fprintf(stderr, "Tree mode supports at most %d servers\n", PROTO_MAX_CHILDREN);
+        free(servers);
+        return 1;
+    }
 
-    uint64_t numbers_per_server = k / (uint64_t)servers_num;
-    uint64_t remainder = k % (uint64_t)servers_num;
-    uint64_t current_start = 1;
+    // В режиме дерева планировщик видит только корни: кусок корня считает
+    // всё его поддерево
+    int conn_count = fanout > 0 ? (int)ProtoTreeGroups((uint32_t)servers_num, (uint32_t)fanout)
+                                : servers_num;
+    if (fanout > 0)
+        printf("Starting PARALLEL computation of %s using %d servers in %d trees\n", job,
+               servers_num, conn_count);
+    else
+        printf("Starting PARALLEL computation of %s using %d servers\n", job, servers_num);
 
-    // Инициализация и запуск всех потоков
-    for (int i = 0; i < servers_num; i++) {
-        thread_data[i].server = servers[i];
-        thread_data[i].begin = current_start;
-        thread_data[i].end = current_start + numbers_per_server - 1;
-        
-        if (remainder > 0) {
-            thread_data[i].end++;
-            remainder--;
-        }
-        
-        thread_data[i].mod = mod;
-        thread_data[i].thread_id = i;
-        thread_data[i].completed = false;
-        thread_data[i].result = 1;
-        
-        pthread_mutex_init(&thread_data[i].mutex, NULL);
-        pthread_cond_init(&thread_data[i].cond, NULL);
-
-        current_start = thread_data[i].end + 1;
-
-        printf("Server %d: %s:%d will compute range %lu-%lu\n", 
-               i, servers[i].ip, servers[i].port, 
-               thread_data[i].begin, thread_data[i].end);
-
-        // Запускаем все потоки
-        if (pthread_create(&thread_data[i].thread, NULL, ServerThread, &thread_data[i]) != 0) {
-            fprintf(stderr, "Failed to create thread for server %s:%d\n", 
-                    servers[i].ip, servers[i].port);
-            thread_data[i].result = 1;
-            thread_data[i].completed = true;
-            
-            pthread_mutex_lock(&monitor.mutex);
-            monitor.completed_threads++;
-            pthread_mutex_unlock(&monitor.mutex);
+    // Весь диапазон раздаётся кусками по мере готовности серверов
+    struct Scheduler scheduler;
+    SchedulerInit(&scheduler, 1, k, &spec, conn_count, chunk_ms / 1000.0);
+    // Простой модуль меньше 2^32: длинный кусок сервер считает сублинейно,
+    // за два факториала почти независимо от длины куска, а короче порога —
+    // линейным ядром. Поэтому каждому серверу достаётся один кусок, равная
+    // доля, но не короче порога движка.
+    if (!reduce) {
+        struct ModContext mod_ctx;
+        ModInit(&mod_ctx, mod);
+        if (PrimeEngineApplies(&mod_ctx, 1, k)) {
+            uint64_t share = (k - 1) / (uint64_t)conn_count + 1;
+            scheduler.min_chunk = share > PRIME_ENGINE_MIN_RANGE ? share
+                                                                 : PRIME_ENGINE_MIN_RANGE + 1;
         }
     }
 
-    printf("\nAll %d server threads started working\n", servers_num);
-    printf("Waiting for completion...\n\n");
+    // Корень дерева называется по своему адресу и размеру поддерева: ip:port+N
+    char **names = malloc(sizeof(char *) * conn_count);
+    for (int i = 0; i < conn_count; i++) {
+        uint32_t first = (uint32_t)i;
+        uint32_t size = 1;
+        if (fanout > 0)
+            ProtoTreeGroup((uint32_t)servers_num, (uint32_t)fanout, (uint32_t)i, &first, &size);
+        const struct Server *root = &servers[first];
+        size_t name_size = sizeof(root->ip) + 32;
+        names[i] = malloc(name_size);
+        int length = FormatServer(root, names[i], name_size);
+        if (size > 1)
+            snprintf(names[i] + length, name_size - (size_t)length, "+%u", size - 1);
+    }
+    if (profile != NULL && SchedulerLoadProfile(&scheduler, profile, names) == 0)
+        printf("Loaded server profile %s\n", profile);
 
-    // Ждем завершения ВСЕХ потоков ПАРАЛЛЕЛЬНО с возможностью показа прогресса
-    bool all_completed = wait_for_all_threads(30); // 30 секунд таймаут
+    struct Client client;
+    client.epoll_fd = epoll_create1(0);
+    if (client.epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    client.scheduler = &scheduler;
+    client.names = names;
+    client.conn_count = conn_count;
+    client.open_count = conn_count;
+    client.protocol = protocol;
+    client.window = window;
+    client.udp = udp;
+    client.reduce = reduce;
+    client.fanout = fanout;
+    client.retransmit = UDP_RETRANSMIT_MIN + 2.0 * window * chunk_ms / 1000.0;
+    client.redundant_samples = verify_mode == VERIFY_MODE_REDUNDANT ? (uint32_t)verify_samples : 0;
+    client.verification_queued = false;
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+    client.conns = calloc((size_t)conn_count, sizeof(struct ClientConn));
+    for (int i = 0; i < conn_count; i++) {
+        client.conns[i].index = i;
+        client.conns[i].fd = -1;
+        client.conns[i].state = CONN_CONNECTING;
+        client.conns[i].in_flight = malloc(sizeof(struct InFlight) * (size_t)window);
+    }
 
-    if (!all_completed) {
-        printf("Some servers didn't respond in time. Using available results.\n");
+    fflush(stdout);
+    if (LogStart(level) != 0) {
+        fprintf(stderr, "Could not start log writer\n");
+        return 1;
+    }
+    RaiseFileLimit(conn_count);
+    if (fanout == 0)
+        ResolveServers(servers, client.conns, servers_num);
+    else if (!BuildTrees(&client, servers, servers_num)) {
+        LogShutdown();
+        return 1;
     }
 
-    // Показываем финальный прогресс
-    check_threads_progress();
+    // Отказы и зависания отдельных серверов покрываются повторной выдачей
+    // и спекулятивными копиями
+    bool finished = RunClient(&client, timeout);
+    // Итоги печатаются после всех записей журнала
+    LogShutdown();
+    if (!finished)
+        printf("Computation did not finish: timeout or no live servers left\n");
 
-    // Объединяем результаты от всех серверов
-    uint64_t total_result = 1;
-    int successful_servers = 0;
-    
-    for (int i = 0; i < servers_num; i++) {
-        if (thread_data[i].completed && thread_data[i].result != 0) {
-            total_result = MultModulo(total_result, thread_data[i].result, mod);
-            successful_servers++;
-            
-            // Освобождаем ресурсы мьютексов
-            pthread_mutex_destroy(&thread_data[i].mutex);
-            pthread_cond_destroy(&thread_data[i].cond);
-        }
+    // Результат собран планировщиком из посчитанных кусков
+    unsigned __int128 total_result = scheduler.value;
+    char total_text[40];
+    ReduceFormat(total_result, total_text, sizeof(total_text));
+    uint64_t covered = scheduler.covered;
+    printf("Chunks: %u issued, %lu retried, %lu speculative copies, %lu late duplicates\n",
+           scheduler.record_count, scheduler.retried, scheduler.speculated,
+           scheduler.duplicates);
+    if (verify_mode == VERIFY_MODE_SAMPLED && covered == scheduler.total)
+        VerifySampled(&scheduler, (uint32_t)verify_samples);
+    for (int i = 0; i < conn_count; i++) {
+        const struct ServerRate *rate = &scheduler.rates[i];
+        printf("Server %s: %lu numbers in %lu chunks, %.2f M/s, %lu checked, %lu mismatched\n",
+               names[i], rate->numbers, rate->chunks, rate->rate / 1e6, rate->checked,
+               rate->mismatched);
+        if (client.conns[i].shed > 0)
+            printf("Server %s: %lu chunks shed while overloaded\n", names[i],
+                   client.conns[i].shed);
     }
+    PrintDiscrepancies(&scheduler, names);
 
-    printf("\n%d/%d servers completed successfully\n", successful_servers, servers_num);
-    printf("Final result: %lu! mod %lu = %lu\n", k, mod, total_result);
+    // Свёртка части кусков — не ответ, поэтому неполный результат не печатается
+    bool complete = covered == scheduler.total;
+    if (complete)
+        printf("Final result: %s = %s\n", job, total_text);
+    else
+        printf("\nOnly %lu of %lu numbers were computed, no result for %s\n", covered,
+               scheduler.total, job);
 
-    // Проверка: последовательное вычисление для верификации
-    uint64_t sequential_result = 1;
-    for (uint64_t i = 1; i <= k; i++) {
-        sequential_result = MultModulo(sequential_result, i, mod);
-    }
-    printf("Sequential result for verification: %lu\n", sequential_result);
-    
-    if (sequential_result == total_result) {
-        printf("Results match! Parallel computation successful!\n");
-    } else {
-        printf("Results don't match! Parallel: %lu, Sequential: %lu\n", 
-               total_result, sequential_result);
+    if (profile != NULL && SchedulerSaveProfile(&scheduler, profile, names) != 0)
+        fprintf(stderr, "Cannot save server profile %s\n", profile);
+
+    if (verify_mode == VERIFY_MODE_FULL && complete) {
+        // Последовательное вычисление всего диапазона — дорого, только по запросу
+        unsigned __int128 sequential_result = ComputeLocal(&scheduler, 1, k);
+        char sequential_text[40];
+        ReduceFormat(sequential_result, sequential_text, sizeof(sequential_text));
+        printf("Sequential result for verification: %s\n", sequential_text);
+
+        if (sequential_result == total_result) {
+            printf("Results match! Parallel computation successful!\n");
+        } else {
+            printf("Results don't match! Parallel: %s, Sequential: %s\n",
+                   total_text, sequential_text);
+        }
+    } else if (verify_mode != VERIFY_MODE_NONE) {
+        // Опоздавшие копии сверяются в любом режиме и тоже входят в счёт
+        printf("Verification (%s): %lu chunk results cross-checked, %u mismatches",
+               VERIFY_MODE_NAMES[verify_mode], scheduler.checked, scheduler.discrepancy_count);
+        if (scheduler.verify_skipped > 0)
+            printf(", %u skipped for lack of another live server", scheduler.verify_skipped);
+        printf("\n");
     }
 
     // Освобождаем ресурсы
-    free(thread_data);
+    for (int i = 0; i < conn_count; i++) {
+        free(client.conns[i].in_flight);
+        free(client.conns[i].out);
+        free(client.conns[i].children);
+        free(names[i]);
+    }
+    free(client.conns);
+    close(client.epoll_fd);
+    SchedulerDestroy(&scheduler);
+    free(names);
     free(servers);
-    pthread_mutex_destroy(&monitor.mutex);
-    pthread_cond_destroy(&monitor.all_done);
     
-    return 0;
-}
\ No newline at end of file
+    return complete ? 0 : 1;
+}
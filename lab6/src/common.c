@@ -1,17 +1,16 @@
 #include "common.h"
+#include "modarith.h"
+#include "prime_factorial.h"
+#include "range_kernel.h"
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <sys/un.h>
 
 uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
-    uint64_t result = 0;
-    a = a % mod;
-    while (b > 0) {
-        if (b % 2 == 1)
-            result = (result + a) % mod;
-        a = (a * 2) % mod;
-        b /= 2;
-    }
-    return result % mod;
+    return ModMulWide(a, b, mod);
 }
 
 bool ConvertStringToUI64(const char *str, uint64_t *val) {
@@ -29,10 +28,65 @@ bool ConvertStringToUI64(const char *str, uint64_t *val) {
     return true;
 }
 
-uint64_t Factorial(const struct FactorialArgs *args) {
-    uint64_t ans = 1;
-    for (uint64_t i = args->begin; i <= args->end; i++) {
-        ans = MultModulo(ans, i, args->mod);
+int ReadServers(const char *path, struct Server **servers) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    int servers_num = 0;
+    char line[255];
+    *servers = NULL;
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = 0;
+
+        if (strlen(line) == 0) continue;
+
+        struct Server server;
+        server.transport = SERVER_TCP;
+        if (strncmp(line, "unix:", 5) == 0)
+            server.transport = SERVER_UNIX;
+        else if (strncmp(line, "shm:", 4) == 0)
+            server.transport = SERVER_SHM;
+        if (server.transport != SERVER_TCP) {
+            struct sockaddr_un addr;
+            const char *socket_path = strchr(line, ':') + 1;
+            if (*socket_path == '\0' || strlen(socket_path) >= sizeof(addr.sun_path)) {
+                fprintf(stderr, "Invalid socket path in: %s\n", line);
+                continue;
+            }
+            strcpy(server.ip, socket_path);
+            server.port = 0;
+        } else {
+            char* colon = strchr(line, ':');
+            if (colon == NULL) {
+                fprintf(stderr, "Invalid server format: %s (expected ip:port)\n", line);
+                continue;
+            }
+
+            *colon = '\0';
+            strncpy(server.ip, line, sizeof(server.ip) - 1);
+            server.ip[sizeof(server.ip) - 1] = '\0';
+            server.port = atoi(colon + 1);
+
+            if (server.port <= 0) {
+                fprintf(stderr, "Invalid port in: %s\n", line);
+                continue;
+            }
+        }
+
+        servers_num++;
+        *servers = realloc(*servers, sizeof(struct Server) * servers_num);
+        (*servers)[servers_num - 1] = server;
     }
-    return ans;
+    fclose(file);
+    return servers_num;
+}
+
+uint64_t Factorial(const struct FactorialArgs *args) {
+    struct ModContext ctx;
+    ModInit(&ctx, args->mod);
+    if (PrimeEngineApplies(&ctx, args->begin, args->end))
+        return PrimeRangeProduct(&ctx, args->begin, args->end);
+    return RangeProduct(&ctx, args->begin, args->end);
 }
\ No newline at end of file
@@ -11,10 +11,18 @@ struct FactorialArgs {
     uint64_t mod;
 };
 
+// Как клиент связывается с сервером
+enum ServerTransport {
+    SERVER_TCP,
+    SERVER_UNIX,    // unix-сокет сервера (--unix), ip — путь к нему
+    SERVER_SHM,     // каналы в общей памяти, открываемые через тот же unix-сокет
+};
+
 // Структура для информации о сервере
 struct Server {
     char ip[255];
-    int port;
+    int port;                   // 0 у unix и shm
+    enum ServerTransport transport;
 };
 
 // Функция модульного умножения
@@ -23,6 +31,11 @@ uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod);
 // Функция преобразования строки в uint64_t
 bool ConvertStringToUI64(const char *str, uint64_t *val);
 
+// Читает файл серверов "ip:port", "unix:путь" или "shm:путь" по одному в
+// строке, неверные строки пропускает с сообщением. Возвращает число
+// серверов или -1, если файл не открылся.
+int ReadServers(const char *path, struct Server **servers);
+
 // Функция для вычисления факториала в диапазоне
 uint64_t Factorial(const struct FactorialArgs *args);
 
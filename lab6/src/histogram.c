@@ -0,0 +1,77 @@
+#include "histogram.h"
+
+#include <string.h>
+
+static int BucketOf(uint64_t value) {
+    if (value < HISTOGRAM_EXACT)
+        return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= HISTOGRAM_MAX_EXPONENT)
+        return HISTOGRAM_BUCKETS - 1;
+    // Старшие 7 бит значения: единица и 6 бит номера поддиапазона
+    int sub = (int)(value >> (exponent - 6)) - HISTOGRAM_SUB_BUCKETS;
+    return HISTOGRAM_EXACT + (exponent - 7) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// Наибольшее значение корзины
+static uint64_t BucketBound(int index) {
+    if (index < HISTOGRAM_EXACT)
+        return (uint64_t)index;
+    int exponent = (index - HISTOGRAM_EXACT) / HISTOGRAM_SUB_BUCKETS + 7;
+    uint64_t sub = (uint64_t)((index - HISTOGRAM_EXACT) % HISTOGRAM_SUB_BUCKETS);
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (exponent - 6)) - 1;
+}
+
+void HistogramInit(struct Histogram *histogram) {
+    memset(histogram->counts, 0, sizeof(histogram->counts));
+    histogram->total = 0;
+    histogram->min = UINT64_MAX;
+    histogram->max = 0;
+    histogram->sum = 0.0;
+}
+
+void HistogramRecord(struct Histogram *histogram, uint64_t value) {
+    histogram->counts[BucketOf(value)]++;
+    histogram->total++;
+    if (value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+    histogram->sum += (double)value;
+}
+
+void HistogramMerge(struct Histogram *into, const struct Histogram *from) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->min < into->min)
+        into->min = from->min;
+    if (from->max > into->max)
+        into->max = from->max;
+    into->sum += from->sum;
+}
+
+uint64_t HistogramPercentile(const struct Histogram *histogram, double percent) {
+    if (histogram->total == 0)
+        return 0;
+    // Номер записи (с единицы), на которую приходится процентиль
+    uint64_t rank = (uint64_t)(percent / 100.0 * (double)histogram->total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > histogram->total)
+        rank = histogram->total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            uint64_t bound = BucketBound(i);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+double HistogramMean(const struct Histogram *histogram) {
+    return histogram->total ? histogram->sum / (double)histogram->total : 0.0;
+}
@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Гистограмма в духе HDR: значения до 128 хранятся точно, дальше по 64
+// поддиапазона на степень двойки (погрешность меньше 1.6%), до 2^40.
+// Для задержек в наносекундах это около 18 минут.
+#define HISTOGRAM_EXACT 128
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_MAX_EXPONENT 40
+#define HISTOGRAM_BUCKETS \
+    (HISTOGRAM_EXACT + (HISTOGRAM_MAX_EXPONENT - 7) * HISTOGRAM_SUB_BUCKETS)
+
+struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+};
+
+void HistogramInit(struct Histogram *histogram);
+
+// Значения больше 2^40 попадают в последнюю корзину, max остаётся точным
+void HistogramRecord(struct Histogram *histogram, uint64_t value);
+
+void HistogramMerge(struct Histogram *into, const struct Histogram *from);
+
+// Значение, не меньше которого percent процентов записей (верхняя граница
+// корзины, но не больше max). 0 для пустой гистограммы.
+uint64_t HistogramPercentile(const struct Histogram *histogram, double percent);
+
+double HistogramMean(const struct Histogram *histogram);
+
+#endif
@@ -0,0 +1,850 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+#include "histogram.h"
+#include "net.h"
+#include "protocol.h"
+
+#define DEFAULT_CONNECTIONS 4
+#define DEFAULT_THREADS 1
+#define DEFAULT_WINDOW 1
+#define DEFAULT_DURATION 10.0
+#define DEFAULT_MAX_BEGIN 1000000000ULL
+#define DEFAULT_MOD 1000000007ULL
+// Неотвеченные запросы одного соединения, степень двойки
+#define MAX_OUTSTANDING 1024
+#define MAX_EVENTS 256
+#define READ_CHUNK 65536
+// Сколько после окончания замера ждать ответов на отправленные запросы
+#define DRAIN_SECONDS 2.0
+#define REQUEST_SIZE (PROTO_HEADER_SIZE + sizeof(uint32_t) + PROTO_RANGE_SIZE)
+
+enum LoadMode {
+    LOAD_CLOSED,                // у соединения всегда window запросов в полёте
+    LOAD_OPEN,                  // запросы приходят с заданной частотой, как бы ни отвечал сервер
+};
+
+enum SizeDistribution {
+    SIZE_FIXED,                 // fixed:N
+    SIZE_UNIFORM,               // uniform:MIN:MAX
+    SIZE_EXP,                   // exp:MEAN
+    SIZE_LOGNORMAL,             // lognormal:MEDIAN:SIGMA
+};
+
+struct SizeSpec {
+    enum SizeDistribution distribution;
+    double a;
+    double b;
+};
+
+struct ModChoice {
+    uint64_t mod;
+    double cumulative;          // нарастающий итог весов
+};
+
+struct LoadConfig {
+    enum LoadMode mode;
+    int connections;
+    int threads;
+    int window;
+    double rate;                // запросов в секунду на все потоки, открытый цикл
+    bool poisson;               // экспоненциальные интервалы вместо равных
+    double duration;
+    double warmup;
+    struct SizeSpec size;
+    struct ModChoice *mods;
+    int mod_count;
+    uint64_t max_begin;
+    struct Server *servers;
+    int server_count;
+};
+
+struct Pending {
+    uint64_t id;
+    uint64_t start_ns;          // в открытом цикле — запланированное время отправки
+    uint64_t numbers;
+    bool used;
+};
+
+struct LoadConn {
+    int fd;
+    int server;
+    bool closed;
+    bool want_write;
+    unsigned char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    unsigned char *in;
+    size_t in_len;
+    struct Pending pending[MAX_OUTSTANDING];
+    int outstanding;
+    uint64_t next_id;
+};
+
+struct LoadStats {
+    uint64_t completed;         // ответы на запросы, начатые после разогрева
+    uint64_t errors;            // ответы с ошибкой и запросы, потерянные с соединением
+    uint64_t shed;              // отказы перегруженного сервера, в errors не входят
+    uint64_t not_sent;          // открытый цикл: у соединения нет места под запрос
+    uint64_t unfinished;        // не дождались ответа к концу
+    uint64_t numbers;
+    struct Histogram latency;   // наносекунды
+};
+
+struct LoadThread {
+    int index;
+    const struct LoadConfig *config;
+    struct LoadConn *conns;
+    int conn_count;
+    int open_count;
+    int epoll_fd;
+    int timer_fd;
+    uint64_t rng;
+    double interval_ns;         // средний интервал между запросами потока
+    uint64_t next_arrival;
+    int next_conn;
+    uint64_t warm_ns;
+    uint64_t end_ns;
+    struct LoadStats stats;
+    pthread_barrier_t *start;
+    pthread_t thread;
+};
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*: у каждого потока свой генератор
+static uint64_t NextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Равномерно в (0, 1)
+static double RandomUnit(uint64_t *state) {
+    return ((double)(NextRandom(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static uint64_t RandomSize(const struct SizeSpec *spec, uint64_t *rng) {
+    double size;
+    switch (spec->distribution) {
+    case SIZE_FIXED:
+        size = spec->a;
+        break;
+    case SIZE_UNIFORM:
+        size = spec->a + (double)(NextRandom(rng) % (uint64_t)(spec->b - spec->a + 1));
+        break;
+    case SIZE_EXP:
+        size = -spec->a * log(RandomUnit(rng));
+        break;
+    default: {
+        // Бокс — Мюллер
+        double normal = sqrt(-2.0 * log(RandomUnit(rng))) * cos(2.0 * M_PI * RandomUnit(rng));
+        size = spec->a * exp(spec->b * normal);
+    }
+    }
+    return size < 1.0 ? 1 : (uint64_t)size;
+}
+
+static uint64_t RandomMod(const struct LoadConfig *config, uint64_t *rng) {
+    double x = RandomUnit(rng) * config->mods[config->mod_count - 1].cumulative;
+    for (int i = 0; i < config->mod_count - 1; i++) {
+        if (x < config->mods[i].cumulative)
+            return config->mods[i].mod;
+    }
+    return config->mods[config->mod_count - 1].mod;
+}
+
+static void UpdateEvents(struct LoadThread *thread, struct LoadConn *conn, bool want_write) {
+    if (conn->want_write == want_write)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->want_write = want_write;
+}
+
+// Запросы закрытого соединения считаются ошибками
+static void CloseConn(struct LoadThread *thread, struct LoadConn *conn, const char *reason) {
+    if (conn->closed)
+        return;
+    fprintf(stderr, "Connection to %s:%d: %s\n", thread->config->servers[conn->server].ip,
+            thread->config->servers[conn->server].port, reason);
+    thread->stats.errors += (uint64_t)conn->outstanding;
+    conn->outstanding = 0;
+    close(conn->fd);
+    conn->closed = true;
+    thread->open_count--;
+}
+
+static void FlushOut(struct LoadThread *thread, struct LoadConn *conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t sent = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent,
+                            MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                UpdateEvents(thread, conn, true);
+                return;
+            }
+            CloseConn(thread, conn, "send failed");
+            return;
+        }
+        conn->out_sent += (size_t)sent;
+    }
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    UpdateEvents(thread, conn, false);
+}
+
+// Ставит запрос в выходной буфер. Возвращает false, если у соединения нет
+// свободного места под запрос.
+static bool QueueRequest(struct LoadThread *thread, struct LoadConn *conn, uint64_t start_ns) {
+    if (conn->closed || conn->outstanding == MAX_OUTSTANDING)
+        return false;
+    // Ответы приходят не по порядку, и ячейка следующего номера может быть
+    // ещё занята: номер пропускается до свободной ячейки, иначе окно
+    // соединения навсегда сузилось бы
+    while (conn->pending[conn->next_id & (MAX_OUTSTANDING - 1)].used)
+        conn->next_id++;
+    struct Pending *slot = &conn->pending[conn->next_id & (MAX_OUTSTANDING - 1)];
+
+    const struct LoadConfig *config = thread->config;
+    uint64_t size = RandomSize(&config->size, &thread->rng);
+    struct FactorialArgs args;
+    args.begin = 1 + NextRandom(&thread->rng) % config->max_begin;
+    args.end = args.begin + size - 1;
+    args.mod = RandomMod(config, &thread->rng);
+
+    slot->id = conn->next_id++;
+    slot->start_ns = start_ns;
+    slot->numbers = size;
+    slot->used = true;
+    conn->outstanding++;
+
+    if (conn->out_len + REQUEST_SIZE > conn->out_cap) {
+        conn->out_cap = conn->out_cap == 0 ? 64 * REQUEST_SIZE : conn->out_cap * 2;
+        conn->out = realloc(conn->out, conn->out_cap);
+    }
+    struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION, PROTO_OP_RANGE, PROTO_STATUS_OK,
+                                 (uint32_t)ProtoRangePayloadSize(1), slot->id};
+    ProtoEncodeHeader(&header, conn->out + conn->out_len);
+    ProtoEncodeRanges(&args, 1, conn->out + conn->out_len + PROTO_HEADER_SIZE);
+    conn->out_len += REQUEST_SIZE;
+    return true;
+}
+
+static void FinishRequest(struct LoadThread *thread, struct LoadConn *conn,
+                          const struct FrameHeader *header, uint64_t now) {
+    struct Pending *slot = &conn->pending[header->request_id & (MAX_OUTSTANDING - 1)];
+    if (!slot->used || slot->id != header->request_id) {
+        CloseConn(thread, conn, "reply to unknown request");
+        return;
+    }
+    slot->used = false;
+    conn->outstanding--;
+    if (header->status == PROTO_STATUS_OVERLOADED) {
+        thread->stats.shed++;
+        return;
+    }
+    if (header->status != PROTO_STATUS_OK) {
+        thread->stats.errors++;
+        return;
+    }
+    // Запросы, начатые во время разогрева, не учитываются
+    if (slot->start_ns < thread->warm_ns)
+        return;
+    thread->stats.completed++;
+    thread->stats.numbers += slot->numbers;
+    HistogramRecord(&thread->stats.latency, now - slot->start_ns);
+}
+
+static void ReadReplies(struct LoadThread *thread, struct LoadConn *conn) {
+    bool closed_loop = thread->config->mode == LOAD_CLOSED;
+    while (!conn->closed) {
+        ssize_t received = recv(conn->fd, conn->in + conn->in_len, READ_CHUNK - conn->in_len, 0);
+        if (received == 0) {
+            CloseConn(thread, conn, "closed by server");
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                CloseConn(thread, conn, "receive failed");
+            break;
+        }
+        conn->in_len += (size_t)received;
+
+        uint64_t now = NowNs();
+        size_t offset = 0;
+        while (conn->in_len - offset >= PROTO_HEADER_SIZE) {
+            struct FrameHeader header;
+            ProtoDecodeHeader(conn->in + offset, &header);
+            if (header.magic != PROTO_MAGIC || header.length > READ_CHUNK - PROTO_HEADER_SIZE) {
+                CloseConn(thread, conn, "bad reply");
+                return;
+            }
+            if (conn->in_len - offset < PROTO_HEADER_SIZE + header.length)
+                break;
+            offset += PROTO_HEADER_SIZE + header.length;
+            FinishRequest(thread, conn, &header, now);
+            if (conn->closed)
+                return;
+            // Закрытый цикл: на место ответившего запроса сразу идёт следующий
+            if (closed_loop && now < thread->end_ns)
+                QueueRequest(thread, conn, now);
+        }
+        memmove(conn->in, conn->in + offset, conn->in_len - offset);
+        conn->in_len -= offset;
+    }
+    if (!conn->closed && conn->out_len > conn->out_sent)
+        FlushOut(thread, conn);
+}
+
+static void ArmTimer(struct LoadThread *thread, uint64_t at_ns) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(at_ns / 1000000000ULL);
+    spec.it_value.tv_nsec = (long)(at_ns % 1000000000ULL);
+    timerfd_settime(thread->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// Открытый цикл: отправляет все запросы, время которых наступило. Задержка
+// считается от запланированного времени, поэтому отставание генератора
+// или сервера не прячется (coordinated omission).
+static void SendArrivals(struct LoadThread *thread, uint64_t now) {
+    uint64_t tick;
+    if (read(thread->timer_fd, &tick, sizeof(tick)) < 0 && errno != EAGAIN)
+        return;
+
+    while (thread->next_arrival <= now && thread->next_arrival < thread->end_ns &&
+           thread->open_count > 0) {
+        struct LoadConn *conn;
+        do {
+            conn = &thread->conns[thread->next_conn];
+            thread->next_conn = (thread->next_conn + 1) % thread->conn_count;
+        } while (conn->closed);
+        if (QueueRequest(thread, conn, thread->next_arrival))
+            FlushOut(thread, conn);
+        else
+            thread->stats.not_sent++;
+
+        double gap = thread->config->poisson ? -thread->interval_ns * log(RandomUnit(&thread->rng))
+                                             : thread->interval_ns;
+        thread->next_arrival += (uint64_t)gap;
+    }
+    if (thread->next_arrival < thread->end_ns)
+        ArmTimer(thread, thread->next_arrival);
+}
+
+static int ConnectServer(const struct Server *server) {
+    char port[16];
+    snprintf(port, sizeof(port), "%d", server->port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(server->ip, port, &hints, &result) != 0)
+        return -1;
+
+    int fd = socket(result->ai_family, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    SetNonBlocking(fd);
+    return fd;
+}
+
+static void *RunLoadThread(void *arg) {
+    struct LoadThread *thread = arg;
+    const struct LoadConfig *config = thread->config;
+
+    thread->epoll_fd = epoll_create1(0);
+    thread->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &thread->timer_fd;
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->timer_fd, &event);
+
+    thread->open_count = 0;
+    for (int i = 0; i < thread->conn_count; i++) {
+        struct LoadConn *conn = &thread->conns[i];
+        conn->closed = true;
+        conn->fd = ConnectServer(&config->servers[conn->server]);
+        if (conn->fd < 0) {
+            fprintf(stderr, "Cannot connect to %s:%d\n", config->servers[conn->server].ip,
+                    config->servers[conn->server].port);
+            continue;
+        }
+        conn->closed = false;
+        conn->in = malloc(READ_CHUNK);
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+        thread->open_count++;
+    }
+
+    // Все потоки начинают одновременно, после установки соединений
+    pthread_barrier_wait(thread->start);
+    uint64_t start = NowNs();
+    thread->warm_ns = start + (uint64_t)(config->warmup * 1e9);
+    thread->end_ns = thread->warm_ns + (uint64_t)(config->duration * 1e9);
+    uint64_t drain_end = thread->end_ns + (uint64_t)(DRAIN_SECONDS * 1e9);
+
+    if (config->mode == LOAD_CLOSED) {
+        for (int i = 0; i < thread->conn_count; i++) {
+            for (int w = 0; w < config->window; w++)
+                QueueRequest(thread, &thread->conns[i], start);
+            if (!thread->conns[i].closed)
+                FlushOut(thread, &thread->conns[i]);
+        }
+    } else {
+        thread->next_arrival = start;
+        SendArrivals(thread, start);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (thread->open_count > 0) {
+        uint64_t now = NowNs();
+        int outstanding = 0;
+        for (int i = 0; i < thread->conn_count; i++)
+            outstanding += thread->conns[i].outstanding;
+        if (now >= drain_end || (now >= thread->end_ns && outstanding == 0))
+            break;
+
+        // Таймер открытого цикла будит сам, остальное — по событиям или раз в 100 мс
+        int count = epoll_wait(thread->epoll_fd, events, MAX_EVENTS, 100);
+        if (count < 0 && errno != EINTR)
+            break;
+        now = NowNs();
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &thread->timer_fd) {
+                SendArrivals(thread, now);
+                continue;
+            }
+            struct LoadConn *conn = events[i].data.ptr;
+            if (conn->closed)
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                ReadReplies(thread, conn);
+            if (!conn->closed && (events[i].events & EPOLLOUT))
+                FlushOut(thread, conn);
+        }
+    }
+
+    for (int i = 0; i < thread->conn_count; i++) {
+        struct LoadConn *conn = &thread->conns[i];
+        thread->stats.unfinished += (uint64_t)conn->outstanding;
+        if (!conn->closed)
+            close(conn->fd);
+        free(conn->in);
+        free(conn->out);
+    }
+    close(thread->timer_fd);
+    close(thread->epoll_fd);
+    return NULL;
+}
+
+static bool ParseSize(const char *text, struct SizeSpec *spec) {
+    double a = 0;
+    double b = 0;
+    if (sscanf(text, "fixed:%lf", &a) == 1 && a >= 1) {
+        spec->distribution = SIZE_FIXED;
+    } else if (sscanf(text, "uniform:%lf:%lf", &a, &b) == 2 && a >= 1 && b >= a) {
+        spec->distribution = SIZE_UNIFORM;
+    } else if (sscanf(text, "exp:%lf", &a) == 1 && a > 0) {
+        spec->distribution = SIZE_EXP;
+    } else if (sscanf(text, "lognormal:%lf:%lf", &a, &b) == 2 && a > 0 && b >= 0) {
+        spec->distribution = SIZE_LOGNORMAL;
+    } else {
+        return false;
+    }
+    spec->a = a;
+    spec->b = b;
+    return true;
+}
+
+// "m1,m2:3" — модули с весами, вес по умолчанию 1
+static int ParseMods(const char *text, struct ModChoice **mods) {
+    char *copy = strdup(text);
+    int count = 0;
+    double total = 0;
+    *mods = NULL;
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        double weight = 1.0;
+        char *colon = strchr(item, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            weight = atof(colon + 1);
+        }
+        uint64_t mod = 0;
+        if (!ConvertStringToUI64(item, &mod) || mod == 0 || weight <= 0) {
+            free(copy);
+            return -1;
+        }
+        total += weight;
+        *mods = realloc(*mods, sizeof(struct ModChoice) * (size_t)(count + 1));
+        (*mods)[count].mod = mod;
+        (*mods)[count].cumulative = total;
+        count++;
+    }
+    free(copy);
+    return count;
+}
+
+static const char *ModeName(const struct LoadConfig *config) {
+    return config->mode == LOAD_CLOSED ? "closed" : "open";
+}
+
+struct LoadResult {
+    struct LoadStats stats;
+    double throughput;
+    double numbers_per_second;
+    double percentiles[6];      // мкс: min, p50, p90, p99, p99.9, max
+};
+
+static const double PERCENTILES[] = {0, 50, 90, 99, 99.9, 100};
+static const char *PERCENTILE_NAMES[] = {"min", "p50", "p90", "p99", "p99.9", "max"};
+
+static void WriteCsv(const char *path, const struct LoadConfig *config,
+                     const struct LoadResult *result) {
+    FILE *file = fopen(path, "a");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return;
+    }
+    // Заголовок пишется только в новый файл: прогоны копятся построчно
+    if (ftell(file) == 0)
+        fprintf(file, "time,mode,connections,threads,window,target_rate,duration,completed,"
+                      "errors,not_sent,unfinished,throughput,numbers_per_second,"
+                      "min_us,p50_us,p90_us,p99_us,p999_us,max_us,mean_us,shed\n");
+    fprintf(file, "%ld,%s,%d,%d,%d,%.1f,%.1f,%lu,%lu,%lu,%lu,%.1f,%.1f", (long)time(NULL),
+            ModeName(config), config->connections, config->threads, config->window,
+            config->rate, config->duration, result->stats.completed, result->stats.errors,
+            result->stats.not_sent, result->stats.unfinished, result->throughput,
+            result->numbers_per_second);
+    for (int i = 0; i < 6; i++)
+        fprintf(file, ",%.1f", result->percentiles[i]);
+    fprintf(file, ",%.1f,%lu\n", HistogramMean(&result->stats.latency) / 1e3,
+            result->stats.shed);
+    fclose(file);
+}
+
+static void WriteJson(const char *path, const struct LoadConfig *config,
+                      const struct LoadResult *result) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return;
+    }
+    fprintf(file, "{\n  \"time\": %ld,\n  \"mode\": \"%s\",\n  \"connections\": %d,\n"
+                  "  \"threads\": %d,\n  \"window\": %d,\n  \"target_rate\": %.1f,\n"
+                  "  \"duration\": %.1f,\n  \"warmup\": %.1f,\n",
+            (long)time(NULL), ModeName(config), config->connections, config->threads,
+            config->window, config->rate, config->duration, config->warmup);
+    fprintf(file, "  \"completed\": %lu,\n  \"errors\": %lu,\n  \"shed\": %lu,\n"
+                  "  \"not_sent\": %lu,\n  \"unfinished\": %lu,\n  \"throughput\": %.1f,\n"
+                  "  \"numbers_per_second\": %.1f,\n  \"latency_us\": {",
+            result->stats.completed, result->stats.errors, result->stats.shed,
+            result->stats.not_sent, result->stats.unfinished, result->throughput,
+            result->numbers_per_second);
+    for (int i = 0; i < 6; i++)
+        fprintf(file, "\"%s\": %.1f, ", PERCENTILE_NAMES[i], result->percentiles[i]);
+    fprintf(file, "\"mean\": %.1f}\n}\n", HistogramMean(&result->stats.latency) / 1e3);
+    fclose(file);
+}
+
+int main(int argc, char **argv) {
+    struct LoadConfig config;
+    config.mode = LOAD_CLOSED;
+    config.connections = DEFAULT_CONNECTIONS;
+    config.threads = DEFAULT_THREADS;
+    config.window = DEFAULT_WINDOW;
+    config.rate = 0;
+    config.poisson = true;
+    config.duration = DEFAULT_DURATION;
+    config.warmup = 1.0;
+    config.size = (struct SizeSpec){SIZE_FIXED, 1000, 0};
+    config.mods = NULL;
+    config.mod_count = 0;
+    config.max_begin = DEFAULT_MAX_BEGIN;
+    char servers_file[255] = {'\0'};
+    const char *csv = NULL;
+    const char *json = NULL;
+
+    while (true) {
+        static struct option options[] = {
+            {"servers", required_argument, 0, 0},
+            {"connections", required_argument, 0, 0},
+            {"threads", required_argument, 0, 0},
+            {"mode", required_argument, 0, 0},
+            {"window", required_argument, 0, 0},
+            {"rate", required_argument, 0, 0},
+            {"arrival", required_argument, 0, 0},
+            {"duration", required_argument, 0, 0},
+            {"warmup", required_argument, 0, 0},
+            {"size", required_argument, 0, 0},
+            {"mods", required_argument, 0, 0},
+            {"max-begin", required_argument, 0, 0},
+            {"csv", required_argument, 0, 0},
+            {"json", required_argument, 0, 0},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "", options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 0: {
+            switch (option_index) {
+            case 0:
+                strncpy(servers_file, optarg, sizeof(servers_file) - 1);
+                servers_file[sizeof(servers_file) - 1] = '\0';
+                break;
+            case 1:
+                config.connections = atoi(optarg);
+                if (config.connections <= 0) {
+                    fprintf(stderr, "Connections must be positive\n");
+                    return 1;
+                }
+                break;
+            case 2:
+                config.threads = atoi(optarg);
+                if (config.threads <= 0) {
+                    fprintf(stderr, "Threads must be positive\n");
+                    return 1;
+                }
+                break;
+            case 3:
+                if (strcmp(optarg, "closed") == 0) {
+                    config.mode = LOAD_CLOSED;
+                } else if (strcmp(optarg, "open") == 0) {
+                    config.mode = LOAD_OPEN;
+                } else {
+                    fprintf(stderr, "Mode must be closed or open\n");
+                    return 1;
+                }
+                break;
+            case 4:
+                config.window = atoi(optarg);
+                if (config.window <= 0 || config.window > MAX_OUTSTANDING) {
+                    fprintf(stderr, "Window must be in [1, %d]\n", MAX_OUTSTANDING);
+                    return 1;
+                }
+                break;
+            case 5:
+                config.rate = atof(optarg);
+                if (config.rate <= 0) {
+                    fprintf(stderr, "Rate must be positive\n");
+                    return 1;
+                }
+                break;
+            case 6:
+                if (strcmp(optarg, "poisson") == 0) {
+                    config.poisson = true;
+                } else if (strcmp(optarg, "fixed") == 0) {
+                    config.poisson = false;
+                } else {
+                    fprintf(stderr, "Arrival must be poisson or fixed\n");
+                    return 1;
+                }
+                break;
+            case 7:
+                config.duration = atof(optarg);
+                if (config.duration <= 0) {
+                    fprintf(stderr, "Duration must be positive\n");
+                    return 1;
+                }
+                break;
+            case 8:
+                config.warmup = atof(optarg);
+                if (config.warmup < 0) {
+                    fprintf(stderr, "Warmup must not be negative\n");
+                    return 1;
+                }
+                break;
+            case 9:
+                if (!ParseSize(optarg, &config.size)) {
+                    fprintf(stderr, "Size must be fixed:N, uniform:MIN:MAX, exp:MEAN "
+                                    "or lognormal:MEDIAN:SIGMA\n");
+                    return 1;
+                }
+                break;
+            case 10:
+                free(config.mods);
+                config.mod_count = ParseMods(optarg, &config.mods);
+                if (config.mod_count <= 0) {
+                    fprintf(stderr, "Mods must be a list like 1000000007,998244353:2\n");
+                    return 1;
+                }
+                break;
+            case 11:
+                if (!ConvertStringToUI64(optarg, &config.max_begin) || config.max_begin == 0) {
+                    fprintf(stderr, "Invalid max-begin value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 12:
+                csv = optarg;
+                break;
+            case 13:
+                json = optarg;
+                break;
+            default:
+                printf("Index %d is out of options\n", option_index);
+            }
+        } break;
+
+        case '?':
+            printf("Arguments error\n");
+            break;
+        default:
+            fprintf(stderr, "getopt returned character code 0%o?\n", c);
+        }
+    }
+
+    if (!strlen(servers_file) || (config.mode == LOAD_OPEN && config.rate <= 0)) {
+        fprintf(stderr,
+                "Using: %s --servers /path/to/file [--connections %d] [--threads %d] "
+                "[--mode closed|open] [--window %d] [--rate REQ_PER_SEC] "
+                "[--arrival poisson|fixed] [--duration SEC] [--warmup SEC] "
+                "[--size fixed:N|uniform:MIN:MAX|exp:MEAN|lognormal:MEDIAN:SIGMA] "
+                "[--mods m1,m2:weight] [--max-begin N] [--csv FILE] [--json FILE]\n"
+                "Open mode requires --rate\n",
+                argv[0], DEFAULT_CONNECTIONS, DEFAULT_THREADS, DEFAULT_WINDOW);
+        return 1;
+    }
+    if (config.mod_count == 0) {
+        config.mods = malloc(sizeof(struct ModChoice));
+        config.mods[0] = (struct ModChoice){DEFAULT_MOD, 1.0};
+        config.mod_count = 1;
+    }
+    if (config.threads > config.connections)
+        config.threads = config.connections;
+
+    config.server_count = ReadServers(servers_file, &config.servers);
+    if (config.server_count <= 0) {
+        fprintf(stderr, "No valid servers found in file: %s\n", servers_file);
+        return 1;
+    }
+    for (int i = 0; i < config.server_count; i++) {
+        if (config.servers[i].transport != SERVER_TCP) {
+            fprintf(stderr, "Load generator needs ip:port servers, got %s\n",
+                    config.servers[i].ip);
+            return 1;
+        }
+    }
+
+    // Соединение i идёт к серверу i % server_count и в поток i % threads
+    struct LoadThread *threads = calloc((size_t)config.threads, sizeof(struct LoadThread));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned)config.threads);
+    for (int t = 0; t < config.threads; t++) {
+        struct LoadThread *thread = &threads[t];
+        thread->index = t;
+        thread->config = &config;
+        thread->conn_count = (config.connections - t + config.threads - 1) / config.threads;
+        thread->conns = calloc((size_t)thread->conn_count, sizeof(struct LoadConn));
+        for (int i = 0; i < thread->conn_count; i++)
+            thread->conns[i].server = (t + i * config.threads) % config.server_count;
+        thread->rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(t + 1) ^ (uint64_t)time(NULL);
+        thread->interval_ns = config.rate > 0 ? 1e9 * config.threads / config.rate : 0;
+        HistogramInit(&thread->stats.latency);
+        thread->start = &start;
+    }
+
+    printf("Load: %s loop, %d connections to %d servers, %d threads", ModeName(&config),
+           config.connections, config.server_count, config.threads);
+    if (config.mode == LOAD_CLOSED)
+        printf(", window %d", config.window);
+    else
+        printf(", %.1f req/s %s", config.rate, config.poisson ? "poisson" : "fixed");
+    printf(", %.1f s after %.1f s warmup\n", config.duration, config.warmup);
+    fflush(stdout);
+
+    for (int t = 0; t < config.threads; t++) {
+        if (pthread_create(&threads[t].thread, NULL, RunLoadThread, &threads[t]) != 0) {
+            fprintf(stderr, "Error: pthread_create failed!\n");
+            return 1;
+        }
+    }
+
+    struct LoadResult result;
+    memset(&result.stats, 0, sizeof(result.stats));
+    HistogramInit(&result.stats.latency);
+    for (int t = 0; t < config.threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+        const struct LoadStats *stats = &threads[t].stats;
+        result.stats.completed += stats->completed;
+        result.stats.errors += stats->errors;
+        result.stats.shed += stats->shed;
+        result.stats.not_sent += stats->not_sent;
+        result.stats.unfinished += stats->unfinished;
+        result.stats.numbers += stats->numbers;
+        HistogramMerge(&result.stats.latency, &stats->latency);
+    }
+    result.throughput = (double)result.stats.completed / config.duration;
+    result.numbers_per_second = (double)result.stats.numbers / config.duration;
+    for (int i = 0; i < 6; i++)
+        result.percentiles[i] =
+            (double)HistogramPercentile(&result.stats.latency, PERCENTILES[i]) / 1e3;
+    if (result.stats.latency.total > 0)
+        result.percentiles[0] = (double)result.stats.latency.min / 1e3;
+
+    printf("Requests: %lu completed, %lu errors, %lu shed, %lu not sent, %lu unfinished\n",
+           result.stats.completed, result.stats.errors, result.stats.shed,
+           result.stats.not_sent, result.stats.unfinished);
+    printf("Throughput: %.1f req/s, %.2f M numbers/s\n", result.throughput,
+           result.numbers_per_second / 1e6);
+    printf("Latency (us):");
+    for (int i = 0; i < 6; i++)
+        printf(" %s %.1f", PERCENTILE_NAMES[i], result.percentiles[i]);
+    printf(" mean %.1f\n", HistogramMean(&result.stats.latency) / 1e3);
+
+    if (csv != NULL)
+        WriteCsv(csv, &config, &result);
+    if (json != NULL)
+        WriteJson(json, &config, &result);
+
+    for (int t = 0; t < config.threads; t++)
+        free(threads[t].conns);
+    free(threads);
+    pthread_barrier_destroy(&start);
+    free(config.mods);
+    free(config.servers);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Записей в кольце одного потока
+#define LOG_RING_SIZE 1024
+#define LOG_LINE_MAX 512
+// Пауза потока записи, когда все кольца пусты
+#define LOG_IDLE_NS 1000000
+
+// Кольцо одного производителя и одного потребителя: пишет свой поток,
+// читает поток записи. Индексы растут без ограничения, позиция — по маске.
+struct LogRing {
+    _Alignas(64) atomic_uint_fast64_t head;   // следующая запись производителя
+    _Alignas(64) atomic_uint_fast64_t tail;   // следующая запись потребителя
+    _Alignas(64) struct LogRecord records[LOG_RING_SIZE];
+    struct LogRing *next;
+};
+
+enum LogLevel log_level = LOG_INFO;
+
+static _Thread_local struct LogRing *local_ring = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(struct LogRing *) rings = NULL;
+static atomic_bool running = false;
+static atomic_bool stopping = false;
+static atomic_uint_fast64_t dropped = 0;
+static pthread_t writer;
+
+static const char *LEVEL_NAMES[] = {"error", "warn", "info", "debug"};
+
+bool LogParseLevel(const char *name, enum LogLevel *level) {
+    for (int i = 0; i <= LOG_DEBUG; i++) {
+        if (strcmp(name, LEVEL_NAMES[i]) == 0) {
+            *level = (enum LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Собирает текст записи. Каждое преобразование формата печатается
+// отдельным snprintf с аргументом нужного типа.
+static size_t FormatRecord(const struct LogRecord *record, char *out, size_t size) {
+    const char *p = record->format;
+    size_t length = 0;
+    int arg = 0;
+    while (*p != '\0' && length + 1 < size) {
+        if (*p != '%') {
+            out[length++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[length++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // %[флаги][ширина][.точность][длина]преобразование. Модификатор
+        // длины отбрасывается: целые хранятся 64-битными и печатаются через ll.
+        const char *spec = p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL)
+            p++;
+        size_t flags_len = (size_t)(p - spec);
+        while (*p == 'l' || *p == 'h' || *p == 'z' || *p == 'j')
+            p++;
+        if (*p == '\0' || arg >= record->argc)
+            break;
+        char conversion = *p++;
+        char piece[32];
+        if (flags_len + 4 > sizeof(piece))
+            break;
+        memcpy(piece, spec, flags_len);
+        piece[flags_len] = '\0';
+
+        uint64_t value = record->args[arg++];
+        int written;
+        switch (conversion) {
+        case 'f':
+        case 'g':
+        case 'e': {
+            double d;
+            memcpy(&d, &value, sizeof(d));
+            strncat(piece, &conversion, 1);
+            written = snprintf(out + length, size - length, piece, d);
+            break;
+        }
+        case 's':
+            strcat(piece, "s");
+            written = snprintf(out + length, size - length, piece, (const char *)(uintptr_t)value);
+            break;
+        case 'c':
+            strcat(piece, "c");
+            written = snprintf(out + length, size - length, piece, (int)value);
+            break;
+        default:
+            strcat(piece, "ll");
+            strncat(piece, &conversion, 1);
+            written = snprintf(out + length, size - length, piece, (unsigned long long)value);
+        }
+        if (written < 0)
+            break;
+        length += (size_t)written;
+    }
+    if (length >= size)
+        length = size - 1;
+    out[length] = '\0';
+    return length;
+}
+
+static void WriteRecord(const struct LogRecord *record) {
+    char line[LOG_LINE_MAX];
+    size_t length = FormatRecord(record, line, sizeof(line));
+    fwrite(line, 1, length, record->level <= LOG_WARN ? stderr : stdout);
+}
+
+static struct LogRing *LocalRing(void) {
+    if (local_ring != NULL)
+        return local_ring;
+    struct LogRing *ring = aligned_alloc(_Alignof(struct LogRing), sizeof(struct LogRing));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = atomic_load(&rings);
+    atomic_store(&rings, ring);
+    pthread_mutex_unlock(&rings_mutex);
+    local_ring = ring;
+    return ring;
+}
+
+void LogWrite(enum LogLevel level, const char *format, int argc, const uint64_t *args) {
+    struct LogRecord record;
+    record.format = format;
+    record.level = (uint8_t)level;
+    record.argc = (uint8_t)(argc < LOG_MAX_ARGS ? argc : LOG_MAX_ARGS);
+    memcpy(record.args, args, sizeof(uint64_t) * record.argc);
+
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        WriteRecord(&record);
+        return;
+    }
+
+    struct LogRing *ring = LocalRing();
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SIZE) {
+        // Подробные записи теряются, остальные ждут места
+        if (level == LOG_DEBUG || !atomic_load_explicit(&running, memory_order_acquire)) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+        sched_yield();
+    }
+    ring->records[head & (LOG_RING_SIZE - 1)] = record;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Выводит всё, что накопилось в кольцах. Возвращает число записей.
+static uint64_t Drain(void) {
+    uint64_t count = 0;
+    for (struct LogRing *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        count += head - tail;
+        for (; tail != head; tail++)
+            WriteRecord(&ring->records[tail & (LOG_RING_SIZE - 1)]);
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return count;
+}
+
+static void *RunWriter(void *arg) {
+    (void)arg;
+    struct timespec idle = {0, LOG_IDLE_NS};
+    while (!atomic_load(&stopping)) {
+        if (Drain() == 0) {
+            fflush(stdout);
+            nanosleep(&idle, NULL);
+        }
+    }
+    Drain();
+    fflush(stdout);
+    return NULL;
+}
+
+int LogStart(enum LogLevel level) {
+    log_level = level;
+    atomic_store(&stopping, false);
+    if (pthread_create(&writer, NULL, RunWriter, NULL) != 0)
+        return -1;
+    atomic_store_explicit(&running, true, memory_order_release);
+    return 0;
+}
+
+void LogShutdown(void) {
+    if (!atomic_load(&running))
+        return;
+    atomic_store(&stopping, true);
+    pthread_join(writer, NULL);
+    // Записи, попавшие в кольца после последнего прохода, выводятся здесь
+    atomic_store_explicit(&running, false, memory_order_release);
+    Drain();
+    fflush(stdout);
+    uint64_t lost = atomic_load(&dropped);
+    if (lost > 0)
+        fprintf(stderr, "%lu log records dropped\n", lost);
+}
+
+uint64_t LogDropped(void) {
+    return atomic_load(&dropped);
+}
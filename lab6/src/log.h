@@ -0,0 +1,85 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+enum LogLevel {
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,                  // подробный уровень: при переполнении записи теряются
+};
+
+#define LOG_MAX_ARGS 6
+
+// Запись хранит формат и аргументы в двоичном виде, текст собирает поток
+// записи. Поэтому формат должен быть строковым литералом, а строки для %s
+// должны жить до LogShutdown.
+struct LogRecord {
+    const char *format;
+    uint8_t level;
+    uint8_t argc;
+    uint64_t args[LOG_MAX_ARGS];
+};
+
+extern enum LogLevel log_level;
+
+bool LogParseLevel(const char *name, enum LogLevel *level);
+
+// Запускает поток записи. До запуска и после остановки записи выводятся
+// синхронно.
+int LogStart(enum LogLevel level);
+
+// Дописывает всё накопленное и останавливает поток записи
+void LogShutdown(void);
+
+// Записи, потерянные из-за переполнения буфера потока
+uint64_t LogDropped(void);
+
+void LogWrite(enum LogLevel level, const char *format, int argc, const uint64_t *args);
+
+static inline uint64_t LogInteger(uint64_t value) {
+    return value;
+}
+
+static inline uint64_t LogDouble(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline uint64_t LogPointer(const void *value) {
+    return (uint64_t)(uintptr_t)value;
+}
+
+#define LOG_ARG(x)                                                                          \
+    _Generic((x), float: LogDouble, double: LogDouble, char *: LogPointer,                  \
+             const char *: LogPointer, default: LogInteger)(x)
+
+#define LOG_MAP0()
+#define LOG_MAP1(a) , LOG_ARG(a)
+#define LOG_MAP2(a, b) , LOG_ARG(a), LOG_ARG(b)
+#define LOG_MAP3(a, b, c) , LOG_ARG(a), LOG_ARG(b), LOG_ARG(c)
+#define LOG_MAP4(a, b, c, d) , LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d)
+#define LOG_MAP5(a, b, c, d, e) , LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d), LOG_ARG(e)
+#define LOG_MAP6(a, b, c, d, e, f)                                                          \
+    , LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d), LOG_ARG(e), LOG_ARG(f)
+#define LOG_SELECT(_0, _1, _2, _3, _4, _5, _6, name, ...) name
+#define LOG_COUNT(...) LOG_SELECT(_0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_MAP(...)                                                                        \
+    LOG_SELECT(_0, ##__VA_ARGS__, LOG_MAP6, LOG_MAP5, LOG_MAP4, LOG_MAP3, LOG_MAP2,         \
+               LOG_MAP1, LOG_MAP0)(__VA_ARGS__)
+
+// LOG(LOG_INFO, "Total: %lu\n", result). Уровень проверяется до вычисления
+// аргументов, до LOG_MAX_ARGS аргументов.
+#define LOG(level, format, ...)                                                             \
+    do {                                                                                    \
+        if ((level) <= log_level)                                                           \
+            LogWrite((level), (format), LOG_COUNT(__VA_ARGS__),                             \
+                     (const uint64_t[]){0 LOG_MAP(__VA_ARGS__)} + 1);                       \
+    } while (0)
+
+#endif
@@ -0,0 +1,256 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "net.h"
+
+#define HTTP_REQUEST_MAX 4096
+
+// Поток закрепляет за собой шард при первой записи
+static _Thread_local struct MetricsShard *local_shard = NULL;
+
+uint64_t MetricsNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct MetricsShard *LocalShard(struct Metrics *metrics) {
+    if (local_shard == NULL) {
+        // Потоков больше, чем шардов, быть не должно, но и тогда счёт верен:
+        // запись атомарная, просто линия станет общей
+        int index = atomic_fetch_add(&metrics->next_shard, 1) % metrics->shard_count;
+        local_shard = &metrics->shards[index];
+    }
+    return local_shard;
+}
+
+static int BucketOf(uint64_t us) {
+    if (us < 4)
+        return (int)us;
+    int exponent = 63 - __builtin_clzll(us);
+    int index = 4 + (exponent - 2) * 4 + (int)((us >> (exponent - 2)) & 3);
+    return index < METRICS_HISTOGRAM_BUCKETS ? index : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+// Наибольшее значение корзины в микросекундах
+static uint64_t BucketBound(int index) {
+    if (index < 4)
+        return (uint64_t)index;
+    int exponent = (index - 4) / 4 + 2;
+    uint64_t sub = (uint64_t)((index - 4) % 4);
+    return ((5 + sub) << (exponent - 2)) - 1;
+}
+
+void MetricsAdd(struct Metrics *metrics, enum MetricsCounter counter, uint64_t value) {
+    atomic_fetch_add_explicit(&LocalShard(metrics)->counters[counter], value,
+                              memory_order_relaxed);
+}
+
+void MetricsRecord(struct Metrics *metrics, enum MetricsHistogram histogram, uint64_t ns) {
+    struct MetricsHistogramData *data = &LocalShard(metrics)->histograms[histogram];
+    uint64_t us = ns / 1000;
+    atomic_fetch_add_explicit(&data->buckets[BucketOf(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&data->sum_us, us, memory_order_relaxed);
+}
+
+static uint64_t SumCounter(const struct Metrics *metrics, enum MetricsCounter counter) {
+    uint64_t sum = 0;
+    for (int i = 0; i < metrics->shard_count; i++)
+        sum += atomic_load_explicit(&metrics->shards[i].counters[counter], memory_order_relaxed);
+    return sum;
+}
+
+static void PrintHeader(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void PrintCounter(FILE *out, const char *name, const char *help, uint64_t value) {
+    PrintHeader(out, name, "counter", help);
+    fprintf(out, "%s %lu\n", name, value);
+}
+
+static void PrintGauge(FILE *out, const char *name, const char *help, double value) {
+    PrintHeader(out, name, "gauge", help);
+    fprintf(out, "%s %.6g\n", name, value);
+}
+
+static void PrintHistogram(FILE *out, const struct Metrics *metrics,
+                           enum MetricsHistogram histogram, const char *stage) {
+    uint64_t cumulative = 0;
+    uint64_t sum_us = 0;
+    for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+        for (int i = 0; i < metrics->shard_count; i++)
+            cumulative += atomic_load_explicit(
+                &metrics->shards[i].histograms[histogram].buckets[b], memory_order_relaxed);
+        fprintf(out, "factorial_request_duration_seconds_bucket{stage=\"%s\",le=\"%.6f\"} %lu\n",
+                stage, (double)BucketBound(b) / 1e6, cumulative);
+    }
+    for (int i = 0; i < metrics->shard_count; i++)
+        sum_us += atomic_load_explicit(&metrics->shards[i].histograms[histogram].sum_us,
+                                       memory_order_relaxed);
+    fprintf(out, "factorial_request_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n",
+            stage, cumulative);
+    fprintf(out, "factorial_request_duration_seconds_sum{stage=\"%s\"} %.6f\n", stage,
+            (double)sum_us / 1e6);
+    fprintf(out, "factorial_request_duration_seconds_count{stage=\"%s\"} %lu\n", stage,
+            cumulative);
+}
+
+// Текст ответа на /metrics. Скорости считаются за время с прошлого опроса.
+static void FormatMetrics(struct Metrics *metrics, FILE *out) {
+    uint64_t now = MetricsNowNs();
+    uint64_t requests = SumCounter(metrics, METRICS_REQUESTS);
+    uint64_t busy_ns = SumCounter(metrics, METRICS_WORKER_BUSY_NS);
+    uint64_t accepted = SumCounter(metrics, METRICS_ACCEPTED);
+    uint64_t closed = SumCounter(metrics, METRICS_CLOSED);
+    double interval = (double)(now - metrics->last_ns) / 1e9;
+
+    PrintCounter(out, "factorial_requests_total", "Requests answered.", requests);
+    PrintCounter(out, "factorial_ranges_total", "Ranges answered.",
+                 SumCounter(metrics, METRICS_RANGES));
+    PrintCounter(out, "factorial_request_errors_total", "Requests answered with an error status.",
+                 SumCounter(metrics, METRICS_ERRORS));
+    PrintCounter(out, "factorial_requests_cancelled_total",
+                 "Requests cancelled by the client or by its disconnect.",
+                 SumCounter(metrics, METRICS_CANCELLED));
+    PrintCounter(out, "factorial_requests_shed_total",
+                 "Requests rejected as overloaded by admission control.",
+                 SumCounter(metrics, METRICS_SHED));
+    PrintGauge(out, "factorial_requests_per_second", "Request rate since the previous scrape.",
+               interval > 0 ? (double)(requests - metrics->last_requests) / interval : 0.0);
+    PrintCounter(out, "factorial_received_bytes_total", "Bytes read from clients.",
+                 SumCounter(metrics, METRICS_BYTES_IN));
+    PrintCounter(out, "factorial_sent_bytes_total", "Bytes sent to clients.",
+                 SumCounter(metrics, METRICS_BYTES_OUT));
+    PrintCounter(out, "factorial_connections_accepted_total", "Accepted connections.", accepted);
+    PrintGauge(out, "factorial_connections_active", "Open client connections.",
+               (double)(accepted - closed));
+    PrintGauge(out, "factorial_pool_queue_depth", "Tasks waiting for a worker thread.",
+               (double)ThreadPoolQueued(metrics->pool));
+    PrintHeader(out, "factorial_worker_busy_seconds_total", "counter",
+                "Time worker threads spent computing.");
+    fprintf(out, "factorial_worker_busy_seconds_total %.6f\n", (double)busy_ns / 1e9);
+    PrintGauge(out, "factorial_worker_utilization",
+               "Share of worker thread time spent computing since the previous scrape.",
+               interval > 0 ? (double)(busy_ns - metrics->last_busy_ns) / 1e9 /
+                                  (interval * metrics->workers)
+                            : 0.0);
+
+    PrintCounter(out, "factorial_log_dropped_total", "Verbose log records dropped on overflow.",
+                 LogDropped());
+
+    if (metrics->cache != NULL) {
+        struct RangeCacheStats stats;
+        RangeCacheGetStats(metrics->cache, &stats);
+        uint64_t lookups = stats.hits + stats.partial_hits + stats.misses;
+        PrintCounter(out, "factorial_cache_hits_total", "Exact cache hits.", stats.hits);
+        PrintCounter(out, "factorial_cache_partial_hits_total",
+                     "Answers assembled from cached parts.", stats.partial_hits);
+        PrintCounter(out, "factorial_cache_misses_total", "Cache misses.", stats.misses);
+        PrintGauge(out, "factorial_cache_hit_ratio", "Exact and partial hits per lookup.",
+                   lookups ? (double)(stats.hits + stats.partial_hits) / (double)lookups : 0.0);
+        PrintGauge(out, "factorial_cache_entries", "Cached ranges.", (double)stats.entries);
+    }
+
+    PrintHeader(out, "factorial_request_duration_seconds", "histogram",
+                "Request latency by stage.");
+    PrintHistogram(out, metrics, METRICS_COMPUTE, "compute");
+    PrintHistogram(out, metrics, METRICS_END_TO_END, "end_to_end");
+
+    metrics->last_ns = now;
+    metrics->last_requests = requests;
+    metrics->last_busy_ns = busy_ns;
+}
+
+// Один запрос на соединение: читаем до конца заголовков, отвечаем и закрываем
+static void ServeHttp(struct Metrics *metrics, int fd) {
+    char request[HTTP_REQUEST_MAX + 1];
+    size_t length = 0;
+    while (length < HTTP_REQUEST_MAX) {
+        ssize_t received = recv(fd, request + length, HTTP_REQUEST_MAX - length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return;
+        length += (size_t)received;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+    request[length] = '\0';
+
+    char *body = NULL;
+    size_t body_size = 0;
+    FILE *out = open_memstream(&body, &body_size);
+    const char *status = "200 OK";
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+        FormatMetrics(metrics, out);
+    } else {
+        status = "404 Not Found";
+        fprintf(out, "Only GET /metrics is served\n");
+    }
+    fclose(out);
+
+    char header[256];
+    int header_size = snprintf(header, sizeof(header),
+                               "HTTP/1.1 %s\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: %zu\r\n"
+                               "Connection: close\r\n\r\n",
+                               status, body_size);
+    if (SendAll(fd, header, (size_t)header_size) == 0)
+        SendAll(fd, body, body_size);
+    free(body);
+}
+
+static void *RunMetrics(void *arg) {
+    struct Metrics *metrics = (struct Metrics *)arg;
+    while (true) {
+        int fd = accept(metrics->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "Metrics listener failed\n");
+            return NULL;
+        }
+        // Медленный клиент не должен занимать поток надолго
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        ServeHttp(metrics, fd);
+        close(fd);
+    }
+}
+
+int MetricsInit(struct Metrics *metrics, int port, int shard_count, struct ThreadPool *pool,
+                struct RangeCache *cache) {
+    metrics->listen_fd = CreateLoopbackListenSocket(port);
+    if (metrics->listen_fd < 0)
+        return -1;
+    metrics->shard_count = shard_count;
+    metrics->shards = aligned_alloc(_Alignof(struct MetricsShard),
+                                    sizeof(struct MetricsShard) * (size_t)shard_count);
+    memset(metrics->shards, 0, sizeof(struct MetricsShard) * (size_t)shard_count);
+    atomic_init(&metrics->next_shard, 0);
+    metrics->workers = pool->size;
+    metrics->pool = pool;
+    metrics->cache = cache;
+    metrics->last_ns = MetricsNowNs();
+    metrics->last_requests = 0;
+    metrics->last_busy_ns = 0;
+    return 0;
+}
+
+int MetricsStart(struct Metrics *metrics) {
+    return pthread_create(&metrics->thread, NULL, RunMetrics, metrics) == 0 ? 0 : -1;
+}
@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "range_cache.h"
+#include "thread_pool.h"
+
+// Гистограмма в духе HDR: значения 0..3 мкс точно, дальше по четыре
+// поддиапазона на каждую степень двойки (погрешность до 25%), до ~19 часов
+#define METRICS_HISTOGRAM_BUCKETS 140
+
+enum MetricsCounter {
+    METRICS_REQUESTS,           // отправленные ответы (кадр v2 или запрос v1)
+    METRICS_RANGES,             // диапазоны в них
+    METRICS_ERRORS,             // ответы с ненулевым статусом
+    METRICS_CANCELLED,          // запросы, отменённые клиентом или его уходом
+    METRICS_SHED,               // запросы, не допущенные из-за перегрузки
+    METRICS_BYTES_IN,
+    METRICS_BYTES_OUT,
+    METRICS_ACCEPTED,
+    METRICS_CLOSED,
+    METRICS_WORKER_BUSY_NS,     // время потоков пула внутри задач
+    METRICS_COUNTER_COUNT,
+};
+
+enum MetricsHistogram {
+    METRICS_COMPUTE,            // от начала первой задачи запроса до сборки результата
+    METRICS_END_TO_END,         // от разбора запроса до постановки ответа в буфер
+    METRICS_HISTOGRAM_COUNT,
+};
+
+struct MetricsHistogramData {
+    atomic_uint_least64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+    atomic_uint_least64_t sum_us;
+};
+
+// Счётчики одного потока на своих кэш-линиях: запись без блокировок и
+// без борьбы за линию, сумма по потокам собирается только при опросе
+struct MetricsShard {
+    _Alignas(64) atomic_uint_least64_t counters[METRICS_COUNTER_COUNT];
+    struct MetricsHistogramData histograms[METRICS_HISTOGRAM_COUNT];
+};
+
+struct Metrics {
+    struct MetricsShard *shards;
+    int shard_count;
+    atomic_int next_shard;
+    int workers;
+    struct ThreadPool *pool;
+    struct RangeCache *cache;   // NULL, если кэш выключен
+    int listen_fd;
+    pthread_t thread;
+    // Снимок прошлого опроса для скоростей «за интервал»
+    uint64_t last_ns;
+    uint64_t last_requests;
+    uint64_t last_busy_ns;
+};
+
+uint64_t MetricsNowNs(void);
+
+// shard_count — число потоков, которые пишут метрики. Возвращает -1, если
+// не удалось занять порт.
+int MetricsInit(struct Metrics *metrics, int port, int shard_count, struct ThreadPool *pool,
+                struct RangeCache *cache);
+
+// Поток, отвечающий на GET /metrics в текстовом формате Prometheus
+int MetricsStart(struct Metrics *metrics);
+
+void MetricsAdd(struct Metrics *metrics, enum MetricsCounter counter, uint64_t value);
+void MetricsRecord(struct Metrics *metrics, enum MetricsHistogram histogram, uint64_t ns);
+
+#endif
@@ -0,0 +1,94 @@
+#include "modarith.h"
+
+#include <stdbool.h>
+
+void ModInit(struct ModContext *ctx, uint64_t mod) {
+    ctx->mod = mod;
+    ctx->barrett = 0;
+    ctx->mont_inv = 0;
+    ctx->mont_r = 0;
+    ctx->mont_r2 = 0;
+
+    if (mod < (1ULL << 32)) {
+        ctx->kind = MOD_KIND_BARRETT;
+        ctx->barrett = UINT64_MAX / mod;
+    } else if (mod % 2 == 0) {
+        ctx->kind = MOD_KIND_WIDE;
+    } else {
+        ctx->kind = MOD_KIND_MONTGOMERY;
+    }
+
+    // Константы Монтгомери нужны и малым нечётным модулям (цепочки умножений)
+    if (mod % 2 == 0 || mod == 1)
+        return;
+
+    // Обратный элемент по модулю 2^64 методом Ньютона: каждая итерация
+    // удваивает число верных младших бит (для нечётного mod начинаем с 3 бит)
+    uint64_t inv = mod;
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - mod * inv;
+    ctx->mont_inv = inv;
+
+    ctx->mont_r = (0 - mod) % mod;
+    ctx->mont_r2 = ModMulWide(ctx->mont_r, ctx->mont_r, mod);
+}
+
+uint64_t ModPow(const struct ModContext *ctx, uint64_t base, uint64_t exp) {
+    uint64_t result = 1 % ctx->mod;
+    base %= ctx->mod;
+    while (exp > 0) {
+        if (exp & 1)
+            result = ModMul(ctx, result, base);
+        base = ModMul(ctx, base, base);
+        exp >>= 1;
+    }
+    return result;
+}
+
+// Цепочка умножений Монтгомери. Множители не переводятся в форму Монтгомери:
+// каждое умножение вносит лишний множитель 2^-64, и накопленное 2^-64n
+// компенсируется одним умножением на 2^64n mod mod после цикла.
+static uint64_t MontRangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t steps) {
+    uint64_t mod = ctx->mod;
+    uint64_t acc = 1;
+    uint64_t i = begin % mod;
+    uint64_t left = steps;
+
+    while (true) {
+        acc = MontMul(ctx, acc, i);
+        if (left-- == 0)
+            break;
+        if (++i == mod)
+            i = 0;
+    }
+
+    // steps + 1 умножений, steps может быть равен UINT64_MAX
+    uint64_t correction = ModMulWide(ModPow(ctx, ctx->mont_r, steps), ctx->mont_r, mod);
+    return ModMulWide(acc, correction, mod);
+}
+
+uint64_t ModRangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    if (begin > end)
+        return 1;
+
+    uint64_t mod = ctx->mod;
+    uint64_t steps = end - begin;
+
+    // Среди mod подряд идущих чисел обязательно есть кратное mod
+    if (steps >= mod - 1)
+        return 0;
+
+    if (ctx->kind == MOD_KIND_MONTGOMERY)
+        return MontRangeProduct(ctx, begin, steps);
+
+    uint64_t acc = 1 % mod;
+    uint64_t i = begin % mod;
+    while (true) {
+        acc = ModMul(ctx, acc, i);
+        if (steps-- == 0)
+            break;
+        if (++i == mod)
+            i = 0;
+    }
+    return acc;
+}
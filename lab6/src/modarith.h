@@ -0,0 +1,80 @@
+#ifndef MODARITH_H
+#define MODARITH_H
+
+#include <stdint.h>
+
+// Способ модульного умножения, выбираемый по величине модуля
+enum ModKind {
+    MOD_KIND_BARRETT,    // mod < 2^32: произведение помещается в 64 бита
+    MOD_KIND_MONTGOMERY, // нечётный mod >= 2^32
+    MOD_KIND_WIDE,       // чётный mod >= 2^32: остаток от 128-битного произведения
+};
+
+// Предвычисленные константы для быстрого умножения по фиксированному модулю
+struct ModContext {
+    uint64_t mod;
+    enum ModKind kind;
+    uint64_t barrett;  // floor((2^64 - 1) / mod), только для MOD_KIND_BARRETT
+    uint64_t mont_inv; // mod^-1 mod 2^64, для любого нечётного mod > 1
+    uint64_t mont_r;   // 2^64 mod mod
+    uint64_t mont_r2;  // 2^128 mod mod
+};
+
+void ModInit(struct ModContext *ctx, uint64_t mod);
+
+// Умножение через 128-битное произведение, работает для любого mod > 0
+static inline uint64_t ModMulWide(uint64_t a, uint64_t b, uint64_t mod) {
+    return (uint64_t)(((unsigned __int128)a * b) % mod);
+}
+
+// Умножение Барретта для mod < 2^32, a и b должны быть меньше mod
+static inline uint64_t ModMulBarrett(const struct ModContext *ctx, uint64_t a, uint64_t b) {
+    uint64_t x = a * b;
+    uint64_t q = (uint64_t)(((unsigned __int128)x * ctx->barrett) >> 64);
+    uint64_t r = x - q * ctx->mod;
+    // Оценка частного занижена не более чем на 2
+    if (r >= ctx->mod)
+        r -= ctx->mod;
+    if (r >= ctx->mod)
+        r -= ctx->mod;
+    return r;
+}
+
+// Редукция Монтгомери: возвращает a * b * 2^-64 mod mod, a и b меньше mod
+static inline uint64_t MontMul(const struct ModContext *ctx, uint64_t a, uint64_t b) {
+    unsigned __int128 t = (unsigned __int128)a * b;
+    uint64_t t_lo = (uint64_t)t;
+    uint64_t t_hi = (uint64_t)(t >> 64);
+    uint64_t m = t_lo * ctx->mont_inv;
+    uint64_t mn_hi = (uint64_t)(((unsigned __int128)m * ctx->mod) >> 64);
+    uint64_t r = t_hi - mn_hi;
+    if (t_hi < mn_hi)
+        r += ctx->mod;
+    return r;
+}
+
+// Перевод в форму Монтгомери и обратно
+static inline uint64_t MontEnter(const struct ModContext *ctx, uint64_t a) {
+    return MontMul(ctx, a, ctx->mont_r2);
+}
+
+static inline uint64_t MontLeave(const struct ModContext *ctx, uint64_t a) {
+    return MontMul(ctx, a, 1);
+}
+
+// Одиночное умножение a * b mod mod, a и b должны быть меньше mod.
+// Для одиночных умножений Монтгомери невыгоден (нужен вход и выход из формы),
+// поэтому большие модули идут через 128-битный остаток.
+static inline uint64_t ModMul(const struct ModContext *ctx, uint64_t a, uint64_t b) {
+    if (ctx->kind == MOD_KIND_BARRETT)
+        return ModMulBarrett(ctx, a, b);
+    return ModMulWide(a, b, ctx->mod);
+}
+
+// base^exp mod mod
+uint64_t ModPow(const struct ModContext *ctx, uint64_t base, uint64_t exp);
+
+// Произведение всех чисел из [begin, end] по модулю ctx->mod
+uint64_t ModRangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t end);
+
+#endif
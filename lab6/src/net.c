@@ -0,0 +1,228 @@
+#include "net.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int ListenOn(uint32_t address, int port, bool non_blocking, bool reuse_port) {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        fprintf(stderr, "Can not create server socket!\n");
+        return -1;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)port);
+    server.sin_addr.s_addr = htonl(address);
+
+    int opt_val = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt_val,
+                                 sizeof(opt_val)) < 0) {
+        fprintf(stderr, "Can not share port between processes!\n");
+        close(server_fd);
+        return -1;
+    }
+
+    if (bind(server_fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        fprintf(stderr, "Can not bind to socket!\n");
+        close(server_fd);
+        return -1;
+    }
+
+    if (listen(server_fd, 128) < 0) {
+        fprintf(stderr, "Could not listen on socket\n");
+        close(server_fd);
+        return -1;
+    }
+
+    if (non_blocking && SetNonBlocking(server_fd) < 0) {
+        fprintf(stderr, "Could not make socket non-blocking\n");
+        close(server_fd);
+        return -1;
+    }
+
+    return server_fd;
+}
+
+int CreateListenSocket(int port, bool non_blocking, bool reuse_port) {
+    return ListenOn(INADDR_ANY, port, non_blocking, reuse_port);
+}
+
+int CreateUdpSocket(int port, bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Can not create UDP socket!\n");
+        return -1;
+    }
+
+    int opt_val = 1;
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt_val, sizeof(opt_val)) < 0) {
+        fprintf(stderr, "Can not share UDP port between processes!\n");
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)port);
+    server.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        fprintf(stderr, "Can not bind UDP socket!\n");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int CreateUnixListenSocket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Can not create unix socket!\n");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        fprintf(stderr, "Can not listen on unix socket %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int SendFds(int fd, const void *data, size_t size, const int *fds, int count) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * 4)];
+    } control;
+    if (count > 4) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {(void *)data, size};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * (size_t)count);
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0)
+        return -1;
+    // Короткое сообщение в пустой сокет уходит целиком
+    if ((size_t)sent != size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return 0;
+}
+
+long RecvFds(int fd, void *data, size_t size, int *fds, int max, int *count) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * 4)];
+    } control;
+    struct iovec iov = {data, size};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    ssize_t received;
+    do {
+        received = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    *count = 0;
+    if (received < 0)
+        return -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int n = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        const unsigned char *passed = CMSG_DATA(cmsg);
+        for (int i = 0; i < n; i++) {
+            int passed_fd;
+            memcpy(&passed_fd, passed + sizeof(int) * (size_t)i, sizeof(int));
+            // Лишние дескрипторы сразу закрываются
+            if (*count < max)
+                fds[(*count)++] = passed_fd;
+            else
+                close(passed_fd);
+        }
+    }
+    return received;
+}
+
+int CreateLoopbackListenSocket(int port) {
+    return ListenOn(INADDR_LOOPBACK, port, false, false);
+}
+
+int SendAll(int fd, const void *data, size_t size) {
+    const char *ptr = data;
+    while (size > 0) {
+        ssize_t sent = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += sent;
+        size -= (size_t)sent;
+    }
+    return 0;
+}
+
+int RecvAll(int fd, void *data, size_t size) {
+    char *ptr = data;
+    while (size > 0) {
+        ssize_t received = recv(fd, ptr, size, 0);
+        if (received == 0)
+            return -1;
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += received;
+        size -= (size_t)received;
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Перевод дескриптора в неблокирующий режим, 0 при успехе
+int SetNonBlocking(int fd);
+
+// Слушающий TCP-сокет на всех интерфейсах. Возвращает дескриптор или -1,
+// текст ошибки уже выведен в stderr. С reuse_port (SO_REUSEPORT) тот же
+// порт могут слушать несколько процессов, ядро распределяет соединения
+// между их сокетами.
+int CreateListenSocket(int port, bool non_blocking, bool reuse_port);
+
+// Неблокирующий UDP-сокет на всех интерфейсах, -1 при ошибке
+int CreateUdpSocket(int port, bool reuse_port);
+
+// Неблокирующий слушающий unix-сокет. Оставшийся от прошлого запуска файл
+// сокета удаляется. -1 при ошибке, текст ошибки уже выведен в stderr.
+int CreateUnixListenSocket(const char *path);
+
+// Одно сообщение с count дескрипторами (SCM_RIGHTS). 0 или -1 с errno.
+int SendFds(int fd, const void *data, size_t size, const int *fds, int count);
+// Принимает сообщение и до max дескрипторов. Возвращает длину сообщения
+// (0 — соединение закрыто) или -1 с errno, в *count — число дескрипторов.
+long RecvFds(int fd, void *data, size_t size, int *fds, int max, int *count);
+
+// Блокирующий слушающий сокет только на 127.0.0.1, для служебных портов
+int CreateLoopbackListenSocket(int port);
+
+// Блокирующие отправка и приём ровно size байт с повтором при частичной
+// передаче и EINTR. Возвращают 0 или -1 (ошибка или соединение закрыто).
+int SendAll(int fd, const void *data, size_t size);
+int RecvAll(int fd, void *data, size_t size);
+
+#endif
@@ -0,0 +1,371 @@
+#include "prime_factorial.h"
+
+#include <stdlib.h>
+
+#include "range_kernel.h"
+
+// Ниже этого значения n! дешевле посчитать линейным ядром
+#define PRIME_SUBLINEAR_MIN_N (1ULL << 24)
+
+// Простые для NTT вида c * 2^k + 1 с первообразным корнем 3. Произведение
+// трёх таких простых (~2^86) больше любого коэффициента свёртки
+// (длина * p^2 < 2^17 * 2^64), поэтому его восстанавливает КТО.
+#define NTT_PRIME0 998244353U
+#define NTT_PRIME1 167772161U
+#define NTT_PRIME2 469762049U
+
+static uint32_t PowMod32(uint32_t base, uint64_t exp, uint32_t mod) {
+    uint64_t result = 1;
+    uint64_t b = base % mod;
+    while (exp > 0) {
+        if (exp & 1)
+            result = result * b % mod;
+        b = b * b % mod;
+        exp >>= 1;
+    }
+    return (uint32_t)result;
+}
+
+bool IsPrime64(uint64_t n) {
+    if (n < 2)
+        return false;
+    static const uint64_t small[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    for (size_t i = 0; i < sizeof(small) / sizeof(small[0]); i++) {
+        if (n % small[i] == 0)
+            return n == small[i];
+    }
+
+    uint64_t d = n - 1;
+    int s = 0;
+    while (d % 2 == 0) {
+        d /= 2;
+        s++;
+    }
+
+    struct ModContext ctx;
+    ModInit(&ctx, n);
+
+    // Этого набора оснований достаточно для всех n < 2^64
+    static const uint64_t bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        uint64_t a = bases[i] % n;
+        if (a == 0)
+            continue;
+        uint64_t x = ModPow(&ctx, a, d);
+        if (x == 1 || x == n - 1)
+            continue;
+        bool composite = true;
+        for (int r = 1; r < s; r++) {
+            x = ModMul(&ctx, x, x);
+            if (x == n - 1) {
+                composite = false;
+                break;
+            }
+        }
+        if (composite)
+            return false;
+    }
+    return true;
+}
+
+// Корни для NTT длины до n: rt[k + j] = w^j, где w — корень степени 2k,
+// k = 1, 2, 4, ..., n / 2. Таблица меньшей длины — префикс большей.
+static void NttRoots(uint32_t *rt, size_t n, uint32_t mod) {
+    rt[0] = 1;
+    for (size_t k = 1; k < n; k <<= 1) {
+        uint64_t w = PowMod32(3, (mod - 1) / (2 * k), mod);
+        rt[k] = 1;
+        for (size_t j = 1; j < k; j++)
+            rt[k + j] = (uint32_t)(rt[k + j - 1] * w % mod);
+    }
+}
+
+// Встраивается с константным mod, чтобы компилятор заменил деление умножением.
+// Обратное преобразование — прямое с разворотом a[1..n-1] и делением на n.
+static inline __attribute__((always_inline))
+void Ntt(uint32_t *a, size_t n, const uint32_t *rt, uint32_t mod, bool invert) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            uint32_t t = a[i];
+            a[i] = a[j];
+            a[j] = t;
+        }
+    }
+
+    for (size_t k = 1; k < n; k <<= 1) {
+        for (size_t i = 0; i < n; i += 2 * k) {
+            for (size_t j = 0; j < k; j++) {
+                uint32_t u = a[i + j];
+                uint32_t v = (uint32_t)((uint64_t)a[i + j + k] * rt[k + j] % mod);
+                a[i + j] = u + v >= mod ? u + v - mod : u + v;
+                a[i + j + k] = u >= v ? u - v : u + mod - v;
+            }
+        }
+    }
+
+    if (invert) {
+        for (size_t i = 1, j = n - 1; i < j; i++, j--) {
+            uint32_t t = a[i];
+            a[i] = a[j];
+            a[j] = t;
+        }
+        uint64_t n_inv = PowMod32((uint32_t)(n % mod), mod - 2, mod);
+        for (size_t i = 0; i < n; i++)
+            a[i] = (uint32_t)(a[i] * n_inv % mod);
+    }
+}
+
+// Образ вектора src длины len, дополненного нулями до size
+static inline __attribute__((always_inline))
+void NttForward(const uint32_t *src, size_t len, uint32_t *dst, size_t size,
+                const uint32_t *rt, uint32_t mod) {
+    for (size_t i = 0; i < size; i++)
+        dst[i] = i < len ? src[i] % mod : 0;
+    Ntt(dst, size, rt, mod, false);
+}
+
+// Поточечное произведение с готовым образом f_hat и обратное преобразование
+static inline __attribute__((always_inline))
+void NttMulInverse(uint32_t *a, const uint32_t *f_hat, size_t size, const uint32_t *rt,
+                   uint32_t mod) {
+    for (size_t i = 0; i < size; i++)
+        a[i] = (uint32_t)((uint64_t)a[i] * f_hat[i] % mod);
+    Ntt(a, size, rt, mod, true);
+}
+
+struct SublinearState {
+    uint32_t p;
+    uint32_t *fact;     // i! mod p, i <= v + 1
+    uint32_t *inv_fact; // (i!)^-1 mod p
+    uint32_t *rt[3];    // корни NTT для каждого простого
+    uint32_t *f_hat[3]; // образ f текущего шага удвоения
+    uint32_t *g_hat[3]; // буферы под образ g
+    uint32_t *f;        // f_i, g_j и префиксные произведения, до 2v + 2 элементов
+    uint32_t *g;
+    uint32_t *prefix;
+    size_t d;           // степень, для которой посчитан f_hat
+    size_t size;        // длина NTT для этой степени
+};
+
+// Первая половина интерполяции Лагранжа, общая для всех сдвигов одной
+// выборки: f_i = h(i) / (i! (d - i)! (-1)^(d - i)) и её образы
+static void PrepareShift(struct SublinearState *st, const uint32_t *h, size_t d) {
+    uint64_t p = st->p;
+    for (size_t i = 0; i <= d; i++) {
+        uint64_t v = (uint64_t)h[i] * st->inv_fact[i] % p * st->inv_fact[d - i] % p;
+        st->f[i] = (uint32_t)((d - i) % 2 == 1 && v != 0 ? p - v : v);
+    }
+
+    size_t size = 1;
+    while (size < 2 * d + 1)
+        size <<= 1;
+    st->d = d;
+    st->size = size;
+    NttForward(st->f, d + 1, st->f_hat[0], size, st->rt[0], NTT_PRIME0);
+    NttForward(st->f, d + 1, st->f_hat[1], size, st->rt[1], NTT_PRIME1);
+    NttForward(st->f, d + 1, st->f_hat[2], size, st->rt[2], NTT_PRIME2);
+}
+
+// По значениям многочлена степени d в точках 0..d (подготовленным PrepareShift)
+// находит значения в a..a+d. Точки a - d .. a + d не должны совпадать с 0..d
+// по модулю p. Нужна только середина свёртки (индексы d..2d), поэтому
+// хватает циклической свёртки длины >= 2d + 1.
+static void ShiftSamples(struct SublinearState *st, uint64_t a, uint32_t *out) {
+    uint64_t p = st->p;
+    size_t d = st->d;
+    size_t m = 2 * d + 1;
+    size_t size = st->size;
+    uint32_t *g = st->g;
+    uint32_t *prefix = st->prefix;
+
+    // g_j = 1 / (a - d + j), обратные считаются одним возведением в степень
+    uint64_t base = (a + p - d % p) % p;
+    prefix[0] = 1;
+    for (size_t j = 0; j < m; j++)
+        prefix[j + 1] = (uint32_t)((uint64_t)prefix[j] * ((base + j) % p) % p);
+    uint64_t inv = PowMod32(prefix[m], p - 2, (uint32_t)p);
+    for (size_t j = m; j-- > 0;) {
+        g[j] = (uint32_t)(inv * prefix[j] % p);
+        inv = inv * ((base + j) % p) % p;
+    }
+
+    NttForward(g, m, st->g_hat[0], size, st->rt[0], NTT_PRIME0);
+    NttMulInverse(st->g_hat[0], st->f_hat[0], size, st->rt[0], NTT_PRIME0);
+    NttForward(g, m, st->g_hat[1], size, st->rt[1], NTT_PRIME1);
+    NttMulInverse(st->g_hat[1], st->f_hat[1], size, st->rt[1], NTT_PRIME1);
+    NttForward(g, m, st->g_hat[2], size, st->rt[2], NTT_PRIME2);
+    NttMulInverse(st->g_hat[2], st->f_hat[2], size, st->rt[2], NTT_PRIME2);
+
+    // Восстановление по Гарнеру: x = r0 + m0 * t1 + m0 * m1 * t2
+    const uint64_t m0 = NTT_PRIME0, m1 = NTT_PRIME1, m2 = NTT_PRIME2;
+    const uint64_t m0_inv_m1 = PowMod32(m0 % m1, m1 - 2, m1);
+    const uint64_t m01_inv_m2 = PowMod32(m0 * m1 % m2, m2 - 2, m2);
+    const uint64_t m0_p = m0 % p;
+    const uint64_t m01_p = m0 * m1 % p;
+
+    // h(a + k) = conv[d + k] * prod_{j=0..d} (a + k - j), произведение —
+    // это prefix[k + d + 1] / prefix[k], а 1 / prefix[k] — произведение g_0..g_{k-1}
+    uint64_t prefix_inv = 1;
+    for (size_t k = 0; k <= d; k++) {
+        uint64_t r0 = st->g_hat[0][d + k], r1 = st->g_hat[1][d + k], r2 = st->g_hat[2][d + k];
+        uint64_t t1 = (r1 + m1 - r0 % m1) % m1 * m0_inv_m1 % m1;
+        uint64_t x01_m2 = (r0 + m0 % m2 * t1) % m2;
+        uint64_t t2 = (r2 + m2 - x01_m2) % m2 * m01_inv_m2 % m2;
+        uint64_t conv = (r0 % p + m0_p * t1 % p + m01_p * t2 % p) % p;
+
+        uint64_t numer = prefix[k + d + 1] * prefix_inv % p;
+        out[k] = (uint32_t)(conv * numer % p);
+        prefix_inv = prefix_inv * g[k] % p;
+    }
+}
+
+// Значения g_d(x) = (v x + 1)(v x + 2)...(v x + d) в точках x = 0..v,
+// d наращивается удвоением (min_25): g_2d(x) = g_d(x) * g_d(x + d / v)
+static uint32_t *SampleBlocks(struct SublinearState *st, uint64_t v) {
+    uint64_t p = st->p;
+    uint32_t *h = malloc(sizeof(uint32_t) * (v + 2));
+    uint32_t *a = malloc(sizeof(uint32_t) * (v + 2));
+    uint32_t *b = malloc(sizeof(uint32_t) * (v + 2));
+    uint32_t *c = malloc(sizeof(uint32_t) * (v + 2));
+    uint64_t v_inv = PowMod32((uint32_t)(v % p), p - 2, (uint32_t)p);
+
+    int top = 63 - __builtin_clzll(v);
+    uint64_t d = 1;
+    h[0] = 1;
+    h[1] = (uint32_t)((v + 1) % p);
+
+    for (int bit = top - 1; bit >= 0; bit--) {
+        // d -> 2d
+        uint64_t delta = d % p * v_inv % p;
+        PrepareShift(st, h, d);
+        ShiftSamples(st, d + 1, a);
+        ShiftSamples(st, delta, b);
+        ShiftSamples(st, (delta + d + 1) % p, c);
+        for (uint64_t i = d + 1; i <= 2 * d; i++)
+            h[i] = a[i - d - 1];
+        for (uint64_t i = 0; i <= d; i++)
+            h[i] = (uint32_t)((uint64_t)h[i] * b[i] % p);
+        for (uint64_t i = d + 1; i <= 2 * d; i++)
+            h[i] = (uint32_t)((uint64_t)h[i] * c[i - d - 1] % p);
+        d *= 2;
+
+        if ((v >> bit) & 1) {
+            // d -> d + 1
+            for (uint64_t i = 0; i <= d; i++)
+                h[i] = (uint32_t)((uint64_t)h[i] * ((v * i + d + 1) % p) % p);
+            uint64_t last = 1;
+            for (uint64_t k = 1; k <= d + 1; k++)
+                last = last * ((v * (d + 1) + k) % p) % p;
+            h[d + 1] = (uint32_t)last;
+            d++;
+        }
+    }
+
+    free(a);
+    free(b);
+    free(c);
+    return h;
+}
+
+// n! mod p при n <= p / 2: тогда v^2 + 2v < p и точки сдвига не пересекаются
+static uint64_t SublinearFactorial(const struct ModContext *ctx, uint64_t n) {
+    uint64_t p = ctx->mod;
+    uint64_t v = 1;
+    while ((v + 1) * (v + 1) <= n)
+        v++;
+
+    struct SublinearState st;
+    st.p = (uint32_t)p;
+    st.fact = malloc(sizeof(uint32_t) * (v + 2));
+    st.inv_fact = malloc(sizeof(uint32_t) * (v + 2));
+    st.f = malloc(sizeof(uint32_t) * (v + 2));
+    st.g = malloc(sizeof(uint32_t) * (v + 2));
+    st.prefix = malloc(sizeof(uint32_t) * (v + 3));
+
+    // Наибольшая свёртка — на последнем удвоении, d <= v / 2
+    size_t size = 1;
+    while (size < v + 1)
+        size <<= 1;
+    const uint32_t primes[3] = {NTT_PRIME0, NTT_PRIME1, NTT_PRIME2};
+    for (int k = 0; k < 3; k++) {
+        st.rt[k] = malloc(sizeof(uint32_t) * size);
+        st.f_hat[k] = malloc(sizeof(uint32_t) * size);
+        st.g_hat[k] = malloc(sizeof(uint32_t) * size);
+        NttRoots(st.rt[k], size, primes[k]);
+    }
+
+    st.fact[0] = 1;
+    for (uint64_t i = 1; i <= v + 1; i++)
+        st.fact[i] = (uint32_t)((uint64_t)st.fact[i - 1] * i % p);
+    st.inv_fact[v + 1] = PowMod32(st.fact[v + 1], p - 2, (uint32_t)p);
+    for (uint64_t i = v + 1; i > 0; i--)
+        st.inv_fact[i - 1] = (uint32_t)((uint64_t)st.inv_fact[i] * i % p);
+
+    uint32_t *blocks = SampleBlocks(&st, v);
+    uint64_t result = 1;
+    for (uint64_t i = 0; i < v; i++)
+        result = result * blocks[i] % p;
+    // Остаток (v^2, n] — не больше 2v множителей
+    result = ModMul(ctx, result, RangeProduct(ctx, v * v + 1, n));
+
+    free(blocks);
+    free(st.fact);
+    free(st.inv_fact);
+    free(st.f);
+    free(st.g);
+    free(st.prefix);
+    for (int k = 0; k < 3; k++) {
+        free(st.rt[k]);
+        free(st.f_hat[k]);
+        free(st.g_hat[k]);
+    }
+    return result;
+}
+
+uint64_t PrimeFactorial(const struct ModContext *ctx, uint64_t n) {
+    uint64_t p = ctx->mod;
+    if (n >= p)
+        return 0;
+
+    // Теорема Вильсона: (p-1)! = -1, значит n! = (-1)^(p-n) / (p-1-n)!
+    if (n > p / 2) {
+        uint64_t rest = PrimeFactorial(ctx, p - 1 - n);
+        uint64_t inv = ModPow(ctx, rest, p - 2);
+        return (p - n) % 2 == 1 ? (p - inv) % p : inv;
+    }
+
+    if (n < PRIME_SUBLINEAR_MIN_N)
+        return RangeProduct(ctx, 1, n);
+    return SublinearFactorial(ctx, n);
+}
+
+uint64_t PrimeRangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    uint64_t p = ctx->mod;
+    if (begin > end)
+        return 1;
+    if (end - begin >= p - 1)
+        return 0;
+
+    // Диапазон короче p содержит кратное p, только если начинается с него
+    // или переходит через него
+    uint64_t lo = begin % p;
+    uint64_t hi = end % p;
+    if (lo == 0 || hi < lo)
+        return 0;
+
+    uint64_t numer = PrimeFactorial(ctx, hi);
+    uint64_t denom = PrimeFactorial(ctx, lo - 1);
+    return ModMul(ctx, numer, ModPow(ctx, denom, p - 2));
+}
+
+bool PrimeEngineApplies(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    if (begin > end || end - begin < PRIME_ENGINE_MIN_RANGE)
+        return false;
+    if (ctx->mod >= (1ULL << 32) || end - begin >= ctx->mod - 1)
+        return false;
+    return IsPrime64(ctx->mod);
+}
@@ -0,0 +1,25 @@
+#ifndef PRIME_FACTORIAL_H
+#define PRIME_FACTORIAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "modarith.h"
+
+// Диапазоны короче этого не стоят проверки простоты и двух факториалов
+#define PRIME_ENGINE_MIN_RANGE (1ULL << 26)
+
+// Детерминированный тест Миллера — Рабина для всех 64-битных чисел
+bool IsPrime64(uint64_t n);
+
+// n! mod p за O(sqrt(n) log n) для простого p < 2^32 и n < p
+uint64_t PrimeFactorial(const struct ModContext *ctx, uint64_t n);
+
+// Произведение [begin, end] по простому модулю через два факториала и обратный элемент
+uint64_t PrimeRangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t end);
+
+// Стоит ли считать диапазон через PrimeRangeProduct: модуль простой, меньше 2^32,
+// а диапазон достаточно длинный, чтобы обогнать линейное ядро
+bool PrimeEngineApplies(const struct ModContext *ctx, uint64_t begin, uint64_t end);
+
+#endif
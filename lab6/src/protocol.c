@@ -0,0 +1,237 @@
+#include "protocol.h"
+
+#include <string.h>
+
+void ProtoPutU32(unsigned char *out, uint32_t value) {
+    for (int i = 3; i >= 0; i--) {
+        out[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+void ProtoPutU64(unsigned char *out, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+uint32_t ProtoGetU32(const unsigned char *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+uint64_t ProtoGetU64(const unsigned char *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+void ProtoEncodeHeader(const struct FrameHeader *header, unsigned char *out) {
+    ProtoPutU32(out, header->magic);
+    out[4] = header->version;
+    out[5] = header->opcode;
+    out[6] = (unsigned char)(header->status >> 8);
+    out[7] = (unsigned char)header->status;
+    ProtoPutU32(out + 8, header->length);
+    ProtoPutU64(out + 12, header->request_id);
+}
+
+void ProtoDecodeHeader(const unsigned char *in, struct FrameHeader *header) {
+    header->magic = ProtoGetU32(in);
+    header->version = in[4];
+    header->opcode = in[5];
+    header->status = (uint16_t)((in[6] << 8) | in[7]);
+    header->length = ProtoGetU32(in + 8);
+    header->request_id = ProtoGetU64(in + 12);
+}
+
+bool ProtoIsFrameStart(const unsigned char *in) {
+    return ProtoGetU32(in) == PROTO_MAGIC;
+}
+
+size_t ProtoRangePayloadSize(uint32_t count) {
+    return sizeof(uint32_t) + (size_t)count * PROTO_RANGE_SIZE;
+}
+
+void ProtoEncodeRanges(const struct FactorialArgs *ranges, uint32_t count, unsigned char *out) {
+    ProtoPutU32(out, count);
+    out += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        ProtoPutU64(out, ranges[i].begin);
+        ProtoPutU64(out + 8, ranges[i].end);
+        ProtoPutU64(out + 16, ranges[i].mod);
+        out += PROTO_RANGE_SIZE;
+    }
+}
+
+int ProtoDecodeRanges(const unsigned char *in, size_t length, struct FactorialArgs *ranges,
+                      uint32_t max) {
+    if (length < sizeof(uint32_t))
+        return -1;
+    uint32_t count = ProtoGetU32(in);
+    if (count == 0 || count > max || length != ProtoRangePayloadSize(count))
+        return -1;
+    in += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        ranges[i].begin = ProtoGetU64(in);
+        ranges[i].end = ProtoGetU64(in + 8);
+        ranges[i].mod = ProtoGetU64(in + 16);
+        in += PROTO_RANGE_SIZE;
+    }
+    return (int)count;
+}
+
+size_t ProtoResultPayloadSize(uint32_t count) {
+    return sizeof(uint32_t) + (size_t)count * sizeof(uint64_t);
+}
+
+void ProtoEncodeResults(const uint64_t *results, uint32_t count, unsigned char *out) {
+    ProtoPutU32(out, count);
+    out += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++)
+        ProtoPutU64(out + i * sizeof(uint64_t), results[i]);
+}
+
+int ProtoDecodeResults(const unsigned char *in, size_t length, uint64_t *results, uint32_t max) {
+    if (length < sizeof(uint32_t))
+        return -1;
+    uint32_t count = ProtoGetU32(in);
+    if (count > max || length != ProtoResultPayloadSize(count))
+        return -1;
+    in += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++)
+        results[i] = ProtoGetU64(in + i * sizeof(uint64_t));
+    return (int)count;
+}
+
+size_t ProtoReducePayloadSize(uint32_t count) {
+    return sizeof(uint32_t) + (size_t)count * PROTO_REDUCE_SIZE;
+}
+
+void ProtoEncodeReductions(const struct ReduceArgs *reductions, uint32_t count,
+                           unsigned char *out) {
+    ProtoPutU32(out, count);
+    out += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct ReduceArgs *args = &reductions[i];
+        memset(out, 0, sizeof(uint64_t));
+        out[0] = (unsigned char)args->spec.op;
+        out[1] = (unsigned char)args->spec.generator;
+        ProtoPutU64(out + 8, args->spec.seed);
+        ProtoPutU64(out + 16, args->spec.bound);
+        ProtoPutU64(out + 24, args->spec.param);
+        ProtoPutU64(out + 32, args->begin);
+        ProtoPutU64(out + 40, args->end);
+        out += PROTO_REDUCE_SIZE;
+    }
+}
+
+int ProtoDecodeReductions(const unsigned char *in, size_t length, struct ReduceArgs *reductions,
+                          uint32_t max) {
+    if (length < sizeof(uint32_t))
+        return -1;
+    uint32_t count = ProtoGetU32(in);
+    if (count == 0 || count > max || length != ProtoReducePayloadSize(count))
+        return -1;
+    in += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        struct ReduceArgs *args = &reductions[i];
+        args->spec.op = (enum ReduceOp)in[0];
+        args->spec.generator = (enum ReduceGenerator)in[1];
+        args->spec.seed = ProtoGetU64(in + 8);
+        args->spec.bound = ProtoGetU64(in + 16);
+        args->spec.param = ProtoGetU64(in + 24);
+        args->begin = ProtoGetU64(in + 32);
+        args->end = ProtoGetU64(in + 40);
+        in += PROTO_REDUCE_SIZE;
+    }
+    return (int)count;
+}
+
+size_t ProtoWideResultPayloadSize(uint32_t count) {
+    return sizeof(uint32_t) + (size_t)count * PROTO_WIDE_RESULT_SIZE;
+}
+
+void ProtoEncodeWideResults(const unsigned __int128 *results, uint32_t count, unsigned char *out) {
+    ProtoPutU32(out, count);
+    out += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        ProtoPutU64(out, (uint64_t)(results[i] >> 64));
+        ProtoPutU64(out + 8, (uint64_t)results[i]);
+        out += PROTO_WIDE_RESULT_SIZE;
+    }
+}
+
+int ProtoDecodeWideResults(const unsigned char *in, size_t length, unsigned __int128 *results,
+                           uint32_t max) {
+    if (length < sizeof(uint32_t))
+        return -1;
+    uint32_t count = ProtoGetU32(in);
+    if (count > max || length != ProtoWideResultPayloadSize(count))
+        return -1;
+    in += sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        results[i] = (unsigned __int128)ProtoGetU64(in) << 64 | ProtoGetU64(in + 8);
+        in += PROTO_WIDE_RESULT_SIZE;
+    }
+    return (int)count;
+}
+
+size_t ProtoTreeSize(uint32_t child_count) {
+    return PROTO_TREE_HEADER_SIZE + (size_t)child_count * PROTO_TREE_NODE_SIZE;
+}
+
+void ProtoEncodeTree(const struct ProtoTree *tree, const struct ProtoNode *children,
+                     unsigned char *out) {
+    out[0] = tree->opcode;
+    out[1] = 0;
+    out[2] = (unsigned char)(tree->fanout >> 8);
+    out[3] = (unsigned char)tree->fanout;
+    ProtoPutU32(out + 4, tree->child_count);
+    out += PROTO_TREE_HEADER_SIZE;
+    for (uint32_t i = 0; i < tree->child_count; i++) {
+        ProtoPutU32(out, children[i].ip);
+        out[4] = (unsigned char)(children[i].port >> 8);
+        out[5] = (unsigned char)children[i].port;
+        out[6] = 0;
+        out[7] = 0;
+        out += PROTO_TREE_NODE_SIZE;
+    }
+}
+
+long ProtoDecodeTree(const unsigned char *in, size_t length, struct ProtoTree *tree,
+                     struct ProtoNode *children, uint32_t max) {
+    if (length < PROTO_TREE_HEADER_SIZE)
+        return -1;
+    tree->opcode = in[0];
+    tree->fanout = (uint16_t)((in[2] << 8) | in[3]);
+    tree->child_count = ProtoGetU32(in + 4);
+    if ((tree->opcode != PROTO_OP_RANGE && tree->opcode != PROTO_OP_REDUCE) ||
+        tree->fanout == 0 || tree->child_count > max ||
+        length < ProtoTreeSize(tree->child_count))
+        return -1;
+    in += PROTO_TREE_HEADER_SIZE;
+    for (uint32_t i = 0; i < tree->child_count; i++) {
+        children[i].ip = ProtoGetU32(in);
+        children[i].port = (uint16_t)((in[4] << 8) | in[5]);
+        in += PROTO_TREE_NODE_SIZE;
+    }
+    return (long)ProtoTreeSize(tree->child_count);
+}
+
+uint32_t ProtoTreeGroups(uint32_t count, uint32_t fanout) {
+    return count < fanout ? count : fanout;
+}
+
+void ProtoTreeGroup(uint32_t count, uint32_t fanout, uint32_t group, uint32_t *first,
+                    uint32_t *size) {
+    uint32_t groups = ProtoTreeGroups(count, fanout);
+    uint32_t base = count / groups;
+    uint32_t extra = count % groups;
+    *first = group * base + (group < extra ? group : extra);
+    *size = base + (group < extra ? 1 : 0);
+}
@@ -0,0 +1,162 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "reduce.h"
+
+// Протокол v1: запрос — три uint64_t (begin, end, mod) в порядке байтов
+// хоста, ответ — один uint64_t. Ответы идут строго в порядке запросов.
+#define PROTO_V1_REQUEST_SIZE (sizeof(uint64_t) * 3)
+#define PROTO_V1_RESPONSE_SIZE sizeof(uint64_t)
+
+// Протокол v2: кадры с заголовком, все числа big-endian.
+//   magic u32 | version u8 | opcode u8 | status u16 | length u32 | request_id u64
+// За заголовком length байт данных. Ответ несёт request_id запроса и может
+// прийти раньше ответов на более ранние запросы того же соединения.
+// Сервер отличает v1 от v2 по первым четырём байтам соединения: v1-запрос,
+// у которого младшие 32 бита begin совпадают с magic, будет принят за кадр v2.
+#define PROTO_MAGIC 0x46414332u     // "FAC2"
+#define PROTO_VERSION 2
+#define PROTO_HEADER_SIZE 20
+#define PROTO_MAX_RANGES 4096
+#define PROTO_RANGE_SIZE (sizeof(uint64_t) * 3)
+// Свёртка: op u8 | generator u8 | 6 байт нулей | seed | bound | param | begin | end
+#define PROTO_REDUCE_SIZE (sizeof(uint64_t) * 6)
+#define PROTO_MAX_REDUCTIONS 2048
+#define PROTO_WIDE_RESULT_SIZE (sizeof(uint64_t) * 2)
+#define PROTO_RETRY_AFTER_SIZE sizeof(uint32_t)
+#define PROTO_MAX_EXACT_RANGE (1ULL << 24)
+// Дерево: opcode u8 | 1 байт нулей | fanout u16 | count u32, затем count
+// узлов ip u32 | port u16 | 2 байта нулей
+#define PROTO_TREE_HEADER_SIZE (sizeof(uint32_t) * 2)
+#define PROTO_TREE_NODE_SIZE sizeof(uint64_t)
+#define PROTO_MAX_CHILDREN 4096
+#define PROTO_MAX_PAYLOAD                                                                   \
+    (PROTO_TREE_HEADER_SIZE + PROTO_MAX_CHILDREN * PROTO_TREE_NODE_SIZE + sizeof(uint32_t) + \
+     PROTO_MAX_RANGES * PROTO_RANGE_SIZE)
+
+// Режим UDP: датаграмма — ровно один кадр v2, ответ — одна датаграмма с
+// тем же request_id. Потерянные запросы клиент повторяет, ответы на повторы
+// отбрасывает по request_id.
+#define PROTO_MAX_DATAGRAM 65507
+
+enum ProtoOpcode {
+    // Запрос: count u32, затем count троек (begin, end, mod).
+    // Ответ: count u32, затем count произведений в том же порядке.
+    PROTO_OP_RANGE = 1,
+    // Запрос: count u32, затем count свёрток (PROTO_REDUCE_SIZE байт).
+    // Ответ: count u32, затем count 128-битных результатов (старшая половина
+    // первой).
+    PROTO_OP_REDUCE = 2,
+    // Запрос: заголовок дерева с opcode вложенного запроса (RANGE или REDUCE)
+    // и списком узлов поддерева, затем данные вложенного запроса. Сервер
+    // делит узлы на не больше чем fanout групп, отдаёт каждой группе долю
+    // диапазонов, пропорциональную её размеру (первый узел группы получает
+    // остальные как своё поддерево), и сворачивает их ответы со своей долей.
+    // Ответ: данные ответа вложенного opcode.
+    PROTO_OP_AGGREGATE = 3,
+    // Запрос без данных: отменить ещё не отвеченный запрос того же соединения
+    // (в UDP — того же отправителя) с этим request_id. На сам кадр ответа
+    // нет, отменённый запрос отвечает статусом PROTO_STATUS_CANCELLED.
+    PROTO_OP_CANCEL = 4,
+    // Запрос без данных, только первым кадром по unix-сокету сервера. Ответ
+    // без данных несёт в SCM_RIGHTS три дескриптора: память ShmChannel,
+    // eventfd сервера и eventfd клиента. Дальше кадры идут кольцами канала,
+    // а сокет остаётся открытым только как признак того, что клиент жив.
+    PROTO_OP_SHM_ATTACH = 5,
+    // Запрос: как у PROTO_OP_RANGE, один диапазон с mod = 0, 1 <= begin <=
+    // end и не длиннее PROTO_MAX_EXACT_RANGE чисел. Ответ: как у
+    // PROTO_OP_RANGE, но count — число 64-битных limbs точного произведения
+    // begin..end, младший первым. Только по TCP и unix-сокету.
+    PROTO_OP_EXACT = 6,
+};
+
+enum ProtoStatus {
+    PROTO_STATUS_OK = 0,
+    PROTO_STATUS_BAD_REQUEST = 1,   // некорректные данные кадра
+    PROTO_STATUS_UNSUPPORTED = 2,   // неизвестная версия или opcode
+    PROTO_STATUS_CANCELLED = 3,     // запрос отменён кадром PROTO_OP_CANCEL
+    // Сервер перегружен и запрос не принял. Данные: retry_after u32 —
+    // через сколько миллисекунд стоит обращаться к нему снова.
+    PROTO_STATUS_OVERLOADED = 4,
+};
+
+struct FrameHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t status;
+    uint32_t length;
+    uint64_t request_id;
+};
+
+// Узел дерева: IPv4-адрес и порт в порядке байтов хоста
+struct ProtoNode {
+    uint32_t ip;
+    uint16_t port;
+};
+
+struct ProtoTree {
+    uint8_t opcode;             // вложенный запрос
+    uint16_t fanout;
+    uint32_t child_count;
+};
+
+void ProtoPutU32(unsigned char *out, uint32_t value);
+void ProtoPutU64(unsigned char *out, uint64_t value);
+uint32_t ProtoGetU32(const unsigned char *in);
+uint64_t ProtoGetU64(const unsigned char *in);
+
+void ProtoEncodeHeader(const struct FrameHeader *header, unsigned char *out);
+void ProtoDecodeHeader(const unsigned char *in, struct FrameHeader *header);
+
+// Начало кадра v2? Нужны как минимум четыре байта.
+bool ProtoIsFrameStart(const unsigned char *in);
+
+// Данные запроса PROTO_OP_RANGE, out должен вмещать ProtoRangePayloadSize(count)
+size_t ProtoRangePayloadSize(uint32_t count);
+void ProtoEncodeRanges(const struct FactorialArgs *ranges, uint32_t count, unsigned char *out);
+// Возвращает число диапазонов или -1, если длина не сходится с count или
+// count вне [1, max]
+int ProtoDecodeRanges(const unsigned char *in, size_t length, struct FactorialArgs *ranges,
+                      uint32_t max);
+
+// Данные ответа PROTO_OP_RANGE
+size_t ProtoResultPayloadSize(uint32_t count);
+void ProtoEncodeResults(const uint64_t *results, uint32_t count, unsigned char *out);
+int ProtoDecodeResults(const unsigned char *in, size_t length, uint64_t *results, uint32_t max);
+
+// Данные запроса PROTO_OP_REDUCE. Декодирование не проверяет операцию и
+// генератор, для этого есть ReduceValid.
+size_t ProtoReducePayloadSize(uint32_t count);
+void ProtoEncodeReductions(const struct ReduceArgs *reductions, uint32_t count,
+                           unsigned char *out);
+int ProtoDecodeReductions(const unsigned char *in, size_t length, struct ReduceArgs *reductions,
+                          uint32_t max);
+
+// Данные ответа PROTO_OP_REDUCE
+size_t ProtoWideResultPayloadSize(uint32_t count);
+void ProtoEncodeWideResults(const unsigned __int128 *results, uint32_t count, unsigned char *out);
+int ProtoDecodeWideResults(const unsigned char *in, size_t length, unsigned __int128 *results,
+                           uint32_t max);
+
+// Заголовок дерева перед данными вложенного запроса PROTO_OP_AGGREGATE
+size_t ProtoTreeSize(uint32_t child_count);
+void ProtoEncodeTree(const struct ProtoTree *tree, const struct ProtoNode *children,
+                     unsigned char *out);
+// Возвращает длину заголовка дерева или -1, если данные короче, узлов
+// больше max, fanout равен нулю или opcode не RANGE и не REDUCE
+long ProtoDecodeTree(const unsigned char *in, size_t length, struct ProtoTree *tree,
+                     struct ProtoNode *children, uint32_t max);
+
+// count узлов делятся на min(fanout, count) идущих подряд групп, размеры
+// которых отличаются не больше чем на один
+uint32_t ProtoTreeGroups(uint32_t count, uint32_t fanout);
+void ProtoTreeGroup(uint32_t count, uint32_t fanout, uint32_t group, uint32_t *first,
+                    uint32_t *size);
+
+#endif
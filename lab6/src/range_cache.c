@@ -0,0 +1,324 @@
+#include "range_cache.h"
+
+#include <stdlib.h>
+
+#define NIL UINT32_MAX
+
+struct CacheEntry {
+    uint64_t mod;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t product;
+    uint32_t next_exact;
+    uint32_t next_begin;
+    uint32_t next_end;
+    bool referenced;        // бит CLOCK: к записи обращались с прошлого прохода стрелки
+};
+
+enum ChainKind { CHAIN_EXACT, CHAIN_BEGIN, CHAIN_END };
+
+static uint64_t Mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static size_t BucketOf(const struct RangeCache *cache, enum ChainKind kind, uint64_t mod,
+                       uint64_t begin, uint64_t end) {
+    uint64_t h = Mix(mod + (uint64_t)kind);
+    if (kind != CHAIN_END)
+        h = Mix(h ^ begin);
+    if (kind != CHAIN_BEGIN)
+        h = Mix(h ^ end);
+    return (size_t)(h & (cache->buckets - 1));
+}
+
+static uint32_t *ChainHead(struct RangeCache *cache, enum ChainKind kind,
+                           const struct CacheEntry *e) {
+    size_t bucket = BucketOf(cache, kind, e->mod, e->begin, e->end);
+    switch (kind) {
+    case CHAIN_EXACT:
+        return &cache->exact[bucket];
+    case CHAIN_BEGIN:
+        return &cache->by_begin[bucket];
+    default:
+        return &cache->by_end[bucket];
+    }
+}
+
+static uint32_t *NextOf(struct CacheEntry *e, enum ChainKind kind) {
+    switch (kind) {
+    case CHAIN_EXACT:
+        return &e->next_exact;
+    case CHAIN_BEGIN:
+        return &e->next_begin;
+    default:
+        return &e->next_end;
+    }
+}
+
+static void Link(struct RangeCache *cache, enum ChainKind kind, uint32_t index) {
+    struct CacheEntry *e = &cache->entries[index];
+    uint32_t *head = ChainHead(cache, kind, e);
+    *NextOf(e, kind) = *head;
+    *head = index;
+}
+
+static void Unlink(struct RangeCache *cache, enum ChainKind kind, uint32_t index) {
+    uint32_t *link = ChainHead(cache, kind, &cache->entries[index]);
+    while (*link != NIL) {
+        if (*link == index) {
+            *link = *NextOf(&cache->entries[index], kind);
+            return;
+        }
+        link = NextOf(&cache->entries[*link], kind);
+    }
+}
+
+int RangeCacheInit(struct RangeCache *cache, size_t budget_bytes) {
+    // На запись приходится сама запись и до двух корзин в каждом из трёх индексов
+    size_t per_entry = sizeof(struct CacheEntry) + 3 * 2 * sizeof(uint32_t);
+    size_t capacity = budget_bytes / per_entry;
+    if (capacity == 0)
+        return -1;
+    if (capacity >= NIL)
+        capacity = NIL - 1;
+
+    size_t buckets = 1;
+    while (buckets < capacity)
+        buckets <<= 1;
+
+    cache->capacity = capacity;
+    cache->used = 0;
+    cache->hand = 0;
+    cache->buckets = buckets;
+    cache->entries = malloc(sizeof(struct CacheEntry) * capacity);
+    cache->exact = malloc(sizeof(uint32_t) * buckets);
+    cache->by_begin = malloc(sizeof(uint32_t) * buckets);
+    cache->by_end = malloc(sizeof(uint32_t) * buckets);
+    if (cache->entries == NULL || cache->exact == NULL || cache->by_begin == NULL ||
+        cache->by_end == NULL) {
+        RangeCacheDestroy(cache);
+        return -1;
+    }
+    for (size_t i = 0; i < buckets; i++) {
+        cache->exact[i] = NIL;
+        cache->by_begin[i] = NIL;
+        cache->by_end[i] = NIL;
+    }
+
+    cache->stats = (struct RangeCacheStats){0};
+    cache->stats.capacity = capacity;
+    pthread_mutex_init(&cache->mutex, NULL);
+    return 0;
+}
+
+void RangeCacheDestroy(struct RangeCache *cache) {
+    free(cache->entries);
+    free(cache->exact);
+    free(cache->by_begin);
+    free(cache->by_end);
+    cache->entries = NULL;
+    cache->exact = NULL;
+    cache->by_begin = NULL;
+    cache->by_end = NULL;
+}
+
+static struct CacheEntry *FindExact(struct RangeCache *cache, uint64_t mod, uint64_t begin,
+                                    uint64_t end) {
+    uint32_t i = cache->exact[BucketOf(cache, CHAIN_EXACT, mod, begin, end)];
+    while (i != NIL) {
+        struct CacheEntry *e = &cache->entries[i];
+        if (e->mod == mod && e->begin == begin && e->end == end)
+            return e;
+        i = e->next_exact;
+    }
+    return NULL;
+}
+
+static void EmptyPlan(struct CachePlan *plan) {
+    plan->num = 1;
+    plan->den = 1;
+    plan->mul_begin = 1;
+    plan->mul_end = 0;
+    plan->div_begin = 1;
+    plan->div_end = 0;
+}
+
+bool RangeCacheLookup(struct RangeCache *cache, uint64_t mod, uint64_t begin, uint64_t end,
+                      bool prime, struct CachePlan *plan) {
+    if (begin > end)
+        return false;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    struct CacheEntry *exact = FindExact(cache, mod, begin, end);
+    if (exact != NULL) {
+        exact->referenced = true;
+        EmptyPlan(plan);
+        plan->num = exact->product;
+        cache->stats.hits++;
+        pthread_mutex_unlock(&cache->mutex);
+        return true;
+    }
+
+    // План принимается, только если досчитать нужно меньше половины диапазона
+    uint64_t best_cost = (end - begin) / 2;
+    struct CacheEntry *used[2] = {NULL, NULL};
+    bool found = false;
+
+    // Записи с тем же началом: дополнить до end или разделить на лишний хвост
+    uint32_t i = cache->by_begin[BucketOf(cache, CHAIN_BEGIN, mod, begin, 0)];
+    for (; i != NIL; i = cache->entries[i].next_begin) {
+        struct CacheEntry *e = &cache->entries[i];
+        if (e->mod != mod || e->begin != begin)
+            continue;
+        if (e->end < end && end - e->end < best_cost) {
+            best_cost = end - e->end;
+            EmptyPlan(plan);
+            plan->num = e->product;
+            plan->mul_begin = e->end + 1;
+            plan->mul_end = end;
+        } else if (e->end > end && prime && e->product != 0 && e->end - end < best_cost) {
+            best_cost = e->end - end;
+            EmptyPlan(plan);
+            plan->num = e->product;
+            plan->div_begin = end + 1;
+            plan->div_end = e->end;
+        } else {
+            continue;
+        }
+        used[0] = e;
+        used[1] = NULL;
+        found = true;
+    }
+
+    // Записи с тем же концом: дополнить слева или разделить на лишнее начало
+    i = cache->by_end[BucketOf(cache, CHAIN_END, mod, 0, end)];
+    for (; i != NIL; i = cache->entries[i].next_end) {
+        struct CacheEntry *e = &cache->entries[i];
+        if (e->mod != mod || e->end != end)
+            continue;
+        if (e->begin > begin && e->begin - begin < best_cost) {
+            best_cost = e->begin - begin;
+            EmptyPlan(plan);
+            plan->num = e->product;
+            plan->mul_begin = begin;
+            plan->mul_end = e->begin - 1;
+        } else if (e->begin < begin && prime && e->product != 0 && begin - e->begin < best_cost) {
+            best_cost = begin - e->begin;
+            EmptyPlan(plan);
+            plan->num = e->product;
+            plan->div_begin = e->begin;
+            plan->div_end = begin - 1;
+        } else {
+            continue;
+        }
+        used[0] = e;
+        used[1] = NULL;
+        found = true;
+    }
+
+    // Простой модуль: end! / (begin - 1)! через ближайшие закэшированные
+    // префиксы [1, x]. Имеет смысл, пока end < mod, иначе (begin - 1)! или
+    // end! обнуляются.
+    if (prime && begin > 1 && end < mod) {
+        struct CacheEntry *upper = NULL;
+        struct CacheEntry *lower = NULL;
+        i = cache->by_begin[BucketOf(cache, CHAIN_BEGIN, mod, 1, 0)];
+        for (; i != NIL; i = cache->entries[i].next_begin) {
+            struct CacheEntry *e = &cache->entries[i];
+            if (e->mod != mod || e->begin != 1)
+                continue;
+            if (e->end <= end && (upper == NULL || e->end > upper->end))
+                upper = e;
+            if (e->end <= begin - 1 && (lower == NULL || e->end > lower->end))
+                lower = e;
+        }
+
+        if (upper != NULL) {
+            uint64_t lower_end = lower != NULL ? lower->end : 0;
+            uint64_t cost = (end - upper->end) + (begin - 1 - lower_end);
+            if (cost < best_cost) {
+                EmptyPlan(plan);
+                plan->num = upper->product;
+                plan->den = lower != NULL ? lower->product : 1;
+                plan->mul_begin = upper->end + 1;
+                plan->mul_end = end;
+                plan->div_begin = lower_end + 1;
+                plan->div_end = begin - 1;
+                used[0] = upper;
+                used[1] = lower;
+                found = true;
+            }
+        }
+    }
+
+    if (found) {
+        for (int k = 0; k < 2; k++) {
+            if (used[k] != NULL)
+                used[k]->referenced = true;
+        }
+        cache->stats.partial_hits++;
+    } else {
+        cache->stats.misses++;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+void RangeCacheInsert(struct RangeCache *cache, uint64_t mod, uint64_t begin, uint64_t end,
+                      uint64_t product) {
+    if (begin > end || end - begin + 1 < RANGE_CACHE_MIN_RANGE)
+        return;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    struct CacheEntry *existing = FindExact(cache, mod, begin, end);
+    if (existing != NULL) {
+        existing->referenced = true;
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+
+    uint32_t index;
+    if (cache->used < cache->capacity) {
+        index = (uint32_t)cache->used++;
+    } else {
+        // CLOCK: пропускаем записи со свежим обращением, сбрасывая им бит
+        while (cache->entries[cache->hand].referenced) {
+            cache->entries[cache->hand].referenced = false;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+        }
+        index = (uint32_t)cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+
+        Unlink(cache, CHAIN_EXACT, index);
+        Unlink(cache, CHAIN_BEGIN, index);
+        Unlink(cache, CHAIN_END, index);
+        cache->stats.evictions++;
+    }
+
+    struct CacheEntry *e = &cache->entries[index];
+    e->mod = mod;
+    e->begin = begin;
+    e->end = end;
+    e->product = product;
+    e->referenced = false;
+    Link(cache, CHAIN_EXACT, index);
+    Link(cache, CHAIN_BEGIN, index);
+    Link(cache, CHAIN_END, index);
+    cache->stats.inserts++;
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void RangeCacheGetStats(struct RangeCache *cache, struct RangeCacheStats *stats) {
+    pthread_mutex_lock(&cache->mutex);
+    *stats = cache->stats;
+    stats->entries = cache->used;
+    pthread_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,67 @@
+#ifndef RANGE_CACHE_H
+#define RANGE_CACHE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Диапазоны короче этого не кэшируются: их дешевле пересчитать
+#define RANGE_CACHE_MIN_RANGE 4096
+
+// Как получить произведение [begin, end] из закэшированных значений:
+// result = num * P(mul_begin, mul_end) / (den * P(div_begin, div_end)).
+// Пустой диапазон (begin > end) даёт P = 1. Деление используется только для
+// простого модуля и только если делитель не кратен модулю.
+struct CachePlan {
+    uint64_t num;
+    uint64_t den;
+    uint64_t mul_begin;
+    uint64_t mul_end;
+    uint64_t div_begin;
+    uint64_t div_end;
+};
+
+struct RangeCacheStats {
+    uint64_t hits;          // точные попадания
+    uint64_t partial_hits;  // ответ собран из закэшированных частей
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    size_t entries;
+    size_t capacity;
+};
+
+struct CacheEntry;
+
+// Кэш (mod, begin, end) -> произведение с вытеснением CLOCK. Потокобезопасен.
+struct RangeCache {
+    struct CacheEntry *entries;
+    size_t capacity;
+    size_t used;
+    size_t hand;            // стрелка CLOCK
+    uint32_t *exact;        // головы цепочек по (mod, begin, end)
+    uint32_t *by_begin;     // по (mod, begin)
+    uint32_t *by_end;       // по (mod, end)
+    size_t buckets;
+    struct RangeCacheStats stats;
+    pthread_mutex_t mutex;
+};
+
+// budget_bytes — ограничение памяти под записи и индексы. Возвращает -1,
+// если в бюджет не помещается ни одной записи.
+int RangeCacheInit(struct RangeCache *cache, size_t budget_bytes);
+void RangeCacheDestroy(struct RangeCache *cache);
+
+// Ищет точное значение или план досчёта, который дешевле полного диапазона.
+// prime — простой ли модуль (разрешает деление).
+// Возвращает false при промахе.
+bool RangeCacheLookup(struct RangeCache *cache, uint64_t mod, uint64_t begin, uint64_t end,
+                      bool prime, struct CachePlan *plan);
+
+void RangeCacheInsert(struct RangeCache *cache, uint64_t mod, uint64_t begin, uint64_t end,
+                      uint64_t product);
+
+void RangeCacheGetStats(struct RangeCache *cache, struct RangeCacheStats *stats);
+
+#endif
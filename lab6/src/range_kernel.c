@@ -0,0 +1,228 @@
+#include "range_kernel.h"
+
+#include <immintrin.h>
+
+// Короче этого диапазона распараллеливание по линиям не окупается
+#define LANES_MIN_RANGE 256
+
+#define SCALAR_LANES 8
+#define AVX2_VECTORS 4
+#define AVX2_LANES (AVX2_VECTORS * 4)
+#define IFMA_VECTORS 4
+#define IFMA_LANES (IFMA_VECTORS * 8)
+
+// x + step по модулю mod без переполнения, x < mod, step < mod
+static inline uint64_t AddStep(uint64_t x, uint64_t step, uint64_t mod) {
+    return x >= mod - step ? x - (mod - step) : x + step;
+}
+
+// Хвост диапазона, не кратный числу линий, и свёртка линий — обычными умножениями
+static uint64_t FinishLanes(const struct ModContext *ctx, const uint64_t *acc, int lanes,
+                            uint64_t tail_begin, uint64_t end) {
+    uint64_t result = acc[0];
+    for (int j = 1; j < lanes; j++)
+        result = ModMul(ctx, result, acc[j]);
+    if (tail_begin <= end)
+        result = ModMul(ctx, result, ModRangeProduct(ctx, tail_begin, end));
+    return result;
+}
+
+static uint64_t ScalarLanes(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    uint64_t mod = ctx->mod;
+    uint64_t rounds = (end - begin + 1) / SCALAR_LANES;
+    uint64_t acc[SCALAR_LANES];
+    uint64_t x[SCALAR_LANES];
+
+    for (int j = 0; j < SCALAR_LANES; j++) {
+        acc[j] = 1;
+        x[j] = (begin + j) % mod;
+    }
+
+    if (ctx->kind == MOD_KIND_BARRETT) {
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (int j = 0; j < SCALAR_LANES; j++) {
+                acc[j] = ModMulBarrett(ctx, acc[j], x[j]);
+                x[j] = AddStep(x[j], SCALAR_LANES, mod);
+            }
+        }
+    } else if (ctx->kind == MOD_KIND_WIDE) {
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (int j = 0; j < SCALAR_LANES; j++) {
+                acc[j] = ModMulWide(acc[j], x[j], mod);
+                x[j] = AddStep(x[j], SCALAR_LANES, mod);
+            }
+        }
+    } else {
+        // Нечётный модуль: каждое умножение Монтгомери вносит 2^-64,
+        // компенсируем один раз после свёртки
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (int j = 0; j < SCALAR_LANES; j++) {
+                acc[j] = MontMul(ctx, acc[j], x[j]);
+                x[j] = AddStep(x[j], SCALAR_LANES, mod);
+            }
+        }
+        acc[0] = ModMul(ctx, acc[0], ModPow(ctx, ctx->mont_r, rounds * SCALAR_LANES));
+    }
+
+    return FinishLanes(ctx, acc, SCALAR_LANES, begin + rounds * SCALAR_LANES, end);
+}
+
+// Умножение Монтгомери в 64-битных линиях со значениями < mod < 2^32, R = 2^32
+__attribute__((target("avx2")))
+static inline __m256i MontMulAvx2(__m256i a, __m256i b, __m256i mod, __m256i inv) {
+    __m256i t = _mm256_mul_epu32(a, b);
+    __m256i m = _mm256_mul_epu32(t, inv);
+    __m256i mn = _mm256_mul_epu32(m, mod);
+    __m256i r = _mm256_sub_epi64(_mm256_srli_epi64(t, 32), _mm256_srli_epi64(mn, 32));
+    __m256i negative = _mm256_cmpgt_epi64(_mm256_setzero_si256(), r);
+    return _mm256_add_epi64(r, _mm256_and_si256(negative, mod));
+}
+
+__attribute__((target("avx2")))
+static uint64_t Avx2Lanes(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    uint64_t mod = ctx->mod;
+    uint64_t rounds = (end - begin + 1) / AVX2_LANES;
+    uint64_t init[AVX2_LANES];
+
+    for (int j = 0; j < AVX2_LANES; j++)
+        init[j] = (begin + j) % mod;
+
+    __m256i vmod = _mm256_set1_epi64x((long long)mod);
+    __m256i vinv = _mm256_set1_epi64x((long long)(uint32_t)ctx->mont_inv);
+    __m256i vstep = _mm256_set1_epi64x(AVX2_LANES % mod);
+    __m256i acc[AVX2_VECTORS];
+    __m256i x[AVX2_VECTORS];
+    for (int v = 0; v < AVX2_VECTORS; v++) {
+        acc[v] = _mm256_set1_epi64x(1);
+        x[v] = _mm256_loadu_si256((const __m256i *)&init[v * 4]);
+    }
+
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (int v = 0; v < AVX2_VECTORS; v++) {
+            acc[v] = MontMulAvx2(acc[v], x[v], vmod, vinv);
+            // x + step, если вышли за mod — вычитаем mod
+            __m256i next = _mm256_add_epi64(x[v], vstep);
+            __m256i below = _mm256_cmpgt_epi64(vmod, next);
+            x[v] = _mm256_sub_epi64(next, _mm256_andnot_si256(below, vmod));
+        }
+    }
+
+    uint64_t lanes[AVX2_LANES];
+    for (int v = 0; v < AVX2_VECTORS; v++)
+        _mm256_storeu_si256((__m256i *)&lanes[v * 4], acc[v]);
+
+    uint64_t r32 = (1ULL << 32) % mod;
+    lanes[0] = ModMul(ctx, lanes[0], ModPow(ctx, r32, rounds * AVX2_LANES));
+    return FinishLanes(ctx, lanes, AVX2_LANES, begin + rounds * AVX2_LANES, end);
+}
+
+// Умножение Монтгомери на IFMA, значения < mod < 2^52, R = 2^52
+__attribute__((target("avx512f,avx512ifma")))
+static inline __m512i MontMulIfma(__m512i a, __m512i b, __m512i mod, __m512i inv) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo = _mm512_madd52lo_epu64(zero, a, b);
+    __m512i hi = _mm512_madd52hi_epu64(zero, a, b);
+    __m512i m = _mm512_madd52lo_epu64(zero, lo, inv);
+    __m512i mn_hi = _mm512_madd52hi_epu64(zero, m, mod);
+    __m512i r = _mm512_sub_epi64(hi, mn_hi);
+    __mmask8 negative = _mm512_cmplt_epi64_mask(r, zero);
+    return _mm512_mask_add_epi64(r, negative, r, mod);
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static uint64_t IfmaLanes(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    uint64_t mod = ctx->mod;
+    uint64_t rounds = (end - begin + 1) / IFMA_LANES;
+    uint64_t init[IFMA_LANES];
+
+    for (int j = 0; j < IFMA_LANES; j++)
+        init[j] = (begin + j) % mod;
+
+    __m512i vmod = _mm512_set1_epi64((long long)mod);
+    __m512i vinv = _mm512_set1_epi64((long long)(ctx->mont_inv & ((1ULL << 52) - 1)));
+    __m512i vstep = _mm512_set1_epi64(IFMA_LANES % mod);
+    __m512i acc[IFMA_VECTORS];
+    __m512i x[IFMA_VECTORS];
+    for (int v = 0; v < IFMA_VECTORS; v++) {
+        acc[v] = _mm512_set1_epi64(1);
+        x[v] = _mm512_loadu_si512(&init[v * 8]);
+    }
+
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (int v = 0; v < IFMA_VECTORS; v++) {
+            acc[v] = MontMulIfma(acc[v], x[v], vmod, vinv);
+            __m512i next = _mm512_add_epi64(x[v], vstep);
+            __mmask8 wrapped = _mm512_cmpge_epu64_mask(next, vmod);
+            x[v] = _mm512_mask_sub_epi64(next, wrapped, next, vmod);
+        }
+    }
+
+    uint64_t lanes[IFMA_LANES];
+    for (int v = 0; v < IFMA_VECTORS; v++)
+        _mm512_storeu_si512(&lanes[v * 8], acc[v]);
+
+    uint64_t r52 = (1ULL << 52) % mod;
+    lanes[0] = ModMul(ctx, lanes[0], ModPow(ctx, r52, rounds * IFMA_LANES));
+    return FinishLanes(ctx, lanes, IFMA_LANES, begin + rounds * IFMA_LANES, end);
+}
+
+bool RangeKernelSupported(enum RangeKernel kernel, uint64_t mod) {
+    bool odd = mod % 2 == 1 && mod > 1;
+    switch (kernel) {
+    case RANGE_KERNEL_SERIAL:
+    case RANGE_KERNEL_SCALAR_LANES:
+        return true;
+    case RANGE_KERNEL_AVX2:
+        return odd && mod < (1ULL << 32) && __builtin_cpu_supports("avx2");
+    case RANGE_KERNEL_AVX512_IFMA:
+        return odd && mod < (1ULL << 52) && __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512ifma");
+    }
+    return false;
+}
+
+const char *RangeKernelName(enum RangeKernel kernel) {
+    switch (kernel) {
+    case RANGE_KERNEL_SERIAL:
+        return "serial";
+    case RANGE_KERNEL_SCALAR_LANES:
+        return "scalar-lanes";
+    case RANGE_KERNEL_AVX2:
+        return "avx2";
+    case RANGE_KERNEL_AVX512_IFMA:
+        return "avx512-ifma";
+    }
+    return "unknown";
+}
+
+uint64_t RangeProductWith(enum RangeKernel kernel, const struct ModContext *ctx,
+                          uint64_t begin, uint64_t end) {
+    if (begin > end)
+        return 1;
+    // Среди mod подряд идущих чисел обязательно есть кратное mod
+    if (end - begin >= ctx->mod - 1)
+        return 0;
+    if (kernel == RANGE_KERNEL_SERIAL || end - begin < LANES_MIN_RANGE)
+        return ModRangeProduct(ctx, begin, end);
+
+    if (!RangeKernelSupported(kernel, ctx->mod))
+        kernel = RANGE_KERNEL_SCALAR_LANES;
+
+    switch (kernel) {
+    case RANGE_KERNEL_AVX2:
+        return Avx2Lanes(ctx, begin, end);
+    case RANGE_KERNEL_AVX512_IFMA:
+        return IfmaLanes(ctx, begin, end);
+    default:
+        return ScalarLanes(ctx, begin, end);
+    }
+}
+
+uint64_t RangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t end) {
+    enum RangeKernel kernel = RANGE_KERNEL_SCALAR_LANES;
+    if (RangeKernelSupported(RANGE_KERNEL_AVX512_IFMA, ctx->mod))
+        kernel = RANGE_KERNEL_AVX512_IFMA;
+    else if (RangeKernelSupported(RANGE_KERNEL_AVX2, ctx->mod))
+        kernel = RANGE_KERNEL_AVX2;
+    return RangeProductWith(kernel, ctx, begin, end);
+}
@@ -0,0 +1,32 @@
+#ifndef RANGE_KERNEL_H
+#define RANGE_KERNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "modarith.h"
+
+// Реализации произведения диапазона. Все, кроме RANGE_KERNEL_SERIAL, делят
+// диапазон между независимыми чередующимися аккумуляторами, чтобы цепочка
+// умножений не упиралась в задержку одного умножителя.
+enum RangeKernel {
+    RANGE_KERNEL_SERIAL,       // одна цепочка ModRangeProduct
+    RANGE_KERNEL_SCALAR_LANES, // 8 скалярных аккумуляторов, любой mod
+    RANGE_KERNEL_AVX2,         // 16 линий Монтгомери с R = 2^32, нечётный mod < 2^32
+    RANGE_KERNEL_AVX512_IFMA,  // 32 линии Монтгомери с R = 2^52, нечётный mod < 2^52
+};
+
+// Поддерживает ли процессор ядро и подходит ли ему модуль
+bool RangeKernelSupported(enum RangeKernel kernel, uint64_t mod);
+
+const char *RangeKernelName(enum RangeKernel kernel);
+
+// Произведение [begin, end] по модулю выбранным ядром. Если ядро не поддерживается,
+// используется RANGE_KERNEL_SCALAR_LANES.
+uint64_t RangeProductWith(enum RangeKernel kernel, const struct ModContext *ctx,
+                          uint64_t begin, uint64_t end);
+
+// Произведение [begin, end] по модулю самым быстрым доступным ядром
+uint64_t RangeProduct(const struct ModContext *ctx, uint64_t begin, uint64_t end);
+
+#endif
@@ -0,0 +1,183 @@
+#include "reduce.h"
+
+#include <string.h>
+
+#include "common.h"
+#include "modarith.h"
+
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+static const char *OP_NAMES[] = {NULL, "sum", "min", "max", "product", "count"};
+static const char *GENERATOR_NAMES[] = {"index", "random"};
+
+bool ReduceValid(const struct ReduceSpec *spec) {
+    if (spec->op < REDUCE_SUM || spec->op > REDUCE_COUNT)
+        return false;
+    if (spec->generator != REDUCE_GEN_INDEX && spec->generator != REDUCE_GEN_RANDOM)
+        return false;
+    return spec->op != REDUCE_PRODUCT || spec->param != 0;
+}
+
+bool ReduceParseOp(const char *name, enum ReduceOp *op) {
+    for (int i = REDUCE_SUM; i <= REDUCE_COUNT; i++) {
+        if (strcmp(name, OP_NAMES[i]) == 0) {
+            *op = (enum ReduceOp)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ReduceParseGenerator(const char *name, enum ReduceGenerator *generator) {
+    for (int i = REDUCE_GEN_INDEX; i <= REDUCE_GEN_RANDOM; i++) {
+        if (strcmp(name, GENERATOR_NAMES[i]) == 0) {
+            *generator = (enum ReduceGenerator)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *ReduceOpName(enum ReduceOp op) {
+    return op >= REDUCE_SUM && op <= REDUCE_COUNT ? OP_NAMES[op] : "unknown";
+}
+
+const char *ReduceGeneratorName(enum ReduceGenerator generator) {
+    return generator <= REDUCE_GEN_RANDOM ? GENERATOR_NAMES[generator] : "unknown";
+}
+
+// Элемент i — выход SplitMix64 на шаге i, поэтому любой узел получает его
+// без предыдущих. При bound != 0 значение масштабируется в [0, bound)
+// умножением, без деления.
+static inline uint64_t RandomValue(uint64_t seed, uint64_t bound, uint64_t index) {
+    uint64_t z = seed + (index + 1) * GOLDEN_GAMMA;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return bound ? (uint64_t)(((unsigned __int128)z * bound) >> 64) : z;
+}
+
+uint64_t ReduceValue(const struct ReduceSpec *spec, uint64_t index) {
+    if (spec->generator == REDUCE_GEN_INDEX)
+        return index;
+    return RandomValue(spec->seed, spec->bound, index);
+}
+
+unsigned __int128 ReduceIdentity(const struct ReduceSpec *spec) {
+    switch (spec->op) {
+    case REDUCE_MIN:
+        return UINT64_MAX;
+    case REDUCE_PRODUCT:
+        return 1 % spec->param;
+    default:
+        return 0;
+    }
+}
+
+unsigned __int128 ReduceCombine(const struct ReduceSpec *spec, unsigned __int128 a,
+                                unsigned __int128 b) {
+    switch (spec->op) {
+    case REDUCE_MIN:
+        return a < b ? a : b;
+    case REDUCE_MAX:
+        return a > b ? a : b;
+    case REDUCE_PRODUCT:
+        return ModMulWide((uint64_t)a % spec->param, (uint64_t)b % spec->param, spec->param);
+    default:
+        return a + b;
+    }
+}
+
+// Свёртка x_i = i без перебора
+static unsigned __int128 ReduceIndex(const struct ReduceArgs *args) {
+    uint64_t begin = args->begin;
+    uint64_t end = args->end;
+    uint64_t param = args->spec.param;
+    unsigned __int128 count = (unsigned __int128)(end - begin) + 1;
+    switch (args->spec.op) {
+    case REDUCE_MIN:
+        return begin;
+    case REDUCE_MAX:
+        return end;
+    case REDUCE_COUNT:
+        if (param == 0)
+            return count;
+        if (param <= begin)
+            return 0;
+        return (unsigned __int128)((end < param - 1 ? end : param - 1) - begin) + 1;
+    case REDUCE_PRODUCT: {
+        if (begin == 0)
+            return 0;
+        struct FactorialArgs factorial = {begin, end, param};
+        return Factorial(&factorial);
+    }
+    default: {
+        // Одно из двух чётное, и произведение не выходит за 2^128
+        unsigned __int128 ends = (unsigned __int128)begin + end;
+        return count % 2 == 0 ? count / 2 * ends : count * (ends / 2);
+    }
+    }
+}
+
+// Цикл до end включительно, без переполнения при end = UINT64_MAX
+#define FOR_EACH_VALUE(args, x, body)                                                       \
+    for (uint64_t i = (args)->begin;; i++) {                                                \
+        uint64_t x = RandomValue((args)->spec.seed, (args)->spec.bound, i);                 \
+        body;                                                                               \
+        if (i == (args)->end)                                                               \
+            break;                                                                          \
+    }
+
+unsigned __int128 Reduce(const struct ReduceArgs *args) {
+    const struct ReduceSpec *spec = &args->spec;
+    if (args->begin > args->end)
+        return ReduceIdentity(spec);
+    if (spec->generator == REDUCE_GEN_INDEX)
+        return ReduceIndex(args);
+
+    // Для каждой операции свой цикл: ветвление по операции не попадает внутрь
+    switch (spec->op) {
+    case REDUCE_MIN: {
+        uint64_t min = UINT64_MAX;
+        FOR_EACH_VALUE(args, x, min = x < min ? x : min);
+        return min;
+    }
+    case REDUCE_MAX: {
+        uint64_t max = 0;
+        FOR_EACH_VALUE(args, x, max = x > max ? x : max);
+        return max;
+    }
+    case REDUCE_COUNT: {
+        if (spec->param == 0)
+            return (unsigned __int128)(args->end - args->begin) + 1;
+        uint64_t count = 0;
+        FOR_EACH_VALUE(args, x, count += x < spec->param);
+        return count;
+    }
+    case REDUCE_PRODUCT: {
+        uint64_t product = 1 % spec->param;
+        FOR_EACH_VALUE(args, x, product = ModMulWide(product, x, spec->param));
+        return product;
+    }
+    default: {
+        unsigned __int128 sum = 0;
+        FOR_EACH_VALUE(args, x, sum += x);
+        return sum;
+    }
+    }
+}
+
+void ReduceFormat(unsigned __int128 value, char *out, size_t size) {
+    char digits[40];
+    int length = 0;
+    do {
+        digits[length++] = (char)('0' + (int)(value % 10));
+        value /= 10;
+    } while (value > 0);
+
+    size_t written = 0;
+    while (length > 0 && written + 1 < size)
+        out[written++] = digits[--length];
+    if (size > 0)
+        out[written] = '\0';
+}
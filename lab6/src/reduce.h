@@ -0,0 +1,63 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Ассоциативные свёртки над данными, которые каждый узел порождает сам по
+// (seed, индекс), поэтому по сети передаются только диапазоны индексов.
+// Значения элементов 64-битные, результат — 128-битный (сумма не
+// переполняется), у остальных операций он помещается в 64 бита.
+enum ReduceOp {
+    REDUCE_SUM = 1,
+    REDUCE_MIN = 2,
+    REDUCE_MAX = 3,
+    REDUCE_PRODUCT = 4,         // произведение по модулю param
+    REDUCE_COUNT = 5,           // сколько элементов меньше param, 0 — все
+};
+
+enum ReduceGenerator {
+    REDUCE_GEN_INDEX = 0,       // x_i = i
+    REDUCE_GEN_RANDOM = 1,      // x_i = SplitMix64(seed, i), при bound != 0 в [0, bound)
+};
+
+struct ReduceSpec {
+    enum ReduceOp op;
+    enum ReduceGenerator generator;
+    uint64_t seed;
+    uint64_t bound;
+    uint64_t param;
+};
+
+// Свёртка элементов с индексами [begin, end]
+struct ReduceArgs {
+    uint64_t begin;
+    uint64_t end;
+    struct ReduceSpec spec;
+};
+
+bool ReduceValid(const struct ReduceSpec *spec);
+
+bool ReduceParseOp(const char *name, enum ReduceOp *op);
+bool ReduceParseGenerator(const char *name, enum ReduceGenerator *generator);
+const char *ReduceOpName(enum ReduceOp op);
+const char *ReduceGeneratorName(enum ReduceGenerator generator);
+
+// Значение элемента index
+uint64_t ReduceValue(const struct ReduceSpec *spec, uint64_t index);
+
+// Результат пустого диапазона: a = ReduceCombine(spec, a, identity)
+unsigned __int128 ReduceIdentity(const struct ReduceSpec *spec);
+
+unsigned __int128 ReduceCombine(const struct ReduceSpec *spec, unsigned __int128 a,
+                                unsigned __int128 b);
+
+// Для x_i = i сумма, минимум, максимум и счёт считаются по формуле, а
+// произведение — через Factorial()
+unsigned __int128 Reduce(const struct ReduceArgs *args);
+
+// Десятичная запись, out вмещает 40 символов
+void ReduceFormat(unsigned __int128 value, char *out, size_t size);
+
+#endif
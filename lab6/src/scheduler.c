@@ -0,0 +1,439 @@
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void SchedulerInit(struct Scheduler *scheduler, uint64_t begin, uint64_t end,
+                   const struct ReduceSpec *spec, int server_count, double target_seconds) {
+    scheduler->next = begin;
+    scheduler->end = end;
+    scheduler->exhausted = begin > end;
+    scheduler->spec = *spec;
+    scheduler->value = ReduceIdentity(spec);
+    scheduler->covered = 0;
+    scheduler->total = begin > end ? 0 : end - begin + 1;
+    scheduler->min_chunk = SCHEDULER_MIN_CHUNK;
+    scheduler->target_seconds = target_seconds;
+    scheduler->rates = calloc((size_t)server_count, sizeof(struct ServerRate));
+    scheduler->server_count = server_count;
+    scheduler->live_servers = server_count;
+    scheduler->records = NULL;
+    scheduler->record_count = 0;
+    scheduler->record_cap = 0;
+    scheduler->retry = NULL;
+    scheduler->retry_count = 0;
+    scheduler->retried = 0;
+    scheduler->speculated = 0;
+    scheduler->duplicates = 0;
+    scheduler->verify = NULL;
+    scheduler->verify_count = 0;
+    scheduler->verify_pending = 0;
+    scheduler->verify_skipped = 0;
+    scheduler->discrepancies = NULL;
+    scheduler->checked = 0;
+    scheduler->discrepancy_count = 0;
+    scheduler->discrepancy_cap = 0;
+    pthread_mutex_init(&scheduler->mutex, NULL);
+}
+
+void SchedulerDestroy(struct Scheduler *scheduler) {
+    free(scheduler->records);
+    free(scheduler->retry);
+    free(scheduler->verify);
+    free(scheduler->discrepancies);
+    free(scheduler->rates);
+    pthread_mutex_destroy(&scheduler->mutex);
+}
+
+// Средняя скорость измеренных живых серверов, 0 если замеров нет.
+// Функции ниже вызываются под мьютексом.
+static double AverageRate(const struct Scheduler *scheduler, int *measured) {
+    double sum = 0;
+    *measured = 0;
+    for (int i = 0; i < scheduler->server_count; i++) {
+        const struct ServerRate *rate = &scheduler->rates[i];
+        if (rate->measured && !rate->failed) {
+            sum += rate->rate;
+            (*measured)++;
+        }
+    }
+    return *measured > 0 ? sum / *measured : 0;
+}
+
+static double OwnRate(const struct Scheduler *scheduler, int server) {
+    int measured;
+    if (scheduler->rates[server].measured)
+        return scheduler->rates[server].rate;
+    return AverageRate(scheduler, &measured);
+}
+
+// Сколько сервер будет считать numbers чисел. Без замеров — пробный кусок
+// принимается за несколько target_seconds.
+static double ExpectedSeconds(const struct Scheduler *scheduler, int server, uint64_t numbers) {
+    double rate = OwnRate(scheduler, server);
+    if (rate <= 0)
+        return scheduler->target_seconds * 4;
+    return (double)numbers / rate;
+}
+
+static uint64_t ChunkSize(const struct Scheduler *scheduler, int server) {
+    uint64_t remaining = scheduler->end - scheduler->next + 1;
+    int measured;
+    double average = AverageRate(scheduler, &measured);
+
+    double size;
+    double share;
+    if (measured == 0) {
+        // Первые куски — пробные, 1/16 равной доли
+        size = (double)scheduler->total / scheduler->live_servers / 16;
+        if (size > SCHEDULER_PROBE_CHUNK)
+            size = SCHEDULER_PROBE_CHUNK;
+        share = 1.0 / scheduler->live_servers;
+    } else {
+        double own = OwnRate(scheduler, server);
+        size = own * scheduler->target_seconds;
+        share = own / (average * scheduler->live_servers);
+    }
+
+    // Хвост делится по долям скорости, чтобы медленный сервер не взял
+    // последний большой кусок
+    double tail = (double)remaining * share;
+    if (size > tail)
+        size = tail;
+    uint64_t chunk = size < (double)scheduler->min_chunk ? scheduler->min_chunk : (uint64_t)size;
+    return chunk < remaining ? chunk : remaining;
+}
+
+static uint32_t AddRecord(struct Scheduler *scheduler, uint64_t begin, uint64_t end) {
+    if (scheduler->record_count == scheduler->record_cap) {
+        scheduler->record_cap = scheduler->record_cap == 0 ? 64 : scheduler->record_cap * 2;
+        scheduler->records = realloc(scheduler->records,
+                                     sizeof(struct ChunkRecord) * scheduler->record_cap);
+        scheduler->retry = realloc(scheduler->retry, sizeof(uint32_t) * scheduler->record_cap);
+        scheduler->verify = realloc(scheduler->verify, sizeof(uint32_t) * scheduler->record_cap);
+    }
+    struct ChunkRecord *record = &scheduler->records[scheduler->record_count];
+    record->args.begin = begin;
+    record->args.end = end;
+    record->args.mod = scheduler->spec.param;
+    record->copies = 0;
+    record->done = false;
+    record->solver = -1;
+    record->verify = VERIFY_NONE;
+    return scheduler->record_count++;
+}
+
+// Кусок, копия которого на этом сервере, вероятно, придёт раньше оригинала.
+// Для просроченного куска считается, что оригинал досчитается не раньше,
+// чем через столько же, сколько уже идёт.
+static bool FindSpeculative(struct Scheduler *scheduler, int server, double now,
+                            uint32_t *index) {
+    double best_gain = 0;
+    bool found = false;
+    for (uint32_t i = 0; i < scheduler->record_count; i++) {
+        struct ChunkRecord *record = &scheduler->records[i];
+        if (record->done || record->copies != 1 || record->server == server)
+            continue;
+        double original = record->expected;
+        if (original < now)
+            original = now + (now - record->started);
+        uint64_t numbers = record->args.end - record->args.begin + 1;
+        double gain = original - (now + ExpectedSeconds(scheduler, server, numbers));
+        if (gain > best_gain) {
+            best_gain = gain;
+            *index = i;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Проверить кусок может любой живой сервер, кроме посчитавшего
+static bool CanVerify(const struct Scheduler *scheduler, const struct ChunkRecord *record) {
+    for (int i = 0; i < scheduler->server_count; i++) {
+        if (i != record->solver && !scheduler->rates[i].failed)
+            return true;
+    }
+    return false;
+}
+
+static bool TakeVerification(struct Scheduler *scheduler, int server, uint32_t *index) {
+    for (uint32_t i = 0; i < scheduler->verify_count; i++) {
+        if (scheduler->records[scheduler->verify[i]].solver != server) {
+            *index = scheduler->verify[i];
+            scheduler->verify[i] = scheduler->verify[--scheduler->verify_count];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void AddDiscrepancy(struct Scheduler *scheduler, uint32_t index, int server_b,
+                           unsigned __int128 result_b) {
+    struct ChunkRecord *record = &scheduler->records[index];
+    if (scheduler->discrepancy_count == scheduler->discrepancy_cap) {
+        scheduler->discrepancy_cap = scheduler->discrepancy_cap ? 2 * scheduler->discrepancy_cap : 8;
+        scheduler->discrepancies = realloc(scheduler->discrepancies,
+                                           sizeof(struct Discrepancy) * scheduler->discrepancy_cap);
+    }
+    struct Discrepancy *discrepancy = &scheduler->discrepancies[scheduler->discrepancy_count++];
+    discrepancy->index = index;
+    discrepancy->server_a = record->solver;
+    discrepancy->result_a = record->result;
+    discrepancy->server_b = server_b;
+    discrepancy->result_b = result_b;
+    scheduler->rates[record->solver].mismatched++;
+    if (server_b >= 0)
+        scheduler->rates[server_b].mismatched++;
+}
+
+// Сверяет второй результат куска с засчитанным
+static void CompareResult(struct Scheduler *scheduler, uint32_t index, int server,
+                          unsigned __int128 result) {
+    struct ChunkRecord *record = &scheduler->records[index];
+    scheduler->checked++;
+    scheduler->rates[record->solver].checked++;
+    if (server >= 0)
+        scheduler->rates[server].checked++;
+    if (result != record->result)
+        AddDiscrepancy(scheduler, index, server, result);
+}
+
+static void Issue(struct Scheduler *scheduler, int server, uint32_t index, enum ChunkRole role,
+                  double now, struct SchedulerChunk *chunk) {
+    struct ChunkRecord *record = &scheduler->records[index];
+    uint64_t numbers = record->args.end - record->args.begin + 1;
+    if (role == CHUNK_VERIFY)
+        record->verify = VERIFY_RUNNING;
+    else
+        record->copies++;
+    // Для копии оценки оригинала не трогаем: по ним выбирается следующий кандидат
+    if (role == CHUNK_PRIMARY) {
+        record->server = server;
+        record->started = now;
+        record->expected = now + ExpectedSeconds(scheduler, server, numbers);
+    }
+    chunk->args = record->args;
+    chunk->index = index;
+    chunk->role = role;
+}
+
+bool SchedulerNext(struct Scheduler *scheduler, int server, struct SchedulerChunk *chunk) {
+    pthread_mutex_lock(&scheduler->mutex);
+    bool found = false;
+    while (scheduler->covered < scheduler->total) {
+        double now = NowSeconds();
+        uint32_t index;
+        if (scheduler->retry_count > 0) {
+            index = scheduler->retry[--scheduler->retry_count];
+            if (scheduler->records[index].done)
+                continue;
+            scheduler->retried++;
+            Issue(scheduler, server, index, CHUNK_PRIMARY, now, chunk);
+            found = true;
+            break;
+        }
+        if (!scheduler->exhausted) {
+            uint64_t size = ChunkSize(scheduler, server);
+            index = AddRecord(scheduler, scheduler->next, scheduler->next + size - 1);
+            if (scheduler->records[index].args.end == scheduler->end)
+                scheduler->exhausted = true;
+            else
+                scheduler->next += size;
+            Issue(scheduler, server, index, CHUNK_PRIMARY, now, chunk);
+            found = true;
+            break;
+        }
+        if (FindSpeculative(scheduler, server, now, &index)) {
+            scheduler->speculated++;
+            Issue(scheduler, server, index, CHUNK_SPECULATIVE, now, chunk);
+            found = true;
+        }
+        break;
+    }
+    // Проверки идут после основной работы
+    uint32_t index;
+    if (!found && TakeVerification(scheduler, server, &index)) {
+        Issue(scheduler, server, index, CHUNK_VERIFY, NowSeconds(), chunk);
+        found = true;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return found;
+}
+
+void SchedulerComplete(struct Scheduler *scheduler, int server,
+                       const struct SchedulerChunk *chunk, unsigned __int128 result,
+                       double seconds) {
+    uint64_t numbers = chunk->args.end - chunk->args.begin + 1;
+    pthread_mutex_lock(&scheduler->mutex);
+    struct ChunkRecord *record = &scheduler->records[chunk->index];
+    if (chunk->role != CHUNK_VERIFY)
+        record->copies--;
+
+    struct ServerRate *rate = &scheduler->rates[server];
+    rate->sample_numbers += numbers;
+    rate->sample_seconds += seconds;
+    if (rate->sample_seconds >= scheduler->target_seconds / 4) {
+        double observed = (double)rate->sample_numbers / rate->sample_seconds;
+        if (rate->measured)
+            rate->rate = SCHEDULER_EWMA_ALPHA * observed + (1 - SCHEDULER_EWMA_ALPHA) * rate->rate;
+        else
+            rate->rate = observed;
+        rate->measured = true;
+        rate->sample_numbers = 0;
+        rate->sample_seconds = 0;
+    }
+
+    if (chunk->role == CHUNK_VERIFY) {
+        record->verify = VERIFY_DONE;
+        scheduler->verify_pending--;
+        CompareResult(scheduler, chunk->index, server, result);
+    } else if (record->done) {
+        // Опоздавшая копия проверяет результат бесплатно
+        scheduler->duplicates++;
+        CompareResult(scheduler, chunk->index, server, result);
+    } else {
+        record->done = true;
+        record->result = result;
+        record->solver = server;
+        scheduler->value = ReduceCombine(&scheduler->spec, scheduler->value, result);
+        scheduler->covered += numbers;
+        rate->numbers += numbers;
+        rate->chunks++;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void SchedulerReturn(struct Scheduler *scheduler, const struct SchedulerChunk *chunk) {
+    pthread_mutex_lock(&scheduler->mutex);
+    struct ChunkRecord *record = &scheduler->records[chunk->index];
+    if (chunk->role == CHUNK_VERIFY) {
+        record->verify = VERIFY_PENDING;
+        scheduler->verify[scheduler->verify_count++] = chunk->index;
+        pthread_mutex_unlock(&scheduler->mutex);
+        return;
+    }
+    record->copies--;
+    if (!record->done && record->copies == 0)
+        scheduler->retry[scheduler->retry_count++] = chunk->index;
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void SchedulerServerFailed(struct Scheduler *scheduler, int server) {
+    pthread_mutex_lock(&scheduler->mutex);
+    if (!scheduler->rates[server].failed) {
+        scheduler->rates[server].failed = true;
+        scheduler->live_servers--;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+bool SchedulerComputed(struct Scheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    bool computed = scheduler->covered == scheduler->total;
+    pthread_mutex_unlock(&scheduler->mutex);
+    return computed;
+}
+
+bool SchedulerDone(struct Scheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    // Проверки, которые больше некому выполнить, снимаются
+    for (uint32_t i = 0; i < scheduler->verify_count;) {
+        struct ChunkRecord *record = &scheduler->records[scheduler->verify[i]];
+        if (CanVerify(scheduler, record)) {
+            i++;
+            continue;
+        }
+        record->verify = VERIFY_NONE;
+        scheduler->verify[i] = scheduler->verify[--scheduler->verify_count];
+        scheduler->verify_pending--;
+        scheduler->verify_skipped++;
+    }
+    bool done = scheduler->covered == scheduler->total && scheduler->verify_pending == 0;
+    pthread_mutex_unlock(&scheduler->mutex);
+    return done;
+}
+
+uint32_t SchedulerSampleDone(struct Scheduler *scheduler, uint32_t *indices, uint32_t max) {
+    pthread_mutex_lock(&scheduler->mutex);
+    uint32_t *done = malloc(sizeof(uint32_t) * (scheduler->record_count + 1));
+    uint32_t done_count = 0;
+    for (uint32_t i = 0; i < scheduler->record_count; i++) {
+        if (scheduler->records[i].done)
+            done[done_count++] = i;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    // Частичная перетасовка Фишера — Йетса
+    uint32_t count = done_count < max ? done_count : max;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t j = i + (uint32_t)((uint64_t)rand() % (done_count - i));
+        uint32_t tmp = done[i];
+        done[i] = done[j];
+        done[j] = tmp;
+        indices[i] = done[i];
+    }
+    free(done);
+    return count;
+}
+
+void SchedulerQueueVerification(struct Scheduler *scheduler, const uint32_t *indices,
+                                uint32_t count) {
+    pthread_mutex_lock(&scheduler->mutex);
+    for (uint32_t i = 0; i < count; i++) {
+        struct ChunkRecord *record = &scheduler->records[indices[i]];
+        if (!record->done || record->verify != VERIFY_NONE)
+            continue;
+        record->verify = VERIFY_PENDING;
+        scheduler->verify[scheduler->verify_count++] = indices[i];
+        scheduler->verify_pending++;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void SchedulerCheckLocal(struct Scheduler *scheduler, uint32_t index,
+                         unsigned __int128 expected) {
+    pthread_mutex_lock(&scheduler->mutex);
+    CompareResult(scheduler, index, -1, expected);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+int SchedulerLoadProfile(struct Scheduler *scheduler, const char *path, char **names) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    char name[512];
+    double rate;
+    while (fscanf(file, "%511s %lf", name, &rate) == 2) {
+        if (rate <= 0)
+            continue;
+        for (int i = 0; i < scheduler->server_count; i++) {
+            if (strcmp(names[i], name) == 0) {
+                scheduler->rates[i].rate = rate;
+                scheduler->rates[i].measured = true;
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+int SchedulerSaveProfile(struct Scheduler *scheduler, const char *path, char **names) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+    for (int i = 0; i < scheduler->server_count; i++) {
+        if (scheduler->rates[i].measured)
+            fprintf(file, "%s %.0f\n", names[i], scheduler->rates[i].rate);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
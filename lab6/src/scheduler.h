@@ -0,0 +1,160 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "reduce.h"
+
+// Кусок короче этого не выдаётся: накладные расходы на кадр больше счёта
+#define SCHEDULER_MIN_CHUNK 4096
+// Пробный кусок для сервера без замеров не длиннее этого
+#define SCHEDULER_PROBE_CHUNK (1ULL << 22)
+// Вес нового замера в скользящем среднем скорости
+#define SCHEDULER_EWMA_ALPHA 0.3
+
+// Скорость сервера в числах в секунду
+struct ServerRate {
+    double rate;
+    bool measured;              // есть замер или значение из профиля
+    bool failed;                // соединение с сервером потеряно
+    uint64_t numbers;           // сколько чисел посчитал в этом запуске
+    uint64_t chunks;
+    uint64_t sample_numbers;    // накопленное с последнего замера
+    double sample_seconds;
+    uint64_t checked;           // сколько его результатов проверено
+    uint64_t mismatched;        // из них не совпало
+};
+
+enum ChunkRole {
+    CHUNK_PRIMARY,
+    CHUNK_SPECULATIVE,          // копия запаздывающего куска
+    CHUNK_VERIFY,               // пересчёт готового куска другим сервером
+};
+
+enum VerifyState {
+    VERIFY_NONE,
+    VERIFY_PENDING,             // ждёт сервер, отличный от посчитавшего
+    VERIFY_RUNNING,
+    VERIFY_DONE,
+};
+
+// Выданный кусок. Один кусок может считаться на двух серверах сразу
+// (спекулятивная копия), засчитывается первый пришедший результат.
+struct ChunkRecord {
+    struct FactorialArgs args;  // args.mod — spec.param планировщика
+    int copies;                 // сколько серверов считают его сейчас
+    bool done;
+    unsigned __int128 result;
+    int solver;                 // чей результат засчитан
+    enum VerifyState verify;
+    int server;                 // кому выдан не спекулятивно
+    double started;             // когда выдан этому серверу
+    double expected;            // когда ожидается результат от него
+};
+
+// Кусок в руках потока сервера
+struct SchedulerChunk {
+    struct FactorialArgs args;
+    uint32_t index;             // номер ChunkRecord
+    enum ChunkRole role;
+};
+
+// Разные результаты одного куска. server_b = -1 — локальный пересчёт.
+struct Discrepancy {
+    uint32_t index;
+    int server_a;
+    unsigned __int128 result_a;
+    int server_b;
+    unsigned __int128 result_b;
+};
+
+// Раздаёт [begin, end] кусками по запросу серверов. Размер куска подбирается
+// так, чтобы сервер считал его около target_seconds, а к концу диапазона
+// уменьшается пропорционально доле сервера в суммарной скорости, чтобы все
+// закончили примерно одновременно. Куски отказавших серверов выдаются
+// заново; когда новых кусков не осталось, свободные серверы получают копии
+// самых запаздывающих. По запросу готовые куски пересчитываются другими
+// серверами для проверки. Результаты кусков сворачиваются операцией spec:
+// n! mod m — это произведение по модулю над x_i = i. Не зависит от сетевой
+// части клиента.
+struct Scheduler {
+    uint64_t next;              // начало ещё не выданной части
+    uint64_t end;
+    bool exhausted;             // next > end или диапазон пуст
+    struct ReduceSpec spec;
+    unsigned __int128 value;    // свёртка посчитанных кусков
+    uint64_t covered;           // сколько чисел в них
+    uint64_t total;
+    uint64_t min_chunk;         // SCHEDULER_MIN_CHUNK или больше, если так выгоднее серверам
+    double target_seconds;
+    struct ServerRate *rates;
+    int server_count;
+    int live_servers;
+    struct ChunkRecord *records;
+    uint32_t record_count;
+    uint32_t record_cap;
+    uint32_t *retry;            // стек кусков, оставшихся без сервера
+    uint32_t retry_count;
+    uint64_t retried;
+    uint64_t speculated;
+    uint64_t duplicates;        // результаты, пришедшие вторыми
+    uint32_t *verify;           // очередь кусков на проверку другим сервером
+    uint32_t verify_count;
+    uint32_t verify_pending;    // поставленные в очередь и ещё не проверенные
+    uint32_t verify_skipped;    // не осталось сервера, который мог бы проверить
+    uint64_t checked;           // сверенные пары результатов
+    struct Discrepancy *discrepancies;
+    uint32_t discrepancy_count;
+    uint32_t discrepancy_cap;
+    pthread_mutex_t mutex;
+};
+
+void SchedulerInit(struct Scheduler *scheduler, uint64_t begin, uint64_t end,
+                   const struct ReduceSpec *spec, int server_count, double target_seconds);
+void SchedulerDestroy(struct Scheduler *scheduler);
+
+// Следующий кусок для сервера server. false — сейчас выдать нечего: всё
+// выдано, а копировать пока нечего. Кандидаты на копию зависят от времени,
+// поэтому свободным серверам стоит спрашивать периодически.
+bool SchedulerNext(struct Scheduler *scheduler, int server, struct SchedulerChunk *chunk);
+
+// Кусок посчитан за seconds чистого времени сервера. Сервер может считать
+// несколько кусков одновременно, поэтому замер скорости делается по сумме
+// кусков, набравших не меньше четверти target_seconds.
+void SchedulerComplete(struct Scheduler *scheduler, int server,
+                       const struct SchedulerChunk *chunk, unsigned __int128 result,
+                       double seconds);
+
+// Кусок не посчитан: если других копий нет, он будет выдан другому серверу
+void SchedulerReturn(struct Scheduler *scheduler, const struct SchedulerChunk *chunk);
+
+// Сервер больше не берёт куски
+void SchedulerServerFailed(struct Scheduler *scheduler, int server);
+
+// Все числа диапазона посчитаны
+bool SchedulerComputed(struct Scheduler *scheduler);
+
+// Посчитано и проверено всё, что можно проверить
+bool SchedulerDone(struct Scheduler *scheduler);
+
+// До max случайных различных готовых кусков, возвращает их число
+uint32_t SchedulerSampleDone(struct Scheduler *scheduler, uint32_t *indices, uint32_t max);
+
+// Куски будут выданы на пересчёт серверам, отличным от посчитавших
+void SchedulerQueueVerification(struct Scheduler *scheduler, const uint32_t *indices,
+                                uint32_t count);
+
+// Сверка куска с локально пересчитанным значением
+void SchedulerCheckLocal(struct Scheduler *scheduler, uint32_t index,
+                         unsigned __int128 expected);
+
+// Профиль — текстовый файл строк "host:port скорость". Строки неизвестных
+// серверов при загрузке пропускаются, names[i] — "host:port" сервера i.
+// Возвращают 0 или -1.
+int SchedulerLoadProfile(struct Scheduler *scheduler, const char *path, char **names);
+int SchedulerSaveProfile(struct Scheduler *scheduler, const char *path, char **names);
+
+#endif
@@ -1,33 +1,2195 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
 #include <getopt.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <pthread.h>
+#include <time.h>
 
+#include "bignum.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "log.h"
+#include "metrics.h"
+#include "modarith.h"
+#include "net.h"
+#include "prime_factorial.h"
+#include "protocol.h"
+#include "range_cache.h"
+#include "range_kernel.h"
+#include "reduce.h"
+#include "shm_ring.h"
+#include "thread_pool.h"
+#include "timer_wheel.h"
+#include "uring.h"
 
-void *ThreadFactorial(void *args) {
-    struct FactorialArgs *fargs = (struct FactorialArgs *)args;
-    uint64_t result = Factorial(fargs);
-    return (void *)(uintptr_t)result;
+// Диапазон короче этого на одну задачу не делится: пересылка в пул дороже счёта
+#define SPLIT_MIN_RANGE (1ULL << 16)
+// Задача считается срезами такой длины и между ними проверяет отмену запроса:
+// срез занимает поток на единицы миллисекунд
+#define CANCEL_SLICE (1ULL << 22)
+
+#define MAX_EVENTS 64
+#define READ_CHUNK 4096
+#define DEFAULT_CACHE_MB 16
+#define MAX_CHECKPOINTS 8
+#define DEFAULT_MAX_REQUESTS 1024
+#define DEFAULT_RETRY_AFTER_MS 50
+#define MAX_WORKERS 256
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 256
+// Сколько секунд ждать ответа узла поддерева, прежде чем досчитать его
+// долю самому
+#define DEFAULT_CHILD_TIMEOUT 30
+#define CHILD_TIMER_TICK 0.1
+
+struct EventLoop;
+struct Connection;
+struct Request;
+
+// Часть запроса, которую считает один поток пула
+struct RangeTask {
+    struct PoolTask task;
+    union {
+        struct FactorialArgs args;
+        struct ReduceArgs reduce;   // PROTO_OP_REDUCE
+    };
+    uint64_t result;
+    unsigned __int128 value;    // результат свёртки
+    struct BigNum exact;        // PROTO_OP_EXACT: точное произведение
+    bool divide;                // результат идёт в знаменатель (план из кэша)
+    int item;                   // индекс диапазона в запросе
+    int child;                  // группа поддерева, которой отдана задача, -1 — своя
+    struct Request *request;
+};
+
+// Один диапазон запроса
+struct RangeItem {
+    union {
+        struct FactorialArgs args;
+        struct ReduceArgs reduce;   // PROTO_OP_REDUCE
+    };
+    uint64_t num;               // известные из кэша множители числителя
+    uint64_t den;               // и знаменателя
+    uint64_t result;
+    unsigned __int128 value;    // результат свёртки
+    struct BigNum exact;        // PROTO_OP_EXACT
+};
+
+// Запрос клиента: кадр v2 с вектором диапазонов или свёрток, или один
+// запрос v1. Живёт от разбора до отправки ответа, даже если соединение к
+// тому времени закрыто.
+struct Request {
+    struct Connection *conn;
+    uint64_t id;                // request_id кадра v2
+    uint8_t opcode;             // для PROTO_OP_AGGREGATE — opcode вложенного запроса
+    bool tree;                  // ответ уходит с opcode PROTO_OP_AGGREGATE
+    uint16_t status;
+    atomic_bool cancelled;      // потоки пула бросают задачи запроса
+    struct Connection *links;   // связи с поддеревьями, освобождаются вместе с запросом
+    int item_count;
+    struct RangeItem *items;
+    bool done;
+    int parts;
+    uint64_t received_ns;       // метки времени ведутся, только если включены метрики
+    atomic_uint_least64_t compute_start_ns;
+    uint64_t compute_end_ns;
+    atomic_int remaining;       // незавершённые задачи пула
+    bool admitted;              // учтён в Admission до освобождения
+    uint64_t work;              // сколько чисел учтено
+    struct sockaddr_storage peer; // отправитель датаграммы (UDP)
+    socklen_t peer_len;
+    struct Request *next;       // очередь запросов соединения в порядке поступления
+    struct Request *next_done;  // список завершённых, переданный циклу событий
+    struct RangeTask tasks[];
+};
+
+enum ConnProtocol {
+    CONN_PROTOCOL_UNKNOWN,      // ещё не пришли первые байты
+    CONN_PROTOCOL_V1,
+    CONN_PROTOCOL_V2,
+    CONN_PROTOCOL_UDP,          // общий UDP-сокет, кадры v2 в датаграммах
+    CONN_PROTOCOL_CHILD,        // исходящая связь с узлом поддерева, один кадр v2
+    CONN_PROTOCOL_SHM,          // кадры v2 через каналы в общей памяти
+};
+
+struct Connection {
+    int fd;                     // -1 после закрытия сокета
+    struct EventLoop *loop;
+    enum ConnProtocol protocol;
+    unsigned char *in;
+    size_t in_len;
+    size_t in_cap;
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    struct sockaddr_storage peer; // отправитель текущей датаграммы (UDP) или узел (CHILD)
+    socklen_t peer_len;
+    int pending;                // запросы, ещё не отправленные клиенту
+    struct Request *head;
+    struct Request *tail;
+    struct Request *parent;     // CHILD: запрос, ждущий ответа, NULL после него
+    int child;                  // CHILD: номер группы в parent
+    struct Connection *next_link; // CHILD: следующая связь того же запроса
+    struct Timer deadline;      // CHILD: срок ответа узла
+    uint64_t admitted_requests; // принятые и ещё не освобождённые запросы
+    uint64_t admitted_work;     // и числа в них
+    bool uring;                 // сокет обслуживает io_uring цикла, а не epoll
+    int uring_ops;              // незавершённые операции io_uring над ним
+    int closing_fd;             // закрывается, когда завершатся все операции
+    char *sending;              // буфер отправки, которым сейчас владеет ядро
+    size_t sending_len;         // 0 — отправка не идёт
+    size_t sending_sent;
+    size_t sending_cap;
+    bool local;                 // принято через unix-сокет
+    struct ShmEnd shm;          // SHM: каналы и eventfd
+};
+
+// Допуск запросов, общий для всех циклов событий. Запрос, уходящий в пул,
+// принимается, пока число таких запросов и сумма их чисел ниже пределов,
+// а соединение не превысило свою равную долю пределов. Иначе он сразу
+// получает PROTO_STATUS_OVERLOADED, и очередь пула не растёт без меры.
+// Проверка и учёт не атомарны вместе: циклы могут превысить предел на
+// несколько запросов.
+struct Admission {
+    uint64_t max_requests;      // 0 — без предела
+    uint64_t max_work;          // 0 — без предела
+    uint32_t retry_after_ms;
+    atomic_uint_least64_t requests;
+    atomic_uint_least64_t work;
+    atomic_int connections;     // открытые TCP-соединения клиентов
+};
+
+// Цикл событий: свой epoll, общий слушающий сокет и eventfd, через который
+// потоки пула сообщают о готовых запросах
+struct EventLoop {
+    int epoll_fd;
+    int wake_fd;
+    int listen_fd;
+    int unix_fd;                // -1, если сервер не слушает unix-сокет
+    int timer_fd;               // срабатывает к ближайшему тику wheel
+    struct TimerWheel wheel;    // сроки ответа узлов поддеревьев
+    double child_timeout;
+    struct ThreadPool *pool;
+    struct RangeCache *cache;   // NULL, если кэш выключен
+    const struct Checkpoint *checkpoints;
+    int checkpoint_count;
+    struct Metrics *metrics;    // NULL, если метрики выключены
+    struct Admission *admission;
+    bool use_uring;             // попробовать io_uring при запуске цикла
+    struct Uring ring;
+    pthread_t thread;
+    pthread_mutex_t done_mutex;
+    struct Request *done_head;
+};
+
+// Выставляются обработчиком сигналов, обрабатываются циклом событий главного потока
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+static void HandleSignal(int sig) {
+    if (sig == SIGUSR1)
+        stats_requested = 1;
+    else
+        stop_requested = 1;
+}
+
+// Только будит sigsuspend супервизора рабочих процессов
+static void HandleChild(int sig) {
+    (void)sig;
+}
+
+static void PrintCacheStats(struct RangeCache *cache) {
+    if (cache == NULL)
+        return;
+    struct RangeCacheStats stats;
+    RangeCacheGetStats(cache, &stats);
+    uint64_t lookups = stats.hits + stats.partial_hits + stats.misses;
+    printf("Cache: %lu hits, %lu partial hits, %lu misses (hit rate %.1f%%), "
+           "%lu inserts, %lu evictions, %zu/%zu entries\n",
+           stats.hits, stats.partial_hits, stats.misses,
+           lookups ? 100.0 * (double)(stats.hits + stats.partial_hits) / (double)lookups : 0.0,
+           stats.inserts, stats.evictions, stats.entries, stats.capacity);
+    fflush(stdout);
+}
+
+static void Count(struct EventLoop *loop, enum MetricsCounter counter, uint64_t value) {
+    if (loop->metrics != NULL)
+        MetricsAdd(loop->metrics, counter, value);
+}
+
+static void CompleteRequest(struct Request *request) {
+    struct EventLoop *loop = request->conn->loop;
+
+    pthread_mutex_lock(&loop->done_mutex);
+    request->next_done = loop->done_head;
+    loop->done_head = request;
+    pthread_mutex_unlock(&loop->done_mutex);
+
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG(LOG_ERROR, "Could not wake event loop\n");
+}
+
+// Собирает частичные свёртки. Задачи одного диапазона идут подряд.
+static void CombineReductions(struct Request *request) {
+    int task = 0;
+    for (int i = 0; i < request->item_count; i++) {
+        struct RangeItem *item = &request->items[i];
+        const struct ReduceSpec *spec = &item->reduce.spec;
+        item->value = ReduceIdentity(spec);
+        for (; task < request->parts && request->tasks[task].item == i; task++)
+            item->value = ReduceCombine(spec, item->value, request->tasks[task].value);
+    }
+}
+
+// Точные произведения задач перемножаются деревом в потоке, завершившем
+// последнюю задачу
+static void CombineExact(struct Request *request) {
+    struct BigNum *parts = malloc(sizeof(struct BigNum) * (size_t)request->parts);
+    for (int i = 0; i < request->parts; i++) {
+        parts[i] = request->tasks[i].exact;
+        BigInit(&request->tasks[i].exact);
+    }
+    if (atomic_load(&request->cancelled)) {
+        for (int i = 0; i < request->parts; i++)
+            BigFree(&parts[i]);
+    } else {
+        BigProductOf(&request->items[0].exact, parts, request->parts, 1);
+    }
+    free(parts);
+}
+
+// Собирает частичные произведения и известные из кэша множители. Задачи
+// одного диапазона идут подряд, поэтому контекст модуля строится один раз
+// на диапазон.
+static void CombineResults(struct Request *request) {
+    if (request->opcode == PROTO_OP_REDUCE) {
+        CombineReductions(request);
+        return;
+    }
+    if (request->opcode == PROTO_OP_EXACT) {
+        CombineExact(request);
+        return;
+    }
+    int task = 0;
+    for (int i = 0; i < request->item_count; i++) {
+        struct RangeItem *item = &request->items[i];
+        uint64_t mod = item->args.mod;
+        struct ModContext ctx;
+        ModInit(&ctx, mod);
+
+        uint64_t num = item->num % mod;
+        uint64_t den = item->den % mod;
+        for (; task < request->parts && request->tasks[task].item == i; task++) {
+            if (request->tasks[task].divide)
+                den = ModMul(&ctx, den, request->tasks[task].result);
+            else
+                num = ModMul(&ctx, num, request->tasks[task].result);
+        }
+        // Знаменатель бывает только у простого модуля и не кратен ему
+        if (den != 1 % mod)
+            num = ModMul(&ctx, num, ModPow(&ctx, den, mod - 2));
+        item->result = num;
+    }
+}
+
+// Отмечает завершёнными count задач запроса. Последняя собирает результат.
+static void FinishTasks(struct Request *request, int count) {
+    if (atomic_fetch_sub(&request->remaining, count) != count)
+        return;
+    CombineResults(request);
+    if (request->conn->loop->metrics != NULL)
+        request->compute_end_ns = MetricsNowNs();
+    CompleteRequest(request);
+}
+
+static bool Cancelled(const struct Request *request) {
+    return atomic_load_explicit(&request->cancelled, memory_order_relaxed);
+}
+
+// Factorial() по срезам CANCEL_SLICE. Сублинейный движок для простого
+// модуля быстр и так, а на срезах потерял бы выигрыш, поэтому не делится.
+static uint64_t SlicedFactorial(const struct Request *request, const struct FactorialArgs *args) {
+    struct ModContext ctx;
+    ModInit(&ctx, args->mod);
+    if (PrimeEngineApplies(&ctx, args->begin, args->end))
+        return PrimeRangeProduct(&ctx, args->begin, args->end);
+
+    uint64_t result = 1 % args->mod;
+    for (uint64_t begin = args->begin; begin <= args->end && !Cancelled(request);) {
+        uint64_t end = args->end - begin < CANCEL_SLICE ? args->end : begin + CANCEL_SLICE - 1;
+        result = ModMul(&ctx, result, RangeProduct(&ctx, begin, end));
+        if (end == args->end)
+            break;
+        begin = end + 1;
+    }
+    return result;
+}
+
+// Reduce() по срезам CANCEL_SLICE. Для x_i = i Reduce считает по формуле
+// или через Factorial(), такие свёртки не делятся.
+static unsigned __int128 SlicedReduce(const struct Request *request,
+                                      const struct ReduceArgs *args) {
+    if (args->spec.generator == REDUCE_GEN_INDEX)
+        return Reduce(args);
+
+    unsigned __int128 value = ReduceIdentity(&args->spec);
+    struct ReduceArgs slice = *args;
+    for (uint64_t begin = args->begin; begin <= args->end && !Cancelled(request);) {
+        slice.begin = begin;
+        slice.end = args->end - begin < CANCEL_SLICE ? args->end : begin + CANCEL_SLICE - 1;
+        value = ReduceCombine(&args->spec, value, Reduce(&slice));
+        if (slice.end == args->end)
+            break;
+        begin = slice.end + 1;
+    }
+    return value;
+}
+
+// Точное произведение не режется на срезы: отмена видна только до начала
+// задачи
+static void RunTaskBody(struct RangeTask *task) {
+    if (task->request->opcode == PROTO_OP_REDUCE)
+        task->value = SlicedReduce(task->request, &task->reduce);
+    else if (task->request->opcode == PROTO_OP_EXACT)
+        BigProductRange(&task->exact, task->args.begin, task->args.end, 1);
+    else
+        task->result = SlicedFactorial(task->request, &task->args);
+}
+
+static void RunRangeTask(struct PoolTask *task) {
+    struct RangeTask *range_task = (struct RangeTask *)task;
+    struct Request *request = range_task->request;
+    struct Metrics *metrics = request->conn->loop->metrics;
+    if (Cancelled(request)) {
+        // Результат отменённого запроса не нужен, задача только отмечается
+    } else if (metrics == NULL) {
+        RunTaskBody(range_task);
+    } else {
+        uint64_t start = MetricsNowNs();
+        RunTaskBody(range_task);
+        MetricsAdd(metrics, METRICS_WORKER_BUSY_NS, MetricsNowNs() - start);
+        // Началом вычисления считается старт первой задачи
+        uint_least64_t unset = 0;
+        atomic_compare_exchange_strong(&request->compute_start_ns, &unset, start);
+    }
+    FinishTasks(request, 1);
+}
+
+// Число задач пула для [begin, end]: 0 для пустого диапазона, иначе от 1 до
+// pool->size, не меньше SPLIT_MIN_RANGE чисел на задачу
+static uint64_t TaskCount(const struct ThreadPool *pool, uint64_t begin, uint64_t end) {
+    if (begin > end)
+        return 0;
+    uint64_t range = end - begin + 1;
+    uint64_t parts = range / SPLIT_MIN_RANGE;
+    if (range == 0 || parts > (uint64_t)pool->size)
+        parts = (uint64_t)pool->size; // range == 0: переполнение, весь диапазон uint64_t
+    return parts == 0 ? 1 : parts;
+}
+
+// Задача над [begin, end] диапазона item, остальные параметры берутся из него
+static struct RangeTask *InitTask(struct Request *request, int index, int item, uint64_t begin,
+                                  uint64_t end) {
+    struct RangeTask *task = &request->tasks[index];
+    task->task.run = RunRangeTask;
+    task->request = request;
+    task->divide = false;
+    BigInit(&task->exact);
+    task->item = item;
+    task->child = -1;
+    if (request->opcode == PROTO_OP_REDUCE) {
+        task->reduce = request->items[item].reduce;
+        task->reduce.begin = begin;
+        task->reduce.end = end;
+    } else {
+        task->args = request->items[item].args;
+        task->args.begin = begin;
+        task->args.end = end;
+    }
+    return task;
+}
+
+static int AddTasks(struct Request *request, int item, int first, uint64_t parts,
+                    uint64_t begin, uint64_t end, bool divide) {
+    uint64_t numbers_per_task = parts == 0 ? 0 : (end - begin) / parts + 1;
+    uint64_t current_start = begin;
+    for (uint64_t i = 0; i < parts; i++) {
+        uint64_t task_end = i + 1 == parts ? end : current_start + numbers_per_task - 1;
+        InitTask(request, first + (int)i, item, current_start, task_end)->divide = divide;
+        current_start = task_end + 1;
+    }
+    return first + (int)parts;
+}
+
+// Сколько чисел осталось досчитать по плану
+static uint64_t PlanCost(const struct CachePlan *plan) {
+    uint64_t cost = 0;
+    if (plan->mul_begin <= plan->mul_end)
+        cost += plan->mul_end - plan->mul_begin + 1;
+    if (plan->div_begin <= plan->div_end)
+        cost += plan->div_end - plan->div_begin + 1;
+    return cost;
+}
+
+static struct Request *NewRequest(struct Connection *conn, uint64_t id, uint8_t opcode,
+                                  int item_count, uint64_t parts) {
+    struct Request *request = malloc(sizeof(struct Request) + sizeof(struct RangeTask) * parts);
+    request->conn = conn;
+    request->id = id;
+    request->opcode = opcode;
+    request->tree = false;
+    request->status = PROTO_STATUS_OK;
+    atomic_init(&request->cancelled, false);
+    request->links = NULL;
+    request->item_count = item_count;
+    request->items = item_count > 0 ? malloc(sizeof(struct RangeItem) * (size_t)item_count) : NULL;
+    request->done = false;
+    request->parts = (int)parts;
+    request->next = NULL;
+    request->next_done = NULL;
+    request->received_ns = conn->loop->metrics != NULL ? MetricsNowNs() : 0;
+    atomic_init(&request->compute_start_ns, 0);
+    request->compute_end_ns = 0;
+    atomic_init(&request->remaining, (int)parts);
+    request->admitted = false;
+    request->work = 0;
+    if (conn->protocol == CONN_PROTOCOL_UDP) {
+        request->peer = conn->peer;
+        request->peer_len = conn->peer_len;
+    }
+    return request;
+}
+
+// Ответ об ошибке кадра: готов сразу, диапазонов не содержит
+static struct Request *ErrorRequest(struct Connection *conn, uint64_t id, uint8_t opcode,
+                                    uint16_t status) {
+    struct Request *request = NewRequest(conn, id, opcode, 0, 0);
+    request->status = status;
+    request->done = true;
+    return request;
+}
+
+// Принимает запрос с work числами к счёту. v1 не умеет сообщить об отказе,
+// его запросы только учитываются.
+static bool Admit(struct Request *request, uint64_t work) {
+    struct Connection *conn = request->conn;
+    struct Admission *admission = conn->loop->admission;
+    if (conn->protocol != CONN_PROTOCOL_V1) {
+        uint64_t requests = atomic_load(&admission->requests);
+        uint64_t queued = atomic_load(&admission->work);
+        // Отправители датаграмм делят одну псевдо-связь цикла
+        int open = atomic_load(&admission->connections);
+        uint64_t connections = conn->protocol == CONN_PROTOCOL_UDP || open < 1 ? 1 : (uint64_t)open;
+        uint64_t max_requests = admission->max_requests;
+        if (max_requests != 0 &&
+            (requests >= max_requests ||
+             conn->admitted_requests >= (max_requests > connections ? max_requests / connections
+                                                                   : 1)))
+            return false;
+        // Запрос длиннее предела принимается, только когда очередь пуста,
+        // иначе он не был бы принят никогда
+        uint64_t max_work = admission->max_work;
+        if (max_work != 0 && ((queued > 0 && queued + work > max_work) ||
+                              (conn->admitted_work > 0 &&
+                               conn->admitted_work + work > max_work / connections)))
+            return false;
+    }
+
+    atomic_fetch_add(&admission->requests, 1);
+    atomic_fetch_add(&admission->work, work);
+    conn->admitted_requests++;
+    conn->admitted_work += work;
+    request->admitted = true;
+    request->work = work;
+    return true;
+}
+
+static void Release(struct Request *request) {
+    if (!request->admitted)
+        return;
+    struct Connection *conn = request->conn;
+    atomic_fetch_sub(&conn->loop->admission->requests, 1);
+    atomic_fetch_sub(&conn->loop->admission->work, request->work);
+    conn->admitted_requests--;
+    conn->admitted_work -= request->work;
+}
+
+// Освобождает соединение, если сокет закрыт и не осталось незавершённых запросов
+static bool ReleaseIfIdle(struct Connection *conn) {
+    if (conn->fd >= 0 || conn->pending > 0 || conn->uring_ops > 0)
+        return false;
+    free(conn->in);
+    free(conn->out);
+    free(conn->sending);
+    free(conn);
+    return true;
+}
+
+// Связи запроса к этому времени закрыты: он готов, только когда ответили
+// или отказали все поддеревья
+static void FreeRequest(struct Request *request) {
+    struct Connection *link = request->links;
+    while (link != NULL) {
+        struct Connection *next = link->next_link;
+        link->pending = 0;
+        ReleaseIfIdle(link);
+        link = next;
+    }
+    Release(request);
+    if (request->opcode == PROTO_OP_EXACT && request->item_count > 0)
+        BigFree(&request->items[0].exact);
+    free(request->items);
+    free(request);
+}
+
+// Отказ в допуске: вместо запроса клиент сразу получает
+// PROTO_STATUS_OVERLOADED и может отдать работу другому серверу
+static struct Request *ShedRequest(struct Request *request) {
+    struct Connection *conn = request->conn;
+    LOG(LOG_DEBUG, "Request %lu shed: %lu requests, %lu numbers admitted\n", request->id,
+        atomic_load(&conn->loop->admission->requests), atomic_load(&conn->loop->admission->work));
+    Count(conn->loop, METRICS_SHED, 1);
+    struct Request *overloaded = ErrorRequest(conn, request->id, request->opcode,
+                                              PROTO_STATUS_OVERLOADED);
+    overloaded->tree = request->tree;
+    FreeRequest(request);
+    return overloaded;
+}
+
+// Если работы в сумме мало, всё считается сразу в цикле событий, и запрос
+// возвращается готовым, иначе задачи уходят в пул, если запрос допущен.
+// Точное произведение дороже модульного на порядки и всегда идёт в пул.
+static struct Request *LaunchRequest(struct Request *request, uint64_t work) {
+    struct Connection *conn = request->conn;
+    if (work < SPLIT_MIN_RANGE && request->opcode != PROTO_OP_EXACT) {
+        atomic_store(&request->compute_start_ns, request->received_ns);
+        for (int i = 0; i < request->parts; i++)
+            RunTaskBody(&request->tasks[i]);
+        CombineResults(request);
+        if (conn->loop->metrics != NULL)
+            request->compute_end_ns = MetricsNowNs();
+        request->done = true;
+        return request;
+    }
+    if (!Admit(request, work))
+        return ShedRequest(request);
+
+    // Отправляем после заполнения: первая задача может завершиться раньше,
+    // чем будут инициализированы остальные
+    for (int i = 0; i < request->parts; i++)
+        ThreadPoolSubmit(conn->loop->pool, &request->tasks[i].task);
+    return request;
+}
+
+// Диапазон, который сублинейный движок считает целиком, не делится: на
+// части короче PRIME_ENGINE_MIN_RANGE ушло бы линейное ядро
+static uint64_t RangeTaskCount(const struct ThreadPool *pool, uint64_t begin, uint64_t end,
+                               uint64_t mod) {
+    struct ModContext ctx;
+    ModInit(&ctx, mod);
+    if (PrimeEngineApplies(&ctx, begin, end))
+        return 1;
+    return TaskCount(pool, begin, end);
+}
+
+// Делит досчитываемые по планам диапазоны между потоками пула
+static struct Request *StartRequest(struct Connection *conn, uint64_t id,
+                                    const struct FactorialArgs *args,
+                                    const struct CachePlan *plans, int count) {
+    struct ThreadPool *pool = conn->loop->pool;
+    uint64_t parts = 0;
+    uint64_t work = 0;
+    for (int i = 0; i < count; i++) {
+        parts += RangeTaskCount(pool, plans[i].mul_begin, plans[i].mul_end, args[i].mod);
+        parts += RangeTaskCount(pool, plans[i].div_begin, plans[i].div_end, args[i].mod);
+        work += PlanCost(&plans[i]);
+    }
+
+    struct Request *request = NewRequest(conn, id, PROTO_OP_RANGE, count, parts);
+    int task = 0;
+    for (int i = 0; i < count; i++) {
+        const struct CachePlan *plan = &plans[i];
+        request->items[i].args = args[i];
+        request->items[i].num = plan->num;
+        request->items[i].den = plan->den;
+        task = AddTasks(request, i, task,
+                        RangeTaskCount(pool, plan->mul_begin, plan->mul_end, args[i].mod),
+                        plan->mul_begin, plan->mul_end, false);
+        task = AddTasks(request, i, task,
+                        RangeTaskCount(pool, plan->div_begin, plan->div_end, args[i].mod),
+                        plan->div_begin, plan->div_end, true);
+    }
+
+    return LaunchRequest(request, work);
+}
+
+// Точное произведение begin..end делится между потоками пула, как диапазон
+// по модулю, но без кэша и контрольных точек
+static struct Request *StartExact(struct Connection *conn, uint64_t id,
+                                  const struct FactorialArgs *args) {
+    uint64_t parts = TaskCount(conn->loop->pool, args->begin, args->end);
+    struct Request *request = NewRequest(conn, id, PROTO_OP_EXACT, 1, parts);
+    request->items[0].args = *args;
+    BigInit(&request->items[0].exact);
+    AddTasks(request, 0, 0, parts, args->begin, args->end, false);
+    return LaunchRequest(request, args->end - args->begin + 1);
+}
+
+// Свёртку x_i = i, кроме произведения, Reduce считает по формуле: делить её
+// незачем, и работы в ней нет
+static bool ReduceClosedForm(const struct ReduceArgs *args) {
+    return args->spec.generator == REDUCE_GEN_INDEX && args->spec.op != REDUCE_PRODUCT;
+}
+
+static uint64_t ReduceTaskCount(const struct ThreadPool *pool, const struct ReduceArgs *args) {
+    if (ReduceClosedForm(args))
+        return args->begin <= args->end ? 1 : 0;
+    return TaskCount(pool, args->begin, args->end);
+}
+
+// Свёртки делятся между потоками пула так же, как диапазоны произведений
+static struct Request *StartReduce(struct Connection *conn, uint64_t id,
+                                   const struct ReduceArgs *args, int count) {
+    struct ThreadPool *pool = conn->loop->pool;
+    uint64_t parts = 0;
+    uint64_t work = 0;
+    for (int i = 0; i < count; i++) {
+        parts += ReduceTaskCount(pool, &args[i]);
+        if (!ReduceClosedForm(&args[i]) && args[i].begin <= args[i].end)
+            work += args[i].end - args[i].begin + 1;
+    }
+
+    struct Request *request = NewRequest(conn, id, PROTO_OP_REDUCE, count, parts);
+    int task = 0;
+    for (int i = 0; i < count; i++) {
+        request->items[i].reduce = args[i];
+        task = AddTasks(request, i, task, ReduceTaskCount(pool, &args[i]), args[i].begin,
+                        args[i].end, false);
+    }
+    return LaunchRequest(request, work);
+}
+
+// План вычисления: готовое значение или досчёт по контрольным точкам либо
+// из кэша (берётся более дешёвый), иначе весь диапазон
+static void PlanRequest(struct EventLoop *loop, const struct FactorialArgs *args,
+                        struct CachePlan *plan) {
+    uint64_t begin = args->begin;
+    uint64_t end = args->end;
+    bool planned = false;
+    bool worth_planning = begin <= end && end - begin + 1 >= RANGE_CACHE_MIN_RANGE;
+    bool prime = worth_planning && IsPrime64(args->mod);
+
+    for (int i = 0; worth_planning && i < loop->checkpoint_count; i++) {
+        const struct Checkpoint *checkpoint = &loop->checkpoints[i];
+        if (checkpoint->header->mod == args->mod) {
+            planned = CheckpointPlan(checkpoint, begin, end, prime, plan);
+            break;
+        }
+    }
+
+    if (worth_planning && loop->cache != NULL && (!planned || PlanCost(plan) > 0)) {
+        struct CachePlan cached;
+        if (RangeCacheLookup(loop->cache, args->mod, begin, end, prime, &cached) &&
+            (!planned || PlanCost(&cached) < PlanCost(plan))) {
+            *plan = cached;
+            planned = true;
+        }
+    }
+    if (planned)
+        return;
+
+    plan->num = 1;
+    plan->den = 1;
+    plan->mul_begin = begin;
+    plan->mul_end = end;
+    plan->div_begin = 1;
+    plan->div_end = 0;
+}
+
+// Долю группы, чей узел не ответил, досчитывает пул этого сервера: её
+// поддерево выпадает из работы целиком
+static void RunChildLocally(struct Connection *link) {
+    struct Request *request = link->parent;
+    // Журнал форматирует строки позже, поэтому адрес выводится числами
+    const struct sockaddr_in *peer = (const struct sockaddr_in *)&link->peer;
+    uint32_t ip = ntohl(peer->sin_addr.s_addr);
+    LOG(LOG_WARN, "Child %u.%u.%u.%u:%u failed, computing its share locally\n", ip >> 24,
+        (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, ntohs(peer->sin_port));
+
+    link->parent = NULL;
+    for (int i = 0; i < request->parts; i++) {
+        if (request->tasks[i].child == link->child)
+            ThreadPoolSubmit(link->loop->pool, &request->tasks[i].task);
+    }
+}
+
+// Вид операции io_uring в младших битах user_data, в остальных — адрес
+// соединения или цикла событий (выровнен не меньше чем на 8)
+enum UringOp {
+    URING_OP_IGNORE,            // close: результат не нужен
+    URING_OP_ACCEPT,
+    URING_OP_WAKE,              // eventfd пула
+    URING_OP_EPOLL,             // epoll с UDP-сокетом и связями с поддеревьями
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_SHUTDOWN,
+};
+#define URING_OP_MASK 7u
+
+static uint64_t UringTag(void *ptr, enum UringOp op) {
+    return (uint64_t)(uintptr_t)ptr | op;
+}
+
+static void UringArm(struct EventLoop *loop, enum UringOp op) {
+    struct io_uring_sqe *sqe = UringGetSqe(&loop->ring);
+    if (op == URING_OP_ACCEPT)
+        UringPrepAccept(sqe, loop->listen_fd, UringTag(loop, op));
+    else
+        UringPrepPoll(sqe, op == URING_OP_WAKE ? loop->wake_fd : loop->epoll_fd, EPOLLIN,
+                      UringTag(loop, op));
+}
+
+static void UringArmRecv(struct Connection *conn) {
+    UringPrepRecv(UringGetSqe(&conn->loop->ring), conn->fd, UringTag(conn, URING_OP_RECV));
+    conn->uring_ops++;
+}
+
+static void UringSendRest(struct Connection *conn) {
+    UringPrepSend(UringGetSqe(&conn->loop->ring), conn->fd, conn->sending + conn->sending_sent,
+                  conn->sending_len - conn->sending_sent, UringTag(conn, URING_OP_SEND));
+    conn->uring_ops++;
+}
+
+// Пока ядро отправляет один буфер, ответы копятся в другом: out не
+// перевыделяется под выполняющейся отправкой
+static void UringFlush(struct Connection *conn) {
+    if (conn->fd < 0 || conn->sending_len > 0 || conn->out_len == 0)
+        return;
+    char *buffer = conn->sending;
+    size_t cap = conn->sending_cap;
+    conn->sending = conn->out;
+    conn->sending_cap = conn->out_cap;
+    conn->sending_len = conn->out_len;
+    conn->sending_sent = 0;
+    conn->out = buffer;
+    conn->out_cap = cap;
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    UringSendRest(conn);
+}
+
+static void CloseSocket(struct Connection *conn);
+
+// Задачи, ещё не взятые потоками, пропускаются, начатые бросают работу на
+// границе среза. Связи с поддеревьями закрываются, и их узлы отменяют свою
+// часть так же. Отменённый запрос отвечает статусом PROTO_STATUS_CANCELLED.
+static void CancelRequest(struct Request *request) {
+    if (request->done || Cancelled(request))
+        return;
+    atomic_store(&request->cancelled, true);
+    request->status = PROTO_STATUS_CANCELLED;
+    Count(request->conn->loop, METRICS_CANCELLED, 1);
+    for (struct Connection *link = request->links; link != NULL; link = link->next_link)
+        CloseSocket(link);
+}
+
+// Закрытие связи без ответа: у отменённого запроса её задачи просто
+// отмечаются, у остальных досчитываются локально
+static void CloseSocket(struct Connection *conn) {
+    if (conn->fd < 0)
+        return;
+    if (conn->uring) {
+        // shutdown завершает multishot recv и отправку, а close уходит
+        // ядру, когда завершится последняя операция над сокетом
+        UringPrepShutdown(UringGetSqe(&conn->loop->ring), conn->fd,
+                          UringTag(conn, URING_OP_SHUTDOWN));
+        conn->uring_ops++;
+        conn->closing_fd = conn->fd;
+    } else {
+        // Копия eventfd есть у клиента, поэтому close не снимает его с epoll
+        if (conn->protocol == CONN_PROTOCOL_SHM) {
+            epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_DEL, conn->shm.bell, NULL);
+            ShmDetach(&conn->shm);
+        }
+        epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        shutdown(conn->fd, SHUT_RDWR);
+        close(conn->fd);
+    }
+    conn->fd = -1;
+    if (conn->protocol == CONN_PROTOCOL_CHILD)
+        TimerCancel(&conn->loop->wheel, &conn->deadline);
+    if (conn->protocol != CONN_PROTOCOL_CHILD) {
+        Count(conn->loop, METRICS_CLOSED, 1);
+        atomic_fetch_sub(&conn->loop->admission->connections, 1);
+        // Ответы отправлять больше некому
+        for (struct Request *request = conn->head; request != NULL; request = request->next)
+            CancelRequest(request);
+    } else if (conn->parent != NULL && Cancelled(conn->parent)) {
+        struct Request *request = conn->parent;
+        conn->parent = NULL;
+        FinishTasks(request, request->item_count);
+    } else if (conn->parent != NULL) {
+        RunChildLocally(conn);
+    }
+}
+
+// Что не поместилось в кольцо ответов, ждёт в out, пока клиент не
+// освободит место и не разбудит eventfd сервера
+static void ShmFlush(struct Connection *conn) {
+    if (conn->fd < 0 || conn->out_sent == conn->out_len)
+        return;
+    long sent = ShmSend(&conn->shm, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+    if (sent < 0) {
+        LOG(LOG_WARN, "Shared memory ring corrupted by client\n");
+        CloseSocket(conn);
+        return;
+    }
+    conn->out_sent += (size_t)sent;
+    Count(conn->loop, METRICS_BYTES_OUT, (uint64_t)sent);
+    if (conn->out_sent == conn->out_len) {
+        conn->out_len = 0;
+        conn->out_sent = 0;
+    }
+}
+
+static void FlushOutput(struct Connection *conn) {
+    if (conn->uring) {
+        UringFlush(conn);
+        return;
+    }
+    if (conn->protocol == CONN_PROTOCOL_SHM) {
+        ShmFlush(conn);
+        return;
+    }
+    while (conn->fd >= 0 && conn->out_sent < conn->out_len) {
+        ssize_t sent = send(conn->fd, conn->out + conn->out_sent,
+                            conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR)
+                continue;
+            LOG(LOG_WARN, "Can't send data to client\n");
+            CloseSocket(conn);
+            return;
+        }
+        conn->out_sent += (size_t)sent;
+        Count(conn->loop, METRICS_BYTES_OUT, (uint64_t)sent);
+    }
+
+    conn->out_len = 0;
+    conn->out_sent = 0;
+}
+
+static void AppendOutput(struct Connection *conn, const void *data, size_t size) {
+    if (conn->out_len + size > conn->out_cap) {
+        size_t cap = conn->out_cap == 0 ? 64 : conn->out_cap;
+        while (cap < conn->out_len + size)
+            cap *= 2;
+        conn->out = realloc(conn->out, cap);
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out + conn->out_len, data, size);
+    conn->out_len += size;
+}
+
+static void AppendResponse(struct Connection *conn, struct Request *request) {
+    if (conn->protocol == CONN_PROTOCOL_V1) {
+        AppendOutput(conn, &request->items[0].result, PROTO_V1_RESPONSE_SIZE);
+        return;
+    }
+
+    uint32_t count = (uint32_t)request->item_count;
+    bool wide = request->opcode == PROTO_OP_REDUCE;
+    bool exact = request->opcode == PROTO_OP_EXACT && request->status == PROTO_STATUS_OK;
+    if (exact)
+        count = (uint32_t)request->items[0].exact.size;
+    size_t length = 0;
+    if (request->status == PROTO_STATUS_OK)
+        length = wide ? ProtoWideResultPayloadSize(count) : ProtoResultPayloadSize(count);
+    else if (request->status == PROTO_STATUS_OVERLOADED)
+        length = PROTO_RETRY_AFTER_SIZE;
+    unsigned char *frame = malloc(PROTO_HEADER_SIZE + length);
+    uint8_t opcode = request->tree ? PROTO_OP_AGGREGATE : request->opcode;
+    struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION, opcode, request->status,
+                                 (uint32_t)length, request->id};
+    ProtoEncodeHeader(&header, frame);
+    if (request->status == PROTO_STATUS_OVERLOADED) {
+        ProtoPutU32(frame + PROTO_HEADER_SIZE, conn->loop->admission->retry_after_ms);
+    } else if (length > 0 && wide) {
+        unsigned __int128 *values = malloc(sizeof(unsigned __int128) * count);
+        for (uint32_t i = 0; i < count; i++)
+            values[i] = request->items[i].value;
+        ProtoEncodeWideResults(values, count, frame + PROTO_HEADER_SIZE);
+        free(values);
+    } else if (exact) {
+        ProtoEncodeResults(request->items[0].exact.limbs, count, frame + PROTO_HEADER_SIZE);
+    } else if (length > 0) {
+        uint64_t *results = malloc(sizeof(uint64_t) * count);
+        for (uint32_t i = 0; i < count; i++)
+            results[i] = request->items[i].result;
+        ProtoEncodeResults(results, count, frame + PROTO_HEADER_SIZE);
+        free(results);
+    }
+    AppendOutput(conn, frame, PROTO_HEADER_SIZE + length);
+    free(frame);
+}
+
+static void RecordAnswered(struct EventLoop *loop, const struct Request *request) {
+    struct Metrics *metrics = loop->metrics;
+    if (metrics == NULL)
+        return;
+    MetricsAdd(metrics, METRICS_REQUESTS, 1);
+    MetricsAdd(metrics, METRICS_RANGES, (uint64_t)request->item_count);
+    if (request->status != PROTO_STATUS_OK && request->status != PROTO_STATUS_CANCELLED &&
+        request->status != PROTO_STATUS_OVERLOADED)
+        MetricsAdd(metrics, METRICS_ERRORS, 1);
+    // Запросы, целиком взятые из кэша, вычислений не содержат
+    uint64_t compute_start = atomic_load(&request->compute_start_ns);
+    if (request->parts > 0 && compute_start != 0)
+        MetricsRecord(metrics, METRICS_COMPUTE, request->compute_end_ns - compute_start);
+    MetricsRecord(metrics, METRICS_END_TO_END, MetricsNowNs() - request->received_ns);
+}
+
+// Ответ, собранный в conn->out, уходит одной датаграммой
+static void SendDatagram(struct Connection *conn, const struct Request *request) {
+    ssize_t sent = sendto(conn->fd, conn->out, conn->out_len, 0,
+                          (const struct sockaddr *)&request->peer, request->peer_len);
+    if (sent < 0)
+        LOG(LOG_WARN, "Could not send datagram reply\n"); // клиент повторит запрос
+    else
+        Count(conn->loop, METRICS_BYTES_OUT, (uint64_t)sent);
+    conn->out_len = 0;
+}
+
+// v1 отвечает строго в порядке запросов, v2 и UDP — по мере готовности
+static void SendReadyResponses(struct Connection *conn) {
+    bool in_order = conn->protocol == CONN_PROTOCOL_V1;
+    struct Request *prev = NULL;
+    struct Request *request = conn->head;
+    while (request != NULL) {
+        struct Request *next = request->next;
+        if (!request->done) {
+            if (in_order)
+                break;
+            prev = request;
+            request = next;
+            continue;
+        }
+
+        if (prev != NULL)
+            prev->next = next;
+        else
+            conn->head = next;
+        if (conn->tail == request)
+            conn->tail = prev;
+
+        // Результаты отменённого запроса не досчитаны и в кэш не идут
+        bool cacheable = request->opcode == PROTO_OP_RANGE && request->status == PROTO_STATUS_OK;
+        for (int i = 0; cacheable && i < request->item_count; i++) {
+            struct RangeItem *item = &request->items[i];
+            LOG(LOG_DEBUG, "Total: %lu\n", item->result);
+            if (conn->loop->cache != NULL)
+                RangeCacheInsert(conn->loop->cache, item->args.mod, item->args.begin,
+                                 item->args.end, item->result);
+        }
+        if (conn->fd >= 0) {
+            AppendResponse(conn, request);
+            if (conn->protocol == CONN_PROTOCOL_UDP)
+                SendDatagram(conn, request);
+            RecordAnswered(conn->loop, request);
+        }
+        conn->pending--;
+        FreeRequest(request);
+        request = next;
+    }
+    FlushOutput(conn);
+}
+
+static void EnqueueRequest(struct Connection *conn, struct Request *request) {
+    if (conn->tail != NULL)
+        conn->tail->next = request;
+    else
+        conn->head = request;
+    conn->tail = request;
+    conn->pending++;
+}
+
+static struct Request *StartRanges(struct Connection *conn, uint64_t id,
+                                   const struct FactorialArgs *args, int count) {
+    struct CachePlan *plans = malloc(sizeof(struct CachePlan) * (size_t)count);
+    for (int i = 0; i < count; i++) {
+        LOG(LOG_DEBUG, "Receive: %lu %lu %lu\n", args[i].begin, args[i].end, args[i].mod);
+        PlanRequest(conn->loop, &args[i], &plans[i]);
+    }
+    struct Request *request = StartRequest(conn, id, args, plans, count);
+    free(plans);
+    return request;
+}
+
+// Доля [begin, end], приходящаяся на веса [from, from + weight) из total.
+// Пустая доля — begin > end.
+static void TreeShare(uint64_t begin, uint64_t end, uint32_t total, uint32_t from,
+                      uint32_t weight, uint64_t *share_begin, uint64_t *share_end) {
+    *share_begin = 1;
+    *share_end = 0;
+    if (begin > end)
+        return;
+    unsigned __int128 length = (unsigned __int128)(end - begin) + 1;
+    unsigned __int128 low = length * from / total;
+    unsigned __int128 high = length * (from + weight) / total;
+    if (low == high)
+        return;
+    *share_begin = begin + (uint64_t)low;
+    *share_end = begin + (uint64_t)(high - 1);
+}
+
+// Задачи пула на собственную долю узла
+static uint64_t OwnShareTasks(const struct ThreadPool *pool, const struct ReduceArgs *reductions,
+                              int item, uint64_t begin, uint64_t end) {
+    if (reductions == NULL)
+        return TaskCount(pool, begin, end);
+    struct ReduceArgs share = reductions[item];
+    share.begin = begin;
+    share.end = end;
+    return ReduceTaskCount(pool, &share);
+}
+
+static void ItemBounds(const struct Request *request, int item, uint64_t *begin, uint64_t *end) {
+    const struct RangeItem *range_item = &request->items[item];
+    *begin = request->opcode == PROTO_OP_REDUCE ? range_item->reduce.begin : range_item->args.begin;
+    *end = request->opcode == PROTO_OP_REDUCE ? range_item->reduce.end : range_item->args.end;
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Переставляет timer_fd цикла на ближайший тик колеса или снимает его
+static void ScheduleTimers(struct EventLoop *loop) {
+    int ms = TimerWheelTimeoutMs(&loop->wheel, NowSeconds());
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (ms >= 0) {
+        // Нулевое значение снимает таймер, поэтому срок не меньше 1 нс
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = ms % 1000 * 1000000L + 1;
+    }
+    timerfd_settime(loop->timer_fd, 0, &spec, NULL);
+}
+
+// Узел принял соединение, но не ответил в срок: связь закрывается, и
+// CloseSocket отдаёт долю группы пулу, как при отказе в соединении
+static void ExpireChild(struct Timer *timer, void *arg) {
+    (void)arg;
+    struct Connection *link =
+        (struct Connection *)((char *)timer - offsetof(struct Connection, deadline));
+    CloseSocket(link);
+}
+
+static void ExpireTimers(struct EventLoop *loop) {
+    uint64_t ticks;
+    while (read(loop->timer_fd, &ticks, sizeof(ticks)) < 0 && errno == EINTR) {
+    }
+    TimerWheelAdvance(&loop->wheel, NowSeconds(), ExpireChild, loop);
+    ScheduleTimers(loop);
+}
+
+// Отправляет группе g её долю всех диапазонов: первому узлу группы, с
+// остальными узлами как его поддеревом. Связь одноразовая: кадр туда, ответ
+// обратно. Если соединиться не удалось или узел не ответил за
+// child_timeout секунд, долю досчитывает пул.
+static void OpenChild(struct Request *request, const struct ProtoTree *tree,
+                      const struct ProtoNode *children, int g) {
+    uint32_t first;
+    uint32_t size;
+    ProtoTreeGroup(tree->child_count, tree->fanout, (uint32_t)g, &first, &size);
+    const struct ProtoNode *node = &children[first];
+    struct ProtoTree subtree = {tree->opcode, tree->fanout, size - 1};
+    uint32_t count = (uint32_t)request->item_count;
+    bool reduce = tree->opcode == PROTO_OP_REDUCE;
+    size_t tree_size = subtree.child_count > 0 ? ProtoTreeSize(subtree.child_count) : 0;
+    size_t length = tree_size + (reduce ? ProtoReducePayloadSize(count)
+                                        : ProtoRangePayloadSize(count));
+
+    unsigned char *frame = malloc(PROTO_HEADER_SIZE + length);
+    struct FrameHeader header = {PROTO_MAGIC, PROTO_VERSION,
+                                 tree_size > 0 ? PROTO_OP_AGGREGATE : tree->opcode,
+                                 PROTO_STATUS_OK, (uint32_t)length, request->id};
+    ProtoEncodeHeader(&header, frame);
+    if (tree_size > 0)
+        ProtoEncodeTree(&subtree, node + 1, frame + PROTO_HEADER_SIZE);
+    unsigned char *payload = frame + PROTO_HEADER_SIZE + tree_size;
+    if (reduce) {
+        struct ReduceArgs *shares = malloc(sizeof(struct ReduceArgs) * count);
+        for (int i = 0, j = 0; i < request->parts; i++) {
+            if (request->tasks[i].child == g)
+                shares[j++] = request->tasks[i].reduce;
+        }
+        ProtoEncodeReductions(shares, count, payload);
+        free(shares);
+    } else {
+        struct FactorialArgs *shares = malloc(sizeof(struct FactorialArgs) * count);
+        for (int i = 0, j = 0; i < request->parts; i++) {
+            if (request->tasks[i].child == g)
+                shares[j++] = request->tasks[i].args;
+        }
+        ProtoEncodeRanges(shares, count, payload);
+        free(shares);
+    }
+
+    struct Connection *link = calloc(1, sizeof(struct Connection));
+    link->loop = request->conn->loop;
+    link->protocol = CONN_PROTOCOL_CHILD;
+    link->parent = request;
+    link->child = g;
+    link->pending = 1;          // освобождается вместе с запросом
+    link->next_link = request->links;
+    request->links = link;
+    struct sockaddr_in *addr = (struct sockaddr_in *)&link->peer;
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(node->ip);
+    addr->sin_port = htons(node->port);
+    link->peer_len = sizeof(*addr);
+    AppendOutput(link, frame, PROTO_HEADER_SIZE + length);
+    free(frame);
+
+    // Кадр уходит по EPOLLOUT, когда соединение установится
+    link->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = link;
+    bool started = link->fd >= 0 &&
+                   (connect(link->fd, (struct sockaddr *)addr, link->peer_len) == 0 ||
+                    errno == EINPROGRESS) &&
+                   epoll_ctl(link->loop->epoll_fd, EPOLL_CTL_ADD, link->fd, &event) == 0;
+    if (!started) {
+        if (link->fd >= 0)
+            CloseSocket(link);
+        else
+            RunChildLocally(link);
+        return;
+    }
+    TimerArm(&link->loop->wheel, &link->deadline, NowSeconds(), link->loop->child_timeout);
+    ScheduleTimers(link->loop);
+}
+
+// Узел дерева считает долю с весом 1, каждая группа поддерева — долю с
+// весом, равным числу её узлов. Мелкий запрос дешевле досчитать самому.
+static struct Request *StartTree(struct Connection *conn, uint64_t id,
+                                 const struct ProtoTree *tree, const struct ProtoNode *children,
+                                 const struct FactorialArgs *ranges,
+                                 const struct ReduceArgs *reductions, int count) {
+    struct ThreadPool *pool = conn->loop->pool;
+    uint64_t work = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t begin = ranges != NULL ? ranges[i].begin : reductions[i].begin;
+        uint64_t end = ranges != NULL ? ranges[i].end : reductions[i].end;
+        if (begin <= end && (ranges != NULL || !ReduceClosedForm(&reductions[i])))
+            work += end - begin + 1;
+    }
+    if (tree->child_count == 0 || work / (tree->child_count + 1) < SPLIT_MIN_RANGE) {
+        struct Request *request = ranges != NULL ? StartRanges(conn, id, ranges, count)
+                                                 : StartReduce(conn, id, reductions, count);
+        request->tree = true;
+        return request;
+    }
+
+    uint32_t groups = ProtoTreeGroups(tree->child_count, tree->fanout);
+    uint32_t total = tree->child_count + 1;
+    uint64_t parts = (uint64_t)groups * (uint64_t)count;
+    for (int i = 0; i < count; i++) {
+        uint64_t begin;
+        uint64_t end;
+        TreeShare(ranges != NULL ? ranges[i].begin : reductions[i].begin,
+                  ranges != NULL ? ranges[i].end : reductions[i].end, total, 0, 1, &begin, &end);
+        parts += OwnShareTasks(pool, reductions, i, begin, end);
+    }
+
+    struct Request *request = NewRequest(conn, id, tree->opcode, count, parts);
+    request->tree = true;
+    // Свою долю узел считает сам, доли поддеревьев допускают их узлы
+    if (!Admit(request, work / total))
+        return ShedRequest(request);
+    int task = 0;
+    for (int i = 0; i < count; i++) {
+        if (ranges != NULL) {
+            request->items[i].args = ranges[i];
+            request->items[i].num = 1;
+            request->items[i].den = 1;
+        } else {
+            request->items[i].reduce = reductions[i];
+        }
+        uint64_t item_begin;
+        uint64_t item_end;
+        ItemBounds(request, i, &item_begin, &item_end);
+
+        uint64_t begin;
+        uint64_t end;
+        TreeShare(item_begin, item_end, total, 0, 1, &begin, &end);
+        task = AddTasks(request, i, task, OwnShareTasks(pool, reductions, i, begin, end), begin,
+                        end, false);
+        for (uint32_t g = 0; g < groups; g++) {
+            uint32_t first;
+            uint32_t size;
+            ProtoTreeGroup(tree->child_count, tree->fanout, g, &first, &size);
+            TreeShare(item_begin, item_end, total, 1 + first, size, &begin, &end);
+            InitTask(request, task++, i, begin, end)->child = (int)g;
+        }
+    }
+
+    // Как и в LaunchRequest, задачи уходят в пул только после заполнения всех
+    for (int i = 0; i < request->parts; i++) {
+        if (request->tasks[i].child < 0)
+            ThreadPoolSubmit(pool, &request->tasks[i].task);
+    }
+    for (uint32_t g = 0; g < groups; g++)
+        OpenChild(request, tree, children, (int)g);
+    return request;
+}
+
+// Разбирает один запрос v1. Возвращает число использованных байт, 0 если
+// запрос ещё не пришёл целиком, -1 если соединение надо закрыть.
+static long ParseV1(struct Connection *conn, const unsigned char *data, size_t size) {
+    if (size < PROTO_V1_REQUEST_SIZE)
+        return 0;
+
+    struct FactorialArgs args;
+    memcpy(&args.begin, data, sizeof(uint64_t));
+    memcpy(&args.end, data + sizeof(uint64_t), sizeof(uint64_t));
+    memcpy(&args.mod, data + 2 * sizeof(uint64_t), sizeof(uint64_t));
+    if (args.mod == 0) {
+        LOG(LOG_WARN, "Client send zero modulus\n");
+        return -1;
+    }
+
+    EnqueueRequest(conn, StartRanges(conn, 0, &args, 1));
+    return (long)PROTO_V1_REQUEST_SIZE;
+}
+
+// Диапазоны кадра PROTO_OP_RANGE: число диапазонов или -1, если данные
+// некорректны или у какого-то диапазона нулевой модуль
+static int DecodeValidRanges(const unsigned char *payload, size_t length,
+                             struct FactorialArgs *args) {
+    int count = ProtoDecodeRanges(payload, length, args, PROTO_MAX_RANGES);
+    for (int i = 0; i < count; i++) {
+        if (args[i].mod == 0)
+            return -1;
+    }
+    return count;
+}
+
+// Свёртки кадра PROTO_OP_REDUCE: неизвестная операция или генератор, как и
+// произведение по нулевому модулю, — ошибка всего кадра
+static int DecodeValidReductions(const unsigned char *payload, size_t length,
+                                 struct ReduceArgs *args) {
+    int count = ProtoDecodeReductions(payload, length, args, PROTO_MAX_REDUCTIONS);
+    for (int i = 0; i < count; i++) {
+        if (!ReduceValid(&args[i].spec))
+            return -1;
+    }
+    for (int i = 0; i < count; i++)
+        LOG(LOG_DEBUG, "Reduce: %s %lu %lu\n", ReduceOpName(args[i].spec.op), args[i].begin,
+            args[i].end);
+    return count;
+}
+
+static void ParseReduce(struct Connection *conn, const struct FrameHeader *header,
+                        const unsigned char *payload) {
+    struct ReduceArgs *args = malloc(sizeof(struct ReduceArgs) * PROTO_MAX_REDUCTIONS);
+    int count = DecodeValidReductions(payload, header->length, args);
+    if (count > 0)
+        EnqueueRequest(conn, StartReduce(conn, header->request_id, args, count));
+    else
+        EnqueueRequest(conn, ErrorRequest(conn, header->request_id, header->opcode,
+                                          PROTO_STATUS_BAD_REQUEST));
+    free(args);
+}
+
+// Кадр PROTO_OP_EXACT. Ответ может не уместиться в датаграмму, поэтому по
+// UDP такой запрос не принимается.
+static void ParseExact(struct Connection *conn, const struct FrameHeader *header,
+                       const unsigned char *payload) {
+    if (conn->protocol == CONN_PROTOCOL_UDP) {
+        EnqueueRequest(conn, ErrorRequest(conn, header->request_id, header->opcode,
+                                          PROTO_STATUS_UNSUPPORTED));
+        return;
+    }
+    struct FactorialArgs args;
+    int count = ProtoDecodeRanges(payload, header->length, &args, 1);
+    if (count != 1 || args.mod != 0 || args.begin == 0 || args.begin > args.end ||
+        args.end - args.begin >= PROTO_MAX_EXACT_RANGE) {
+        EnqueueRequest(conn, ErrorRequest(conn, header->request_id, header->opcode,
+                                          PROTO_STATUS_BAD_REQUEST));
+        return;
+    }
+    LOG(LOG_DEBUG, "Exact: %lu %lu\n", args.begin, args.end);
+    EnqueueRequest(conn, StartExact(conn, header->request_id, &args));
+}
+
+// Кадр PROTO_OP_AGGREGATE: заголовок дерева, затем вложенный запрос
+static void ParseTree(struct Connection *conn, const struct FrameHeader *header,
+                      const unsigned char *payload) {
+    struct ProtoTree tree;
+    struct ProtoNode *children = malloc(sizeof(struct ProtoNode) * PROTO_MAX_CHILDREN);
+    long offset = ProtoDecodeTree(payload, header->length, &tree, children, PROTO_MAX_CHILDREN);
+    struct FactorialArgs *ranges = NULL;
+    struct ReduceArgs *reductions = NULL;
+    int count = -1;
+    if (offset >= 0 && tree.opcode == PROTO_OP_REDUCE) {
+        reductions = malloc(sizeof(struct ReduceArgs) * PROTO_MAX_REDUCTIONS);
+        count = DecodeValidReductions(payload + offset, header->length - (size_t)offset,
+                                      reductions);
+    } else if (offset >= 0) {
+        ranges = malloc(sizeof(struct FactorialArgs) * PROTO_MAX_RANGES);
+        count = DecodeValidRanges(payload + offset, header->length - (size_t)offset, ranges);
+    }
+
+    if (count > 0) {
+        LOG(LOG_DEBUG, "Tree request %lu: %d items, %u children, fanout %u\n",
+            header->request_id, count, tree.child_count, tree.fanout);
+        EnqueueRequest(conn, StartTree(conn, header->request_id, &tree, children, ranges,
+                                       reductions, count));
+    } else {
+        EnqueueRequest(conn, ErrorRequest(conn, header->request_id, header->opcode,
+                                          PROTO_STATUS_BAD_REQUEST));
+    }
+    free(children);
+    free(ranges);
+    free(reductions);
+}
+
+// Кадр PROTO_OP_CANCEL. Запрос, на который уже ответили, не найдётся.
+static void CancelById(struct Connection *conn, uint64_t id) {
+    for (struct Request *request = conn->head; request != NULL; request = request->next) {
+        if (request->id != id)
+            continue;
+        if (conn->protocol == CONN_PROTOCOL_UDP &&
+            (request->peer_len != conn->peer_len ||
+             memcmp(&request->peer, &conn->peer, conn->peer_len) != 0))
+            continue;
+        LOG(LOG_DEBUG, "Cancel request %lu\n", id);
+        CancelRequest(request);
+    }
+}
+
+// Переводит соединение с unix-сокета на каналы в общей памяти и отдаёт
+// клиенту их дескрипторы. false — соединение нужно закрыть.
+static bool AttachShm(struct Connection *conn, const struct FrameHeader *header) {
+    if (!conn->local || conn->protocol != CONN_PROTOCOL_V2 || conn->head != NULL ||
+        conn->out_len > 0) {
+        EnqueueRequest(conn, ErrorRequest(conn, header->request_id, header->opcode,
+                                          PROTO_STATUS_UNSUPPORTED));
+        return true;
+    }
+
+    int fds[3] = {ShmCreate(), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+                  eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+        LOG(LOG_WARN, "Could not create shared memory channel (errno %d)\n", errno);
+        for (int i = 0; i < 3; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+        return false;
+    }
+    if (ShmAttach(&conn->shm, fds[0], true, fds[1], fds[2]) != 0) {
+        LOG(LOG_WARN, "Could not map shared memory channel (errno %d)\n", errno);
+        for (int i = 0; i < 3; i++)
+            close(fds[i]);
+        return false;
+    }
+
+    unsigned char reply[PROTO_HEADER_SIZE];
+    struct FrameHeader header_out = {PROTO_MAGIC, PROTO_VERSION, PROTO_OP_SHM_ATTACH,
+                                     PROTO_STATUS_OK, 0, header->request_id};
+    ProtoEncodeHeader(&header_out, reply);
+    int sent = SendFds(conn->fd, reply, sizeof(reply), fds, 3);
+    close(fds[0]);
+    conn->protocol = CONN_PROTOCOL_SHM;
+    if (sent != 0) {
+        LOG(LOG_WARN, "Could not pass shared memory channel to client\n");
+        return false;
+    }
+
+    // Данные идут кольцами, от сокета нужно только закрытие
+    struct epoll_event event;
+    event.events = EPOLLRDHUP;
+    event.data.ptr = conn;
+    epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    event.events = EPOLLIN;
+    if (epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_ADD, conn->shm.bell, &event) < 0) {
+        LOG(LOG_WARN, "Could not watch shared memory channel\n");
+        return false;
+    }
+    Count(conn->loop, METRICS_BYTES_OUT, sizeof(reply));
+    return true;
+}
+
+// Разбирает один кадр v2, те же возвращаемые значения, что у ParseV1
+static long ParseV2(struct Connection *conn, const unsigned char *data, size_t size) {
+    if (size < PROTO_HEADER_SIZE)
+        return 0;
+
+    struct FrameHeader header;
+    ProtoDecodeHeader(data, &header);
+    if (header.magic != PROTO_MAGIC) {
+        LOG(LOG_WARN, "Client send wrong data format\n");
+        return -1;
+    }
+    if (header.length > PROTO_MAX_PAYLOAD) {
+        // Пропустить такой кадр можно, но буферизовать его незачем
+        LOG(LOG_WARN, "Client frame is too long: %u bytes\n", header.length);
+        EnqueueRequest(conn, ErrorRequest(conn, header.request_id, header.opcode,
+                                          PROTO_STATUS_BAD_REQUEST));
+        return -1;
+    }
+    if (size < PROTO_HEADER_SIZE + header.length)
+        return 0;
+    long used = (long)(PROTO_HEADER_SIZE + header.length);
+
+    if (header.version != PROTO_VERSION ||
+        (header.opcode != PROTO_OP_RANGE && header.opcode != PROTO_OP_REDUCE &&
+         header.opcode != PROTO_OP_AGGREGATE && header.opcode != PROTO_OP_CANCEL &&
+         header.opcode != PROTO_OP_SHM_ATTACH && header.opcode != PROTO_OP_EXACT)) {
+        EnqueueRequest(conn, ErrorRequest(conn, header.request_id, header.opcode,
+                                          PROTO_STATUS_UNSUPPORTED));
+        return used;
+    }
+    if (header.opcode == PROTO_OP_CANCEL) {
+        CancelById(conn, header.request_id);
+        return used;
+    }
+    if (header.opcode == PROTO_OP_SHM_ATTACH)
+        return AttachShm(conn, &header) ? used : -1;
+    if (header.opcode == PROTO_OP_REDUCE) {
+        ParseReduce(conn, &header, data + PROTO_HEADER_SIZE);
+        return used;
+    }
+    if (header.opcode == PROTO_OP_AGGREGATE) {
+        ParseTree(conn, &header, data + PROTO_HEADER_SIZE);
+        return used;
+    }
+    if (header.opcode == PROTO_OP_EXACT) {
+        ParseExact(conn, &header, data + PROTO_HEADER_SIZE);
+        return used;
+    }
+
+    struct FactorialArgs *args = malloc(sizeof(struct FactorialArgs) * PROTO_MAX_RANGES);
+    int count = DecodeValidRanges(data + PROTO_HEADER_SIZE, header.length, args);
+    if (count > 0)
+        EnqueueRequest(conn, StartRanges(conn, header.request_id, args, count));
+    else
+        EnqueueRequest(conn, ErrorRequest(conn, header.request_id, header.opcode,
+                                          PROTO_STATUS_BAD_REQUEST));
+    free(args);
+    return used;
+}
+
+// Ответ узла поддерева на кадр OpenChild. После него связь закрывается;
+// ответ с ошибкой или чужим request_id равносилен отказу узла.
+static long ParseChildReply(struct Connection *link, const unsigned char *data, size_t size) {
+    if (size < PROTO_HEADER_SIZE)
+        return 0;
+    struct FrameHeader header;
+    ProtoDecodeHeader(data, &header);
+    if (header.magic != PROTO_MAGIC || header.length > PROTO_MAX_PAYLOAD)
+        return -1;
+    if (size < PROTO_HEADER_SIZE + header.length)
+        return 0;
+
+    struct Request *request = link->parent;
+    const unsigned char *payload = data + PROTO_HEADER_SIZE;
+    int count = request->item_count;
+    bool valid = header.status == PROTO_STATUS_OK && header.request_id == request->id;
+    if (valid && request->opcode == PROTO_OP_REDUCE) {
+        unsigned __int128 *values = malloc(sizeof(unsigned __int128) * (size_t)count);
+        valid = ProtoDecodeWideResults(payload, header.length, values, (uint32_t)count) == count;
+        for (int i = 0, j = 0; valid && i < request->parts; i++) {
+            if (request->tasks[i].child == link->child)
+                request->tasks[i].value = values[j++];
+        }
+        free(values);
+    } else if (valid) {
+        uint64_t *results = malloc(sizeof(uint64_t) * (size_t)count);
+        valid = ProtoDecodeResults(payload, header.length, results, (uint32_t)count) == count;
+        for (int i = 0, j = 0; valid && i < request->parts; i++) {
+            if (request->tasks[i].child == link->child)
+                request->tasks[i].result = results[j++];
+        }
+        free(results);
+    }
+    if (!valid) {
+        LOG(LOG_WARN, "Child rejected request %lu with status %u\n", header.request_id,
+            header.status);
+        return -1;
+    }
+
+    link->parent = NULL;
+    FinishTasks(request, count);
+    return -1;
+}
+
+// Разбирает все целиком пришедшие запросы и сдвигает остаток в начало буфера
+static bool ParseInput(struct Connection *conn) {
+    size_t offset = 0;
+    bool keep_open = true;
+    while (keep_open) {
+        const unsigned char *data = conn->in + offset;
+        size_t size = conn->in_len - offset;
+        if (conn->protocol == CONN_PROTOCOL_UNKNOWN) {
+            if (size < sizeof(uint32_t))
+                break;
+            conn->protocol = ProtoIsFrameStart(data) ? CONN_PROTOCOL_V2 : CONN_PROTOCOL_V1;
+        }
+
+        long used;
+        if (conn->protocol == CONN_PROTOCOL_CHILD)
+            used = ParseChildReply(conn, data, size);
+        else if (conn->protocol == CONN_PROTOCOL_V2 || conn->protocol == CONN_PROTOCOL_SHM)
+            used = ParseV2(conn, data, size);
+        else
+            used = ParseV1(conn, data, size);
+        if (used < 0)
+            keep_open = false;
+        else if (used == 0)
+            break;
+        else
+            offset += (size_t)used;
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+    return keep_open;
+}
+
+static void ReserveInput(struct Connection *conn, size_t size) {
+    if (conn->in_cap - conn->in_len >= size)
+        return;
+    size_t cap = conn->in_cap == 0 ? READ_CHUNK : conn->in_cap * 2;
+    while (cap - conn->in_len < size)
+        cap *= 2;
+    conn->in = realloc(conn->in, cap);
+    conn->in_cap = cap;
+}
+
+// Клиент закрыл соединение, и его незавершённые запросы отменяются
+static void ClientLeft(struct Connection *conn) {
+    if (conn->in_len != 0)
+        LOG(LOG_WARN, "Client send wrong data format\n");
+    CloseSocket(conn);
+}
+
+// В conn->in дописаны size байт: разбор, ответы на готовые запросы
+static void HandleInput(struct Connection *conn, size_t size) {
+    conn->in_len += size;
+    Count(conn->loop, METRICS_BYTES_IN, (uint64_t)size);
+    bool keep_open = ParseInput(conn);
+    SendReadyResponses(conn);
+    if (!keep_open)
+        CloseSocket(conn);
+}
+
+static void ReadRequests(struct Connection *conn) {
+    while (conn->fd >= 0) {
+        ReserveInput(conn, READ_CHUNK);
+
+        ssize_t read_bytes = recv(conn->fd, conn->in + conn->in_len,
+                                  conn->in_cap - conn->in_len, 0);
+        // Закрытие соединения клиентом считается уходом клиента, а не
+        // полузакрытием
+        if (read_bytes == 0) {
+            ClientLeft(conn);
+            return;
+        }
+        if (read_bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR)
+                continue;
+            LOG(LOG_WARN, "Client read failed\n");
+            CloseSocket(conn);
+            return;
+        }
+
+        HandleInput(conn, (size_t)read_bytes);
+    }
+}
+
+// Разбирает всё, что клиент успел записать в кольцо запросов, и дописывает
+// ответы, ждавшие места в кольце ответов
+static void ServeShm(struct Connection *conn) {
+    ShmClearBell(&conn->shm);
+    while (conn->fd >= 0) {
+        ReserveInput(conn, READ_CHUNK);
+        long size = ShmReceive(&conn->shm, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (size < 0) {
+            LOG(LOG_WARN, "Shared memory ring corrupted by client\n");
+            CloseSocket(conn);
+            return;
+        }
+        if (size == 0)
+            break;
+        HandleInput(conn, (size_t)size);
+    }
+    FlushOutput(conn);
+}
+
+// Каждая датаграмма — один кадр v2. Неполные и повреждённые датаграммы
+// отбрасываются: клиент повторит запрос по тайм-ауту.
+static void ReadDatagrams(struct Connection *conn) {
+    while (true) {
+        conn->peer_len = sizeof(conn->peer);
+        ssize_t size = recvfrom(conn->fd, conn->in, conn->in_cap, 0,
+                                (struct sockaddr *)&conn->peer, &conn->peer_len);
+        if (size < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG(LOG_WARN, "Datagram read failed\n");
+            return;
+        }
+        Count(conn->loop, METRICS_BYTES_IN, (uint64_t)size);
+        if (ParseV2(conn, conn->in, (size_t)size) != size)
+            LOG(LOG_WARN, "Malformed datagram of %ld bytes\n", (long)size);
+        SendReadyResponses(conn);
+    }
+}
+
+// Соединения с TCP-порта или, если local, с unix-сокета
+static void AcceptConnections(struct EventLoop *loop, int listen_fd, bool local) {
+    while (true) {
+        struct sockaddr_storage client;
+        socklen_t client_len = sizeof(client);
+        int client_fd = accept(listen_fd, (struct sockaddr *)&client, &client_len);
+
+        if (client_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            LOG(LOG_WARN, "Could not establish new connection\n");
+            return;
+        }
+
+        if (SetNonBlocking(client_fd) < 0) {
+            close(client_fd);
+            continue;
+        }
+
+        struct Connection *conn = calloc(1, sizeof(struct Connection));
+        conn->fd = client_fd;
+        conn->loop = loop;
+        conn->local = local;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) < 0) {
+            LOG(LOG_WARN, "Could not watch new connection\n");
+            close(client_fd);
+            free(conn);
+            continue;
+        }
+        Count(loop, METRICS_ACCEPTED, 1);
+        atomic_fetch_add(&loop->admission->connections, 1);
+    }
+}
+
+// Забирает у пула завершённые запросы и отправляет ответы
+static void DrainCompleted(struct EventLoop *loop) {
+    // Чтение eventfd обнуляет счётчик целиком, повторять его незачем
+    uint64_t counter;
+    if (read(loop->wake_fd, &counter, sizeof(counter)) < 0 && errno != EAGAIN)
+        LOG(LOG_ERROR, "Could not read wake counter\n");
+
+    pthread_mutex_lock(&loop->done_mutex);
+    struct Request *done = loop->done_head;
+    loop->done_head = NULL;
+    pthread_mutex_unlock(&loop->done_mutex);
+
+    while (done != NULL) {
+        struct Request *next = done->next_done;
+        struct Connection *conn = done->conn;
+        done->done = true;
+        SendReadyResponses(conn);
+        ReleaseIfIdle(conn);
+        done = next;
+    }
+}
+
+// У соединения SHM два дескриптора в epoll, сокет и eventfd: освобождать
+// его можно только на последнем из его событий пачки
+static bool LaterEvent(const struct epoll_event *events, int i, int count) {
+    for (int j = i + 1; j < count; j++) {
+        if (events[j].data.ptr == events[i].data.ptr)
+            return true;
+    }
+    return false;
+}
+
+// События epoll одной пачки. Готовые запросы разбираются после остальных
+// событий: при этом соединение может освободиться, а на него ещё могут
+// ссылаться события. В режиме io_uring здесь остаются только UDP-сокет,
+// unix-сокет с его соединениями и связи с поддеревьями.
+static void HandleEvents(struct EventLoop *loop, const struct epoll_event *events, int count) {
+    bool woken = false;
+    bool expired = false;
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.ptr == &loop->listen_fd) {
+            AcceptConnections(loop, loop->listen_fd, false);
+            continue;
+        }
+        if (events[i].data.ptr == &loop->unix_fd) {
+            AcceptConnections(loop, loop->unix_fd, true);
+            continue;
+        }
+        if (events[i].data.ptr == &loop->wake_fd) {
+            woken = true;
+            continue;
+        }
+        if (events[i].data.ptr == &loop->timer_fd) {
+            expired = true;
+            continue;
+        }
+
+        struct Connection *conn = events[i].data.ptr;
+        if (conn->protocol == CONN_PROTOCOL_UDP) {
+            ReadDatagrams(conn);
+            continue;
+        }
+        if (conn->protocol == CONN_PROTOCOL_SHM) {
+            if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                ClientLeft(conn);
+            else if (conn->fd >= 0)
+                ServeShm(conn);
+            if (!LaterEvent(events, i, count))
+                ReleaseIfIdle(conn);
+            continue;
+        }
+        if (events[i].events & EPOLLERR)
+            CloseSocket(conn);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+            ReadRequests(conn);
+        if (events[i].events & EPOLLOUT)
+            FlushOutput(conn);
+        ReleaseIfIdle(conn);
+    }
+
+    // Сроки проверяются после событий пачки: ответ, пришедший вместе со
+    // сроком, ещё успевает
+    if (expired)
+        ExpireTimers(loop);
+    if (woken)
+        DrainCompleted(loop);
+}
+
+static bool HandleSignals(struct EventLoop *loop) {
+    if (stop_requested)
+        return true;
+    if (stats_requested) {
+        stats_requested = 0;
+        PrintCacheStats(loop->cache);
+    }
+    return false;
+}
+
+// Соединение, принятое multishot accept: данные приходят multishot recv,
+// в epoll оно не попадает
+static void UringAccepted(struct EventLoop *loop, int fd) {
+    struct Connection *conn = calloc(1, sizeof(struct Connection));
+    conn->fd = fd;
+    conn->loop = loop;
+    conn->uring = true;
+    conn->closing_fd = -1;
+    UringArmRecv(conn);
+    Count(loop, METRICS_ACCEPTED, 1);
+    atomic_fetch_add(&loop->admission->connections, 1);
+}
+
+// Порция multishot recv в буфере кольца: копируется во входной буфер
+// соединения, буфер сразу возвращается ядру
+static void UringReceived(struct Connection *conn, int res, uint32_t flags) {
+    struct Uring *ring = &conn->loop->ring;
+    if (res > 0) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (conn->fd >= 0) {
+            ReserveInput(conn, (size_t)res);
+            memcpy(conn->in + conn->in_len, UringBuffer(ring, bid), (size_t)res);
+            HandleInput(conn, (size_t)res);
+        }
+        UringRecycleBuffer(ring, bid);
+    } else if (res == 0 && conn->fd >= 0) {
+        ClientLeft(conn);
+    } else if (res < 0 && res != -ENOBUFS && conn->fd >= 0) {
+        LOG(LOG_WARN, "Client read failed\n");
+        CloseSocket(conn);
+    }
+    // Без IORING_CQE_F_MORE приём остановлен: кончились буферы кольца или
+    // сокет закрыт
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->uring_ops--;
+        if (conn->fd >= 0)
+            UringArmRecv(conn);
+    }
+}
+
+static void UringSent(struct Connection *conn, int res) {
+    conn->uring_ops--;
+    if (res < 0) {
+        conn->sending_len = 0;
+        if (conn->fd >= 0) {
+            LOG(LOG_WARN, "Can't send data to client\n");
+            CloseSocket(conn);
+        }
+        return;
+    }
+    conn->sending_sent += (size_t)res;
+    Count(conn->loop, METRICS_BYTES_OUT, (uint64_t)res);
+    if (conn->sending_sent < conn->sending_len && conn->fd >= 0) {
+        UringSendRest(conn);
+        return;
+    }
+    conn->sending_len = 0;
+    UringFlush(conn);
+}
+
+static void UringComplete(struct EventLoop *loop, uint64_t user_data, int res, uint32_t flags,
+                          bool *woken) {
+    enum UringOp op = (enum UringOp)(user_data & URING_OP_MASK);
+    if (op == URING_OP_IGNORE)
+        return;
+    if (op == URING_OP_ACCEPT || op == URING_OP_WAKE || op == URING_OP_EPOLL) {
+        if (op == URING_OP_ACCEPT && res >= 0)
+            UringAccepted(loop, res);
+        else if (op == URING_OP_ACCEPT && res != -EAGAIN && res != -ECONNABORTED)
+            LOG(LOG_WARN, "Could not establish new connection\n");
+        if (op == URING_OP_WAKE)
+            *woken = true;
+        if (op == URING_OP_EPOLL) {
+            struct epoll_event events[MAX_EVENTS];
+            int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, 0);
+            if (count > 0)
+                HandleEvents(loop, events, count);
+        }
+        if (!(flags & IORING_CQE_F_MORE))
+            UringArm(loop, op);
+        return;
+    }
+
+    struct Connection *conn =
+        (struct Connection *)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+    if (op == URING_OP_RECV)
+        UringReceived(conn, res, flags);
+    else if (op == URING_OP_SEND)
+        UringSent(conn, res);
+    else
+        conn->uring_ops--;
+    if (conn->fd < 0 && conn->uring_ops == 0 && conn->closing_fd >= 0) {
+        UringPrepClose(UringGetSqe(&loop->ring), conn->closing_fd, URING_OP_IGNORE);
+        conn->closing_fd = -1;
+    }
+    ReleaseIfIdle(conn);
+}
+
+// Цикл на io_uring: новые соединения, приём и отправка идут через кольцо,
+// и один io_uring_enter и отправляет накопленные операции, и ждёт
+// завершений. Слушающий сокет и eventfd уходят из epoll в кольцо.
+static void RunUringLoop(struct EventLoop *loop) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listen_fd, NULL);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->wake_fd, NULL);
+    UringArm(loop, URING_OP_ACCEPT);
+    UringArm(loop, URING_OP_WAKE);
+    UringArm(loop, URING_OP_EPOLL);
+
+    while (true) {
+        int rc = UringSubmit(&loop->ring, 1);
+        if (HandleSignals(loop))
+            return;
+        if (rc < 0 && errno != EINTR) {
+            LOG(LOG_ERROR, "io_uring_enter failed\n");
+            return;
+        }
+
+        bool woken = false;
+        struct io_uring_cqe *cqe;
+        while ((cqe = UringPeekCqe(&loop->ring)) != NULL) {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            UringCqeSeen(&loop->ring);
+            UringComplete(loop, user_data, res, flags, &woken);
+        }
+        if (woken)
+            DrainCompleted(loop);
+    }
+}
+
+static void *RunEventLoop(void *arg) {
+    struct EventLoop *loop = (struct EventLoop *)arg;
+    // Кольцо создаётся в потоке, который будет его обслуживать
+    if (loop->use_uring) {
+        if (UringInit(&loop->ring, URING_ENTRIES, URING_BUFFERS, READ_CHUNK) == 0) {
+            RunUringLoop(loop);
+            return NULL;
+        }
+        LOG(LOG_WARN, "io_uring is not available (errno %d), using epoll\n", errno);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+        if (HandleSignals(loop))
+            return NULL;
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG(LOG_ERROR, "epoll_wait failed\n");
+            return NULL;
+        }
+        HandleEvents(loop, events, count);
+    }
+}
+
+static int InitEventLoop(struct EventLoop *loop, int listen_fd, int unix_fd,
+                         struct ThreadPool *pool,
+                         struct RangeCache *cache, const struct Checkpoint *checkpoints,
+                         int checkpoint_count, struct Metrics *metrics,
+                         struct Admission *admission, bool use_uring, double child_timeout) {
+    loop->listen_fd = listen_fd;
+    loop->unix_fd = unix_fd;
+    loop->pool = pool;
+    loop->cache = cache;
+    loop->checkpoints = checkpoints;
+    loop->checkpoint_count = checkpoint_count;
+    loop->metrics = metrics;
+    loop->admission = admission;
+    loop->use_uring = use_uring;
+    loop->child_timeout = child_timeout;
+    loop->done_head = NULL;
+    pthread_mutex_init(&loop->done_mutex, NULL);
+
+    loop->epoll_fd = epoll_create1(0);
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0 || loop->timer_fd < 0)
+        return -1;
+    TimerWheelInit(&loop->wheel, CHILD_TIMER_TICK, NowSeconds());
+
+    // EPOLLEXCLUSIVE: о новом соединении будится только один из циклов
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = &loop->listen_fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0)
+        return -1;
+    event.data.ptr = &loop->unix_fd;
+    if (unix_fd >= 0 && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, unix_fd, &event) < 0)
+        return -1;
+
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &loop->wake_fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) < 0)
+        return -1;
+    event.data.ptr = &loop->timer_fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->timer_fd, &event) < 0)
+        return -1;
+    return 0;
+}
+
+// Общий UDP-сокет обслуживается каждым циклом через свою псевдо-связь,
+// будится только один из циклов
+static int AddDatagramSocket(struct EventLoop *loop, int udp_fd) {
+    struct Connection *conn = calloc(1, sizeof(struct Connection));
+    conn->fd = udp_fd;
+    conn->loop = loop;
+    conn->protocol = CONN_PROTOCOL_UDP;
+    conn->in_cap = PROTO_MAX_DATAGRAM;
+    conn->in = malloc(conn->in_cap);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = conn;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, udp_fd, &event);
+}
+
+// Список CPU вида "0-3,8". false, если он пуст или записан неверно.
+static bool ParseCpuList(const char *text, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = text;
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+        }
+        if (last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET((int)cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return false;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+// Рабочий процесс worker из workers получает свою подряд идущую часть
+// списка, а если CPU меньше, чем процессов, — один CPU по кругу
+static void WorkerCpus(const cpu_set_t *cpus, int worker, int workers, cpu_set_t *mine) {
+    int list[CPU_SETSIZE];
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus))
+            list[count++] = cpu;
+    }
+    int first = worker % count;
+    int last = first;
+    if (count >= workers) {
+        first = count * worker / workers;
+        last = count * (worker + 1) / workers - 1;
+    }
+    CPU_ZERO(mine);
+    for (int i = first; i <= last; i++)
+        CPU_SET(list[i], mine);
+}
+
+// Порождает рабочие процессы. Возвращает номер процесса в потомке и -1 в
+// родителе; если fork не удался, уже порождённые останавливаются, и
+// родитель получает -2. Потомок умирает вместе с родителем.
+static int SpawnWorkers(int workers, pid_t *pids, const sigset_t *original) {
+    fflush(stdout);
+    for (int i = 0; i < workers; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            pthread_sigmask(SIG_SETMASK, original, NULL);
+            return i;
+        }
+        if (pids[i] < 0) {
+            perror("fork");
+            for (int j = 0; j < i; j++)
+                kill(pids[j], SIGTERM);
+            return -2;
+        }
+    }
+    return -1;
+}
+
+// Родитель только пересылает рабочим SIGINT, SIGTERM и SIGUSR1 и ждёт их.
+// Рабочий, завершившийся сам, не перезапускается: остальные продолжают
+// принимать соединения на том же порту. Возвращает код выхода.
+static int SuperviseWorkers(pid_t *pids, int workers, const sigset_t *wait_mask) {
+    int live = workers;
+    int code = 0;
+    bool forwarded = false;
+    while (live > 0) {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < workers; i++) {
+                if (pids[i] != pid)
+                    continue;
+                pids[i] = 0;
+                live--;
+                if (!stop_requested) {
+                    fprintf(stderr, "Worker %d (pid %d) exited unexpectedly\n", i, (int)pid);
+                    code = 1;
+                }
+            }
+        }
+        if (stop_requested && !forwarded) {
+            forwarded = true;
+            for (int i = 0; i < workers; i++) {
+                if (pids[i] > 0)
+                    kill(pids[i], SIGTERM);
+            }
+        }
+        if (stats_requested) {
+            stats_requested = 0;
+            for (int i = 0; i < workers; i++) {
+                if (pids[i] > 0)
+                    kill(pids[i], SIGUSR1);
+            }
+        }
+        if (live > 0)
+            sigsuspend(wait_mask);
+    }
+    return code;
 }
 
 int main(int argc, char **argv) {
     int tnum = -1;
     int port = -1;
+    int loops = 1;
+    int cache_mb = DEFAULT_CACHE_MB;
+    struct Checkpoint checkpoints[MAX_CHECKPOINTS];
+    int checkpoint_count = 0;
+    int metrics_port = 0;
+    enum LogLevel level = LOG_INFO;
+    bool udp = false;
+    int workers = 1;
+    bool use_uring = false;
+    const char *unix_path = NULL;
+    int child_timeout = DEFAULT_CHILD_TIMEOUT;
+    bool pinned = false;
+    cpu_set_t cpus;
+    struct Admission admission;
+    admission.max_requests = DEFAULT_MAX_REQUESTS;
+    admission.max_work = 0;
+    admission.retry_after_ms = DEFAULT_RETRY_AFTER_MS;
+    atomic_init(&admission.requests, 0);
+    atomic_init(&admission.work, 0);
+    atomic_init(&admission.connections, 0);
 
     while (true) {
         static struct option options[] = {
             {"port", required_argument, 0, 0},
             {"tnum", required_argument, 0, 0},
+            {"loops", required_argument, 0, 0},
+            {"cache-mb", required_argument, 0, 0},
+            {"checkpoint", required_argument, 0, 0},
+            {"metrics-port", required_argument, 0, 0},
+            {"log-level", required_argument, 0, 0},
+            {"udp", no_argument, 0, 0},
+            {"max-requests", required_argument, 0, 0},
+            {"max-work", required_argument, 0, 0},
+            {"retry-after-ms", required_argument, 0, 0},
+            {"workers", required_argument, 0, 0},
+            {"cpus", required_argument, 0, 0},
+            {"io", required_argument, 0, 0},
+            {"unix", required_argument, 0, 0},
+            {"child-timeout", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -54,6 +2216,102 @@ int main(int argc, char **argv) {
                     return 1;
                 }
                 break;
+            case 2:
+                loops = atoi(optarg);
+                if (loops <= 0) {
+                    fprintf(stderr, "Event loop number must be positive\n");
+                    return 1;
+                }
+                break;
+            case 3:
+                cache_mb = atoi(optarg);
+                if (cache_mb < 0) {
+                    fprintf(stderr, "Cache size must not be negative\n");
+                    return 1;
+                }
+                break;
+            case 4:
+                if (checkpoint_count == MAX_CHECKPOINTS) {
+                    fprintf(stderr, "At most %d checkpoint files\n", MAX_CHECKPOINTS);
+                    return 1;
+                }
+                if (CheckpointOpen(&checkpoints[checkpoint_count], optarg, false) != 0)
+                    return 1;
+                printf("Checkpoint %s: mod %lu, %lu points every %lu\n", optarg,
+                       checkpoints[checkpoint_count].header->mod,
+                       checkpoints[checkpoint_count].header->count,
+                       checkpoints[checkpoint_count].header->stride);
+                checkpoint_count++;
+                break;
+            case 5:
+                metrics_port = atoi(optarg);
+                if (metrics_port <= 0) {
+                    fprintf(stderr, "Metrics port must be positive number\n");
+                    return 1;
+                }
+                break;
+            case 6:
+                if (!LogParseLevel(optarg, &level)) {
+                    fprintf(stderr, "Log level must be error, warn, info or debug\n");
+                    return 1;
+                }
+                break;
+            case 7:
+                udp = true;
+                break;
+            case 8:
+            case 9: {
+                char *end;
+                errno = 0;
+                unsigned long long limit = strtoull(optarg, &end, 10);
+                if (errno != 0 || end == optarg || *end != '\0' || optarg[0] == '-') {
+                    fprintf(stderr, "Admission limit must be a non-negative number\n");
+                    return 1;
+                }
+                if (option_index == 8)
+                    admission.max_requests = limit;
+                else
+                    admission.max_work = limit;
+            } break;
+            case 10: {
+                int retry_after = atoi(optarg);
+                if (retry_after <= 0) {
+                    fprintf(stderr, "Retry hint must be positive number of milliseconds\n");
+                    return 1;
+                }
+                admission.retry_after_ms = (uint32_t)retry_after;
+            } break;
+            case 11:
+                workers = atoi(optarg);
+                if (workers <= 0 || workers > MAX_WORKERS) {
+                    fprintf(stderr, "Worker number must be between 1 and %d\n", MAX_WORKERS);
+                    return 1;
+                }
+                break;
+            case 12:
+                if (!ParseCpuList(optarg, &cpus)) {
+                    fprintf(stderr, "CPU list must look like 0-3,8\n");
+                    return 1;
+                }
+                pinned = true;
+                break;
+            case 13:
+                if (strcmp(optarg, "uring") != 0 && strcmp(optarg, "epoll") != 0) {
+                    fprintf(stderr, "I/O engine must be epoll or uring\n");
+                    return 1;
+                }
+                use_uring = strcmp(optarg, "uring") == 0;
+                break;
+            case 14:
+                unix_path = optarg;
+                break;
+            case 15:
+                child_timeout = atoi(optarg);
+                if (child_timeout <= 0) {
+                    fprintf(stderr, "Child timeout must be positive\n");
+                    return 1;
+                }
+                break;
             default:
                 printf("Index %d is out of options\n", option_index);
             }
@@ -68,129 +2326,171 @@ int main(int argc, char **argv) {
     }
 
     if (port == -1 || tnum == -1) {
-        fprintf(stderr, "Using: %s --port 20001 --tnum 4\n", argv[0]);
+        fprintf(stderr,
+                "Using: %s --port 20001 --tnum 4 [--loops 1] [--cache-mb 16] "
+                "[--checkpoint m.ckpt ...] [--metrics-port 9100] "
+                "[--log-level error|warn|info|debug] [--udp] [--max-requests 1024] "
+                "[--max-work 0] [--retry-after-ms 50] [--workers 1] [--cpus 0-3,8] "
+                "[--io epoll|uring] [--unix /tmp/factorial.sock] [--child-timeout %d]\n",
+                argv[0], DEFAULT_CHILD_TIMEOUT);
         return 1;
     }
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        fprintf(stderr, "Can not create server socket!");
-        return 1;
+    // Unix-сокет один на все процессы: его соединения принимает тот, кто
+    // успеет первым
+    int unix_fd = -1;
+    if (unix_path != NULL) {
+        unix_fd = CreateUnixListenSocket(unix_path);
+        if (unix_fd < 0)
+            return 1;
     }
 
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_port = htons((uint16_t)port);
-    server.sin_addr.s_addr = htonl(INADDR_ANY);
-
-    int opt_val = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    // Несколько рабочих процессов слушают порт каждый своим сокетом с
+    // SO_REUSEPORT, ядро распределяет между ними соединения и отправителей
+    // датаграмм. У каждого свои пул, кэш и порт метрик metrics-port + номер.
+    int worker = 0;
+    if (workers > 1) {
+        sigset_t supervised;
+        sigset_t original;
+        sigemptyset(&supervised);
+        sigaddset(&supervised, SIGINT);
+        sigaddset(&supervised, SIGTERM);
+        sigaddset(&supervised, SIGUSR1);
+        sigaddset(&supervised, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &supervised, &original);
 
-    int err = bind(server_fd, (struct sockaddr *)&server, sizeof(server));
-    if (err < 0) {
-        fprintf(stderr, "Can not bind to socket!");
-        return 1;
+        pid_t pids[MAX_WORKERS];
+        worker = SpawnWorkers(workers, pids, &original);
+        if (worker == -2)
+            return 1;
+        if (worker == -1) {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = HandleSignal;
+            sigaction(SIGINT, &action, NULL);
+            sigaction(SIGTERM, &action, NULL);
+            sigaction(SIGUSR1, &action, NULL);
+            action.sa_handler = HandleChild;
+            sigaction(SIGCHLD, &action, NULL);
+            printf("Started %d workers on port %d\n", workers, port);
+            fflush(stdout);
+            int status = SuperviseWorkers(pids, workers, &original);
+            if (unix_path != NULL)
+                unlink(unix_path);
+            return status;
+        }
+        if (metrics_port > 0)
+            metrics_port += worker;
     }
-
-    err = listen(server_fd, 128);
-    if (err < 0) {
-        fprintf(stderr, "Could not listen on socket\n");
-        return 1;
+    if (pinned) {
+        cpu_set_t mine;
+        WorkerCpus(&cpus, worker, workers, &mine);
+        // Потоки пула и циклов событий наследуют привязку
+        if (sched_setaffinity(0, sizeof(mine), &mine) != 0) {
+            fprintf(stderr, "Cannot pin worker %d to its CPUs: %s\n", worker, strerror(errno));
+            return 1;
+        }
     }
 
-    printf("Server listening at %d\n", port);
-
-    while (true) {
-        struct sockaddr_in client;
-        socklen_t client_len = sizeof(client);
-        int client_fd = accept(server_fd, (struct sockaddr *)&client, &client_len);
+    int server_fd = CreateListenSocket(port, true, workers > 1);
+    if (server_fd < 0)
+        return 1;
+    // Тот же номер порта, но UDP: запросы без установки соединения
+    int udp_fd = udp ? CreateUdpSocket(port, workers > 1) : -1;
+    if (udp && udp_fd < 0)
+        return 1;
 
-        if (client_fd < 0) {
-            fprintf(stderr, "Could not establish new connection\n");
-            continue;
+    struct RangeCache cache_storage;
+    struct RangeCache *cache = NULL;
+    if (cache_mb > 0) {
+        if (RangeCacheInit(&cache_storage, (size_t)cache_mb << 20) != 0) {
+            fprintf(stderr, "Could not allocate %d MB cache\n", cache_mb);
+            return 1;
         }
+        cache = &cache_storage;
+    }
 
-        while (true) {
-            unsigned int buffer_size = sizeof(uint64_t) * 3;
-            char from_client[buffer_size];
-            int read_bytes = recv(client_fd, from_client, buffer_size, 0);
-
-            if (read_bytes == 0)
-                break;
-            if (read_bytes < 0) {
-                fprintf(stderr, "Client read failed\n");
-                break;
-            }
-            if (read_bytes < (int)buffer_size) {
-                fprintf(stderr, "Client send wrong data format\n");
-                break;
-            }
-
-            uint64_t begin = 0;
-            uint64_t end = 0;
-            uint64_t mod = 0;
-            memcpy(&begin, from_client, sizeof(uint64_t));
-            memcpy(&end, from_client + sizeof(uint64_t), sizeof(uint64_t));
-            memcpy(&mod, from_client + 2 * sizeof(uint64_t), sizeof(uint64_t));
-
-            fprintf(stdout, "Receive: %lu %lu %lu\n", begin, end, mod);
-
-            uint64_t range = end - begin + 1;
-            int actual_tnum = tnum;
-            
-            if ((uint64_t)tnum > range) {
-                actual_tnum = (int)range;
-            }
+    // Сигналы принимает только главный поток: остальные создаются с
+    // заблокированной маской и наследуют её
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-            pthread_t threads[actual_tnum];
-            struct FactorialArgs args[actual_tnum];
-            
-            uint64_t numbers_per_thread = range / (uint64_t)actual_tnum;
-            uint64_t remainder = range % (uint64_t)actual_tnum;
-            uint64_t current_start = begin;
-
-            for (int i = 0; i < actual_tnum; i++) {
-                args[i].begin = current_start;
-                args[i].end = current_start + numbers_per_thread - 1;
-                
-                if (remainder > 0) {
-                    args[i].end++;
-                    remainder--;
-                }
-                
-                args[i].mod = mod;
-                current_start = args[i].end + 1;
+    struct ThreadPool pool;
+    if (ThreadPoolInit(&pool, tnum) != 0) {
+        fprintf(stderr, "Error: pthread_create failed!\n");
+        return 1;
+    }
 
-                if (pthread_create(&threads[i], NULL, ThreadFactorial, (void *)&args[i])) {
-                    fprintf(stderr, "Error: pthread_create failed!\n");
-                    return 1;
-                }
-            }
+    // Пишут метрики циклы событий и потоки пула, у каждого свой шард
+    struct Metrics metrics_storage;
+    struct Metrics *metrics = NULL;
+    if (metrics_port > 0) {
+        if (MetricsInit(&metrics_storage, metrics_port, loops + tnum, &pool, cache) != 0 ||
+            MetricsStart(&metrics_storage) != 0) {
+            fprintf(stderr, "Could not start metrics listener on port %d\n", metrics_port);
+            return 1;
+        }
+        metrics = &metrics_storage;
+        printf("Metrics at http://127.0.0.1:%d/metrics\n", metrics_port);
+    }
 
-            uint64_t total = 1;
-            for (int i = 0; i < actual_tnum; i++) {
-                uint64_t result = 0;
-                void* thread_result;
-                pthread_join(threads[i], &thread_result);
-                result = (uint64_t)(uintptr_t)thread_result;
-                total = MultModulo(total, result, mod);
-            }
+    struct EventLoop *event_loops = calloc((size_t)loops, sizeof(struct EventLoop));
+    for (int i = 0; i < loops; i++) {
+        if (InitEventLoop(&event_loops[i], server_fd, unix_fd, &pool, cache, checkpoints,
+                          checkpoint_count, metrics, &admission, use_uring,
+                          child_timeout) != 0) {
+            fprintf(stderr, "Could not create event loop\n");
+            return 1;
+        }
+        if (udp_fd >= 0 && AddDatagramSocket(&event_loops[i], udp_fd) != 0) {
+            fprintf(stderr, "Could not watch UDP socket\n");
+            return 1;
+        }
+    }
 
-            printf("Total: %lu\n", total);
+    if (workers > 1)
+        printf("Worker %d (pid %d) listening at %d%s\n", worker, (int)getpid(), port,
+               udp ? " (TCP and UDP)" : "");
+    else
+        printf("Server listening at %d%s\n", port, udp ? " (TCP and UDP)" : "");
+    if (unix_path != NULL && worker == 0)
+        printf("Local clients at unix:%s and shm:%s\n", unix_path, unix_path);
+    fflush(stdout);
+    // Поток записи создаётся с заблокированными сигналами, как и остальные
+    if (LogStart(level) != 0) {
+        fprintf(stderr, "Error: pthread_create failed!\n");
+        return 1;
+    }
 
-            char buffer[sizeof(total)];
-            memcpy(buffer, &total, sizeof(total));
-            err = send(client_fd, buffer, sizeof(total), 0);
-            if (err < 0) {
-                fprintf(stderr, "Can't send data to client\n");
-                break;
-            }
+    // Цикл 0 работает в главном потоке, остальные — в своих
+    for (int i = 1; i < loops; i++) {
+        if (pthread_create(&event_loops[i].thread, NULL, RunEventLoop, &event_loops[i])) {
+            fprintf(stderr, "Error: pthread_create failed!\n");
+            return 1;
         }
-
-        shutdown(client_fd, SHUT_RDWR);
-        close(client_fd);
     }
 
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = HandleSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    RunEventLoop(&event_loops[0]);
+
+    // Остальные циклы и пул не дожидаемся: незавершённые запросы клиентам
+    // уже не нужны, а статистика — последнее, что печатает сервер
+    LogShutdown();
+    printf("Server stopping\n");
+    PrintCacheStats(cache);
     close(server_fd);
+    if (unix_path != NULL && workers == 1)
+        unlink(unix_path);
     return 0;
-}
\ No newline at end of file
+}
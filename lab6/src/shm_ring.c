@@ -0,0 +1,156 @@
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+static void Ring(int bell) {
+    uint64_t one = 1;
+    // Переполнение счётчика eventfd невозможно: читатель сбрасывает его
+    // при каждом пробуждении
+    while (write(bell, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+int ShmCreate(void) {
+    // Имя живёт только до shm_unlink, дальше память держат дескрипторы и
+    // отображения обеих сторон
+    char name[64];
+    static atomic_uint counter;
+    snprintf(name, sizeof(name), "/factorial-%d-%u", (int)getpid(),
+             atomic_fetch_add(&counter, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+    shm_unlink(name);
+    if (ftruncate(fd, sizeof(struct ShmChannel)) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    // Оба читателя начинают спящими: первая запись их будит
+    struct ShmChannel *channel = mmap(NULL, sizeof(*channel), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fd, 0);
+    if (channel == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    atomic_store(&channel->requests.reader_sleeping, 1);
+    atomic_store(&channel->responses.reader_sleeping, 1);
+    munmap(channel, sizeof(*channel));
+    return fd;
+}
+
+int ShmAttach(struct ShmEnd *end, int memory_fd, bool server, int bell, int peer_bell) {
+    struct ShmChannel *channel = mmap(NULL, sizeof(*channel), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, memory_fd, 0);
+    if (channel == MAP_FAILED)
+        return -1;
+    end->channel = channel;
+    end->in = server ? &channel->requests : &channel->responses;
+    end->out = server ? &channel->responses : &channel->requests;
+    end->bell = bell;
+    end->peer_bell = peer_bell;
+    return 0;
+}
+
+void ShmDetach(struct ShmEnd *end) {
+    if (end->channel == NULL)
+        return;
+    munmap(end->channel, sizeof(*end->channel));
+    close(end->bell);
+    close(end->peer_bell);
+    end->channel = NULL;
+}
+
+// Оба индекса лежат в общей памяти, и другая сторона может записать туда
+// что угодно. Поэтому каждый читается один раз, а если занято больше
+// размера кольца, кольцо испорчено: -1 с errno EPROTO. После этой проверки
+// ни одна копия не выходит за data.
+static long RingRead(struct ShmRing *ring, unsigned char *out, size_t size) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (tail - head > SHM_RING_SIZE) {
+        errno = EPROTO;
+        return -1;
+    }
+    size_t n = tail - head < size ? (size_t)(tail - head) : size;
+    size_t offset = head & (SHM_RING_SIZE - 1);
+    size_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+    memcpy(out, ring->data + offset, first);
+    memcpy(out + first, ring->data, n - first);
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return (long)n;
+}
+
+static long RingWrite(struct ShmRing *ring, const unsigned char *in, size_t size) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > SHM_RING_SIZE) {
+        errno = EPROTO;
+        return -1;
+    }
+    size_t space = SHM_RING_SIZE - (size_t)(tail - head);
+    size_t n = size < space ? size : space;
+    size_t offset = tail & (SHM_RING_SIZE - 1);
+    size_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+    memcpy(ring->data + offset, in, first);
+    memcpy(ring->data, in + first, n - first);
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return (long)n;
+}
+
+// Флаг ожидания ставится до повторной проверки кольца, а другая сторона
+// снимает его после своего изменения, поэтому кто-то из двоих обязательно
+// увидит другого: либо ждущий — новые данные, либо другая сторона — флаг.
+long ShmReceive(struct ShmEnd *end, void *data, size_t size) {
+    struct ShmRing *ring = end->in;
+    long n = RingRead(ring, data, size);
+    if (n == 0) {
+        atomic_store(&ring->reader_sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        n = RingRead(ring, data, size);
+        if (n <= 0)
+            return n;
+        atomic_store(&ring->reader_sleeping, 0);
+    }
+    if (n < 0)
+        return -1;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&ring->writer_waiting, 0))
+        Ring(end->peer_bell);
+    return n;
+}
+
+long ShmSend(struct ShmEnd *end, const void *data, size_t size) {
+    struct ShmRing *ring = end->out;
+    long sent = RingWrite(ring, data, size);
+    if (sent >= 0 && (size_t)sent < size) {
+        atomic_store(&ring->writer_waiting, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        long more = RingWrite(ring, (const unsigned char *)data + sent, size - (size_t)sent);
+        sent = more < 0 ? -1 : sent + more;
+        if (sent >= 0 && (size_t)sent == size)
+            atomic_store(&ring->writer_waiting, 0);
+    }
+    if (sent < 0)
+        return -1;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (sent > 0 && atomic_exchange(&ring->reader_sleeping, 0))
+        Ring(end->peer_bell);
+    return sent;
+}
+
+void ShmClearBell(struct ShmEnd *end) {
+    uint64_t count;
+    while (read(end->bell, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Байтов в каждом направлении канала, степень двойки
+#define SHM_RING_SIZE (256 * 1024)
+
+// Кольцо байтов с одним писателем и одним читателем в общей памяти. По
+// нему идут те же кадры v2, что и по сокету. Пока обе стороны заняты,
+// передача обходится без системных вызовов: будить через eventfd нужно,
+// только если читатель заснул на пустом кольце или писатель — на полном.
+struct ShmRing {
+    _Alignas(64) atomic_uint_fast64_t head;     // сколько байт прочитано
+    atomic_int writer_waiting;                  // писатель ждёт места
+    _Alignas(64) atomic_uint_fast64_t tail;     // сколько байт записано
+    atomic_int reader_sleeping;                 // читатель ждёт данных
+    _Alignas(64) unsigned char data[SHM_RING_SIZE];
+};
+
+// Канал: запросы клиента серверу и ответы сервера клиенту
+struct ShmChannel {
+    struct ShmRing requests;
+    struct ShmRing responses;
+};
+
+// Сторона канала в своём процессе
+struct ShmEnd {
+    struct ShmChannel *channel;
+    struct ShmRing *in;
+    struct ShmRing *out;
+    int bell;                   // свой eventfd, его будит другая сторона
+    int peer_bell;              // eventfd другой стороны
+};
+
+// Память под новый канал без имени в файловой системе: дескриптор или -1
+// с errno. Дескриптор передаётся клиенту через unix-сокет (SCM_RIGHTS).
+int ShmCreate(void);
+
+// Отображает канал. Дескрипторы bell и peer_bell переходят во владение
+// end, memory_fd после вызова можно закрыть. 0 или -1 с errno.
+int ShmAttach(struct ShmEnd *end, int memory_fd, bool server, int bell, int peer_bell);
+void ShmDetach(struct ShmEnd *end);
+
+// До size байт из входящего кольца. 0 — кольцо пусто, и писатель разбудит
+// bell, когда запишет ещё. -1 с errno EPROTO — другая сторона испортила
+// индексы кольца, канал надо закрыть.
+long ShmReceive(struct ShmEnd *end, void *data, size_t size);
+
+// Сколько из size байт поместилось в исходящее кольцо. Если не всё,
+// читатель разбудит bell, когда освободит место. -1 — как у ShmReceive.
+long ShmSend(struct ShmEnd *end, const void *data, size_t size);
+
+// Сбрасывает bell перед разбором колец
+void ShmClearBell(struct ShmEnd *end);
+
+#endif
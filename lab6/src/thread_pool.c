@@ -0,0 +1,110 @@
+#include "thread_pool.h"
+
+#include <stdlib.h>
+
+static void *PoolWorker(void *arg) {
+    struct ThreadPool *pool = (struct ThreadPool *)arg;
+
+    while (true) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->head == NULL && !pool->stopping)
+            pthread_cond_wait(&pool->has_work, &pool->mutex);
+
+        if (pool->head == NULL) {
+            // Очередь пуста и пул останавливается
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+
+        struct PoolTask *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pool->queued--;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task->run(task);
+    }
+}
+
+int ThreadPoolInit(struct ThreadPool *pool, int size) {
+    pool->threads = malloc(sizeof(pthread_t) * size);
+    pool->size = 0;
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->queued = 0;
+    pool->stopping = false;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+
+    for (int i = 0; i < size; i++) {
+        if (pthread_create(&pool->threads[i], NULL, PoolWorker, pool) != 0) {
+            ThreadPoolDestroy(pool);
+            return -1;
+        }
+        pool->size++;
+    }
+    return 0;
+}
+
+void ThreadPoolSubmit(struct ThreadPool *pool, struct PoolTask *task) {
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tail != NULL)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->queued++;
+    pthread_cond_signal(&pool->has_work);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+int ThreadPoolQueued(struct ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    int queued = pool->queued;
+    pthread_mutex_unlock(&pool->mutex);
+    return queued;
+}
+
+void ThreadPoolDestroy(struct ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->size; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->size = 0;
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->has_work);
+}
+
+void TaskGroupInit(struct TaskGroup *group, int pending) {
+    group->pending = pending;
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->done, NULL);
+}
+
+void TaskGroupDone(struct TaskGroup *group) {
+    pthread_mutex_lock(&group->mutex);
+    if (--group->pending == 0)
+        pthread_cond_broadcast(&group->done);
+    pthread_mutex_unlock(&group->mutex);
+}
+
+void TaskGroupWait(struct TaskGroup *group) {
+    pthread_mutex_lock(&group->mutex);
+    while (group->pending > 0)
+        pthread_cond_wait(&group->done, &group->mutex);
+    pthread_mutex_unlock(&group->mutex);
+}
+
+void TaskGroupDestroy(struct TaskGroup *group) {
+    pthread_mutex_destroy(&group->mutex);
+    pthread_cond_destroy(&group->done);
+}
@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// Задача пула. Встраивается в структуру вызывающего кода, поэтому очередь
+// не выделяет память на каждую задачу.
+struct PoolTask {
+    void (*run)(struct PoolTask *task);
+    struct PoolTask *next;
+};
+
+// Пул долгоживущих потоков с общей очередью задач
+struct ThreadPool {
+    pthread_t *threads;
+    int size;
+    struct PoolTask *head;
+    struct PoolTask *tail;
+    int queued;                 // задачи в очереди, ещё не взятые потоками
+    bool stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t has_work;
+};
+
+// Счётчик незавершённых задач одной группы, по которому ждёт отправитель
+struct TaskGroup {
+    int pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+};
+
+// Возвращает 0 при успехе, -1 если не удалось создать потоки
+int ThreadPoolInit(struct ThreadPool *pool, int size);
+
+void ThreadPoolSubmit(struct ThreadPool *pool, struct PoolTask *task);
+
+// Длина очереди на момент вызова
+int ThreadPoolQueued(struct ThreadPool *pool);
+
+// Дожидается выполнения уже поставленных задач и останавливает потоки
+void ThreadPoolDestroy(struct ThreadPool *pool);
+
+void TaskGroupInit(struct TaskGroup *group, int pending);
+void TaskGroupDone(struct TaskGroup *group);
+void TaskGroupWait(struct TaskGroup *group);
+void TaskGroupDestroy(struct TaskGroup *group);
+
+#endif
@@ -0,0 +1,78 @@
+#include "timer_wheel.h"
+
+void TimerWheelInit(struct TimerWheel *wheel, double tick_seconds, double now) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+        wheel->slots[i] = NULL;
+    wheel->tick_seconds = tick_seconds;
+    wheel->start = now;
+    wheel->current = 0;
+    wheel->armed = 0;
+}
+
+static uint64_t TickOf(const struct TimerWheel *wheel, double time) {
+    if (time <= wheel->start)
+        return 0;
+    return (uint64_t)((time - wheel->start) / wheel->tick_seconds);
+}
+
+void TimerCancel(struct TimerWheel *wheel, struct Timer *timer) {
+    if (!timer->armed)
+        return;
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        wheel->slots[timer->expires % TIMER_WHEEL_SLOTS] = timer->next;
+    if (timer->next != NULL)
+        timer->next->prev = timer->prev;
+    timer->armed = false;
+    wheel->armed--;
+}
+
+void TimerArm(struct TimerWheel *wheel, struct Timer *timer, double now, double delay) {
+    TimerCancel(wheel, timer);
+    // Округление вверх: таймер не срабатывает раньше срока
+    uint64_t expires = TickOf(wheel, now + delay) + 1;
+    if (expires <= wheel->current)
+        expires = wheel->current + 1;
+
+    struct Timer **slot = &wheel->slots[expires % TIMER_WHEEL_SLOTS];
+    timer->expires = expires;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL)
+        (*slot)->prev = timer;
+    *slot = timer;
+    timer->armed = true;
+    wheel->armed++;
+}
+
+void TimerWheelAdvance(struct TimerWheel *wheel, double now,
+                       void (*expire)(struct Timer *timer, void *arg), void *arg) {
+    uint64_t target = TickOf(wheel, now);
+    while (wheel->current < target) {
+        wheel->current++;
+        if (wheel->armed == 0) {
+            wheel->current = target;
+            break;
+        }
+        struct Timer *timer = wheel->slots[wheel->current % TIMER_WHEEL_SLOTS];
+        while (timer != NULL) {
+            struct Timer *next = timer->next;
+            if (timer->expires <= wheel->current) {
+                TimerCancel(wheel, timer);
+                expire(timer, arg);
+                // expire мог отменить следующий таймер ячейки, начинаем её заново
+                next = wheel->slots[wheel->current % TIMER_WHEEL_SLOTS];
+            }
+            timer = next;
+        }
+    }
+}
+
+int TimerWheelTimeoutMs(const struct TimerWheel *wheel, double now) {
+    if (wheel->armed == 0)
+        return -1;
+    double next_tick = wheel->start + (double)(wheel->current + 1) * wheel->tick_seconds;
+    double ms = (next_tick - now) * 1000;
+    return ms < 0 ? 0 : (int)ms + 1;
+}
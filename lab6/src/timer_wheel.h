@@ -0,0 +1,43 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_SLOTS 512
+
+// Таймер встраивается в структуру владельца, колесо память не выделяет
+struct Timer {
+    uint64_t expires;           // номер тика срабатывания
+    struct Timer *prev;
+    struct Timer *next;
+    bool armed;
+};
+
+// Хешированное колесо таймеров: постановка и отмена за O(1), на тик
+// просматривается одна ячейка. Таймеры дальше одного оборота остаются в
+// своей ячейке до нужного оборота.
+struct TimerWheel {
+    struct Timer *slots[TIMER_WHEEL_SLOTS];
+    double tick_seconds;
+    double start;               // время тика 0
+    uint64_t current;           // последний обработанный тик
+    size_t armed;
+};
+
+void TimerWheelInit(struct TimerWheel *wheel, double tick_seconds, double now);
+
+// Ставит (или переставляет) таймер на now + delay секунд
+void TimerArm(struct TimerWheel *wheel, struct Timer *timer, double now, double delay);
+void TimerCancel(struct TimerWheel *wheel, struct Timer *timer);
+
+// Обрабатывает тики до now и вызывает expire для каждого сработавшего
+// таймера; из expire можно ставить и отменять любые таймеры
+void TimerWheelAdvance(struct TimerWheel *wheel, double now,
+                       void (*expire)(struct Timer *timer, void *arg), void *arg);
+
+// Миллисекунды до следующего тика, -1 если таймеров нет (для epoll_wait)
+int TimerWheelTimeoutMs(const struct TimerWheel *wheel, double now);
+
+#endif
@@ -0,0 +1,215 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static int SysSetup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int SysEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int SysRegister(int fd, unsigned opcode, void *arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void *MapRing(int fd, size_t size, off_t offset) {
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+}
+
+// Буферы приёма: кольцо описателей и сами буферы одним отображением
+static int InitBuffers(struct Uring *ring, unsigned buf_count, size_t buf_size) {
+    ring->buf_count = buf_count;
+    ring->buf_size = buf_size;
+    ring->buf_ring_size = sizeof(struct io_uring_buf) * buf_count;
+    size_t total = ring->buf_ring_size + buf_size * buf_count;
+    void *memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return -1;
+    ring->buf_ring = memory;
+    ring->buffers = (unsigned char *)memory + ring->buf_ring_size;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (SysRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int saved = errno;
+        munmap(memory, total);
+        ring->buf_ring = NULL;
+        errno = saved;
+        return -1;
+    }
+
+    for (unsigned bid = 0; bid < buf_count; bid++) {
+        struct io_uring_buf *buf = &ring->buf_ring->bufs[bid];
+        buf->addr = (uint64_t)(uintptr_t)UringBuffer(ring, bid);
+        buf->len = (uint32_t)buf_size;
+        buf->bid = (uint16_t)bid;
+    }
+    __atomic_store_n(&ring->buf_ring->tail, (uint16_t)buf_count, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int UringInit(struct Uring *ring, unsigned entries, unsigned buf_count, size_t buf_size) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Задачи ядра выполняются только внутри io_uring_enter этого потока, а
+    // не прерывают его посреди разбора запросов
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = SysSetup(entries, &params);
+    if (ring->fd < 0)
+        return -1;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    // IORING_FEAT_SINGLE_MMAP: очереди отправки и завершений в одном отображении
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring = MapRing(ring->fd, ring->ring_size, IORING_OFF_SQ_RING);
+    if (ring->ring == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = MapRing(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->ring, ring->ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    unsigned char *base = ring->ring;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_mask = *(unsigned *)(base + params.sq_off.ring_mask);
+    ring->sq_khead = (unsigned *)(base + params.sq_off.head);
+    ring->sq_ktail = (unsigned *)(base + params.sq_off.tail);
+    ring->sq_array = (unsigned *)(base + params.sq_off.array);
+    ring->sq_tail = *ring->sq_ktail;
+    ring->cq_mask = *(unsigned *)(base + params.cq_off.ring_mask);
+    ring->cq_khead = (unsigned *)(base + params.cq_off.head);
+    ring->cq_ktail = (unsigned *)(base + params.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+    // SQE с номером i всегда лежит в ячейке i массива
+    for (unsigned i = 0; i < ring->sq_entries; i++)
+        ring->sq_array[i] = i;
+
+    if (InitBuffers(ring, buf_count, buf_size) != 0) {
+        int saved = errno;
+        UringDestroy(ring);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+void UringDestroy(struct Uring *ring) {
+    if (ring->buf_ring != NULL)
+        munmap(ring->buf_ring, ring->buf_ring_size + ring->buf_size * ring->buf_count);
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring, ring->ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+int UringSubmit(struct Uring *ring, unsigned wait) {
+    __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+    unsigned pending = ring->sq_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+    if (pending == 0 && wait == 0)
+        return 0;
+    // С DEFER_TASKRUN завершения появляются только внутри GETEVENTS
+    if (SysEnter(ring->fd, pending, wait, IORING_ENTER_GETEVENTS) < 0)
+        return -1;
+    return 0;
+}
+
+struct io_uring_sqe *UringGetSqe(struct Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+    if (ring->sq_tail - head == ring->sq_entries) {
+        // Ядро забирает SQE при отправке синхронно, место появится сразу
+        while (UringSubmit(ring, 0) != 0 && errno == EINTR) {
+        }
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+    ring->sq_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+struct io_uring_cqe *UringPeekCqe(struct Uring *ring) {
+    unsigned head = *ring->cq_khead;
+    if (head == __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void UringCqeSeen(struct Uring *ring) {
+    __atomic_store_n(ring->cq_khead, *ring->cq_khead + 1, __ATOMIC_RELEASE);
+}
+
+unsigned char *UringBuffer(const struct Uring *ring, unsigned bid) {
+    return ring->buffers + ring->buf_size * bid;
+}
+
+void UringRecycleBuffer(struct Uring *ring, unsigned bid) {
+    uint16_t tail = ring->buf_ring->tail;
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (ring->buf_count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)UringBuffer(ring, bid);
+    buf->len = (uint32_t)ring->buf_size;
+    buf->bid = (uint16_t)bid;
+    __atomic_store_n(&ring->buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static void Prep(struct io_uring_sqe *sqe, uint8_t opcode, int fd, const void *addr,
+                 uint32_t len, uint64_t user_data) {
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->user_data = user_data;
+}
+
+void UringPrepAccept(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    Prep(sqe, IORING_OP_ACCEPT, fd, NULL, 0, user_data);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+void UringPrepRecv(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    Prep(sqe, IORING_OP_RECV, fd, NULL, 0, user_data);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+}
+
+void UringPrepSend(struct io_uring_sqe *sqe, int fd, const void *data, size_t size,
+                   uint64_t user_data) {
+    Prep(sqe, IORING_OP_SEND, fd, data, (uint32_t)size, user_data);
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void UringPrepShutdown(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    Prep(sqe, IORING_OP_SHUTDOWN, fd, NULL, SHUT_RDWR, user_data);
+}
+
+void UringPrepClose(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    Prep(sqe, IORING_OP_CLOSE, fd, NULL, 0, user_data);
+}
+
+void UringPrepPoll(struct io_uring_sqe *sqe, int fd, uint32_t events, uint64_t user_data) {
+    Prep(sqe, IORING_OP_POLL_ADD, fd, NULL, IORING_POLL_ADD_MULTI, user_data);
+    sqe->poll32_events = events;
+}
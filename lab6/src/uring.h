@@ -0,0 +1,72 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+// Группа выдаваемых ядру буферов приёма
+#define URING_BUFFER_GROUP 0
+
+// Кольцо io_uring на сырых системных вызовах вместе с кольцом буферов
+// приёма: multishot recv сам берёт из него буфер под каждую порцию данных,
+// после разбора буфер возвращается в кольцо. Кольцо создаётся с
+// IORING_SETUP_SINGLE_ISSUER, поэтому обслуживать его должен поток, который
+// его создал.
+struct Uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_mask;
+    unsigned sq_tail;           // локальный хвост, ядро видит его после UringSubmit
+    unsigned *sq_khead;
+    unsigned *sq_ktail;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned cq_mask;
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    struct io_uring_cqe *cqes;
+    void *ring;                 // очереди отправки и завершений
+    size_t ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    unsigned char *buffers;
+    unsigned buf_count;         // степень двойки
+    size_t buf_size;
+};
+
+// 0 или -1 с errno. Нужно ядро 6.1 и новее: multishot accept и recv,
+// кольцо буферов, IORING_SETUP_DEFER_TASKRUN. На старых ядрах и там, где
+// io_uring запрещён, вызывающий остаётся на epoll.
+int UringInit(struct Uring *ring, unsigned entries, unsigned buf_count, size_t buf_size);
+void UringDestroy(struct Uring *ring);
+
+// Обнулённая SQE. Если очередь полна, накопленные SQE сначала уходят ядру.
+struct io_uring_sqe *UringGetSqe(struct Uring *ring);
+
+// Одним вызовом отправляет накопленные SQE и ждёт не меньше wait
+// завершений. 0 или -1 с errno, EINTR — ожидание прервано сигналом.
+int UringSubmit(struct Uring *ring, unsigned wait);
+
+// Очередное завершение или NULL. UringCqeSeen освобождает его место.
+struct io_uring_cqe *UringPeekCqe(struct Uring *ring);
+void UringCqeSeen(struct Uring *ring);
+
+// Буфер, номер которого пришёл в флагах завершения recv, и его возврат ядру
+unsigned char *UringBuffer(const struct Uring *ring, unsigned bid);
+void UringRecycleBuffer(struct Uring *ring, unsigned bid);
+
+// Multishot accept: одно завершение на каждое новое соединение
+void UringPrepAccept(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+// Multishot recv в буферы группы URING_BUFFER_GROUP
+void UringPrepRecv(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+void UringPrepSend(struct io_uring_sqe *sqe, int fd, const void *data, size_t size,
+                   uint64_t user_data);
+void UringPrepShutdown(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+void UringPrepClose(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+// Multishot poll: завершение на каждое срабатывание events
+void UringPrepPoll(struct io_uring_sqe *sqe, int fd, uint32_t events, uint64_t user_data);
+
+#endif